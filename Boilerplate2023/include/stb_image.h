@@ -116,6 +116,20 @@ STBIDEF int      stbi_is_hdr          (char const *filename);
 STBIDEF int      stbi_is_hdr_from_file(FILE *f);
 #endif // STBI_NO_STDIO
 
+#ifndef STBI_NO_HDR
+// Radiance .hdr scanlines as they are stored, 4 bytes of shared exponent RGBE per
+// pixel (mantissa * 2^(exponent - 136), 0 when the exponent is), for callers that
+// convert them themselves or stream an image too big to decode at once. open returns
+// NULL if the buffer isn't a usable HDR file, and the buffer has to outlive the
+// stream; read writes up to rows scanlines of x * 4 bytes at rgbe and returns how
+// many, fewer at the bottom of the image and 0 on corrupt data.
+typedef struct stbi_hdr_stream stbi_hdr_stream;
+
+STBIDEF stbi_hdr_stream *stbi_hdr_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y);
+STBIDEF int              stbi_hdr_read_rgbe(stbi_hdr_stream *stream, stbi_uc *rgbe, int rows);
+STBIDEF void             stbi_hdr_close(stbi_hdr_stream *stream);
+#endif // STBI_NO_HDR
+
 
 // get a VERY brief reason for failure
 // on most compilers (and ALL modern mainstream compilers) this is threadsafe
@@ -151,6 +165,46 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// use the SSE2 PNG unfiltering when the CPU has it (the default); turning it off
+// gives the scalar loops, e.g. to compare against
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use_simd);
+
+// inflate with a 64-bit bit buffer and wider decode tables (the default); turning
+// it off gives the original byte-at-a-time decoder, which produces the same output
+STBIDEF void stbi_set_zlib_fast(int flag_true_if_should_use_fast_inflate);
+
+// lets the JPEG decoder spread a baseline image over the app's threads: parallel_for
+// must call task(task_context, i) for every i in [0, count), on whichever threads it
+// likes, and return once all of them have. NULL (the default) decodes on the caller.
+typedef void stbi_parallel_task(void *task_context, int index);
+typedef void stbi_parallel_for(void *user, int count, stbi_parallel_task *task, void *task_context);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user);
+
+// decode into memory the caller owns, e.g. a mapped PBO or an arena. Size it with
+// stbi_info_from_memory: y rows of stride bytes, stride at least x*channels, where
+// channels is desired_channels or, if that's 0, the comp the info call returned.
+// Always 8 bits per channel; the 16-bit to 8 conversion, the vertical flip
+// (stbi_set_flip_vertically_on_load) and the stride are applied as the rows are
+// written, and baseline/progressive JPEGs write their rows straight into out.
+// Returns 1 on success, 0 with stbi_failure_reason() otherwise, including when out
+// is too small; out may have been written to then.
+//
+// scratch, if not NULL, holds the decoder's intermediate buffers for the call, so a
+// load that fits doesn't touch the heap; the rest spills to STBI_MALLOC. peak keeps
+// about the most the loads ever wanted from it (never less), to size it by. Needs
+// STBI_THREAD_LOCAL, without it scratch is ignored. One scratch per thread, not
+// shared while in use.
+typedef struct
+{
+   void  *base;
+   size_t size;
+   size_t used, spilled;   // by stb_image, during the call
+   size_t peak;
+} stbi_scratch;
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels,
+                                       stbi_uc *out, size_t out_size, int out_stride, stbi_scratch *scratch);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
@@ -384,7 +438,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -395,7 +449,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -434,6 +488,16 @@ static int stbi__sse2_available(void)
 //
 //  stbi__context struct and start_xxx functions
 
+// where stbi_load_into_from_memory wants the pixels; a loader that writes its
+// rows there itself sets written
+typedef struct
+{
+   stbi_uc *out;
+   size_t size;
+   int stride, flip;
+   int written;
+} stbi__destination;
+
 // stbi__context structure is our basic context used by all images, so it
 // contains all the IO context, plus some basic image information
 typedef struct
@@ -451,6 +515,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   stbi__destination *dest;
 } stbi__context;
 
 
@@ -464,6 +530,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->dest = NULL;
 }
 
 // initialize a callback-based context
@@ -477,6 +544,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->dest = NULL;
 }
 
 #ifndef STBI_NO_STDIO
@@ -616,9 +684,90 @@ static int stbi__err(const char *str)
 }
 #endif
 
+// while stbi_load_into_from_memory runs with a scratch arena, the decoder's own
+// allocations on that thread come out of it: a bump pointer with a 16-byte header
+// holding each block's size, so freeing or growing the newest block works in place
+// and anything else waits for the end of the load. What doesn't fit goes to the
+// heap and counts as spilled for the rest of the load, so peak errs on the big side.
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL stbi_scratch *stbi__scratch;
+#define STBI__SCRATCH_HEADER 16
+
+static int stbi__in_scratch(void *p)
+{
+   stbi_scratch *a = stbi__scratch;
+   return a && (stbi_uc *) p > (stbi_uc *) a->base && (stbi_uc *) p < (stbi_uc *) a->base + a->size;
+}
+#endif
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+#ifdef STBI_THREAD_LOCAL
+   stbi_scratch *a = stbi__scratch;
+   if (a) {
+      size_t need = STBI__SCRATCH_HEADER + ((size + 15) & ~(size_t) 15);
+      if (size < a->size && need <= a->size - a->used) {
+         stbi_uc *p = (stbi_uc *) a->base + a->used;
+         *(size_t *) p = need;
+         a->used += need;
+         if (a->used + a->spilled > a->peak) a->peak = a->used + a->spilled;
+         return p + STBI__SCRATCH_HEADER;
+      }
+      a->spilled += need;
+      if (a->used + a->spilled > a->peak) a->peak = a->used + a->spilled;
+   }
+#endif
+   return STBI_MALLOC(size);
+}
+
+static void stbi__free(void *p)
+{
+#ifdef STBI_THREAD_LOCAL
+   if (stbi__in_scratch(p)) {
+      stbi_scratch *a = stbi__scratch;
+      stbi_uc *block = (stbi_uc *) p - STBI__SCRATCH_HEADER;
+      if (block + *(size_t *) block == (stbi_uc *) a->base + a->used)
+         a->used -= *(size_t *) block;
+      return;
+   }
+#endif
+   STBI_FREE(p);
+}
+
+static void *stbi__realloc_sized(void *p, size_t oldsz, size_t newsz)
+{
+#ifdef STBI_THREAD_LOCAL
+   if (!p)
+      return stbi__malloc(newsz);
+   if (stbi__in_scratch(p)) {
+      stbi_scratch *a = stbi__scratch;
+      stbi_uc *block = (stbi_uc *) p - STBI__SCRATCH_HEADER;
+      size_t need = STBI__SCRATCH_HEADER + ((newsz + 15) & ~(size_t) 15);
+      void *q;
+      if (block + *(size_t *) block == (stbi_uc *) a->base + a->used) {
+         size_t used = (size_t) (block - (stbi_uc *) a->base) + need;
+         if (used <= a->size) {
+            *(size_t *) block = need;
+            a->used = used;
+            if (a->used + a->spilled > a->peak) a->peak = a->used + a->spilled;
+            return p;
+         }
+      }
+      q = stbi__malloc(newsz);
+      if (q) {
+         memcpy(q, p, oldsz < newsz ? oldsz : newsz);
+         stbi__free(p);
+      }
+      return q;
+   }
+   if (stbi__scratch && newsz > oldsz) {
+      stbi_scratch *a = stbi__scratch;
+      a->spilled += newsz - oldsz;
+      if (a->used + a->spilled > a->peak) a->peak = a->used + a->spilled;
+   }
+#endif
+   STBI_NOTUSED(oldsz);
+   return STBI_REALLOC_SIZED(p, oldsz, newsz);
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -735,6 +884,15 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
    stbi__vertically_flip_on_load_global = flag_true_if_should_flip;
 }
 
+static stbi_parallel_for *stbi__parallel_for;
+static void *stbi__parallel_for_user;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user)
+{
+   stbi__parallel_for = parallel_for;
+   stbi__parallel_for_user = user;
+}
+
 #ifndef STBI_THREAD_LOCAL
 #define stbi__vertically_flip_on_load  stbi__vertically_flip_on_load_global
 #else
@@ -816,7 +974,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -832,7 +990,7 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1057,6 +1215,74 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+// the last step of stbi_load_into_from_memory for a loader that returned its own
+// buffer: one pass that narrows 16-bit results and lays the rows out at the caller's
+// stride, bottom-up if flipping
+static int stbi__write_into(stbi__destination *dest, void *result, int w, int h, int channels, int bits)
+{
+   size_t row_bytes = (size_t) w * channels, i;
+   int j;
+   if ((size_t) dest->stride < row_bytes || (size_t) dest->stride * (h-1) + row_bytes > dest->size)
+      return stbi__err("buffer too small", "Output buffer too small");
+   for (j=0; j < h; ++j) {
+      stbi_uc *out = dest->out + (size_t) dest->stride * (dest->flip ? h-1-j : j);
+      if (bits == 16) {
+         stbi__uint16 *in = (stbi__uint16 *) result + row_bytes * j;
+         for (i=0; i < row_bytes; ++i)
+            out[i] = (stbi_uc) (in[i] >> 8);
+      } else
+         memcpy(out, (stbi_uc *) result + row_bytes * j, row_bytes);
+   }
+   return 1;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels,
+                                       stbi_uc *out, size_t out_size, int out_stride, stbi_scratch *scratch)
+{
+   stbi__context s;
+   stbi__result_info ri;
+   stbi__destination dest;
+   void *result;
+   int ok;
+#ifdef STBI_THREAD_LOCAL
+   // a decode nested in this one on the same thread (a job picked up while waiting
+   // in parallel_for) brings its own scratch, or none
+   stbi_scratch *outer = stbi__scratch;
+   if (scratch) {
+      scratch->used = (16 - ((size_t) scratch->base & 15)) & 15;
+      if (scratch->used > scratch->size) scratch->used = scratch->size;
+      scratch->spilled = 0;
+   }
+   stbi__scratch = scratch;
+#else
+   STBI_NOTUSED(scratch);
+#endif
+
+   if (desired_channels < 0 || desired_channels > 4 || out_stride < 0)
+      ok = stbi__err("bad req_comp", "Internal error");
+   else {
+      stbi__start_mem(&s,buffer,len);
+      dest.out = out;
+      dest.size = out_size;
+      dest.stride = out_stride;
+      dest.flip = stbi__vertically_flip_on_load;
+      dest.written = 0;
+      s.dest = &dest;
+      result = stbi__load_main(&s,x,y,channels_in_file,desired_channels,&ri,8);
+      ok = result != NULL;
+      if (result && !dest.written) {
+         ok = stbi__write_into(&dest, result, *x, *y, desired_channels ? desired_channels : *channels_in_file, ri.bits_per_channel);
+         stbi__free(result);
+      }
+   }
+
+#ifdef STBI_THREAD_LOCAL
+   if (scratch) scratch->used = scratch->spilled = 0;
+   stbi__scratch = outer;
+#endif
+   return ok;
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1379,7 +1605,7 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1404,12 +1630,12 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1436,7 +1662,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1461,12 +1687,12 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1478,7 +1704,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    float *output;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1491,7 +1717,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1504,7 +1730,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1521,7 +1747,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -2549,9 +2775,241 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// multithreaded baseline decoding, with stbi_set_parallel_for. When the scan has
+// restart markers and the whole file is in memory, the intervals are located by
+// scanning for RSTn and decoded independently, IDCT included, a group of intervals
+// per task. Otherwise the entropy decoder, which is inherently serial, runs one band
+// of MCU rows ahead of the IDCT: while it decodes band b into coefficients, the other
+// tasks transform band b-1, one MCU row each.
+
+#define STBI__JPEG_MAX_TASKS  64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   int blocks, per_row, mcus;       // blocks per MCU, MCUs per row and in the scan
+   int status[STBI__JPEG_MAX_TASKS]; // per task: 1 done, 0 corrupt, -1 out of memory
+
+   // restart intervals
+   stbi_uc **starts;
+   int intervals, per_task;
+
+   // bands: the one being entropy decoded and the one in the IDCT
+   short *coeff[2];
+   int next, next_first, next_count, next_done;
+   int idct_first, idct_done;
+} stbi__jpeg_tasks;
+
+static int stbi__jpeg_mcu_blocks(stbi__jpeg *z)
+{
+   int k, blocks = 0;
+   if (z->scan_n == 1) return 1;
+   for (k=0; k < z->scan_n; ++k)
+      blocks += z->img_comp[z->order[k]].h * z->img_comp[z->order[k]].v;
+   return blocks;
+}
+
+// where block k of MCU m goes, in the order stbi__parse_entropy_coded_data decodes
+// them; in a non-interleaved scan every block is an MCU
+static stbi_uc *stbi__jpeg_block_out(stbi__jpeg *z, int m, int k, int *comp)
+{
+   int c, n, i, j;
+   if (z->scan_n == 1) {
+      int w = (z->img_comp[z->order[0]].x+7) >> 3;
+      n = z->order[0];
+      *comp = n;
+      return z->img_comp[n].data + z->img_comp[n].w2*(m / w)*8 + (m % w)*8;
+   }
+   i = m % z->img_mcu_x;
+   j = m / z->img_mcu_x;
+   for (c=0; c < z->scan_n; ++c) {
+      int h, v;
+      n = z->order[c];
+      h = z->img_comp[n].h;
+      v = z->img_comp[n].v;
+      if (k < h*v) {
+         *comp = n;
+         return z->img_comp[n].data + z->img_comp[n].w2*(j*v + k/h)*8 + (i*h + k%h)*8;
+      }
+      k -= h*v;
+   }
+   *comp = z->order[0];
+   return z->img_comp[z->order[0]].data; // not reached
+}
+
+// entropy decode MCUs [first, first+count), each block through the IDCT or, with
+// coeff, stored there in decode order; *done counts the finished MCUs. 2 when a
+// restart interval ended in something other than RSTn, where the serial decoder
+// gives up on the rest of the scan
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int count, short *coeff, int *done)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int m, k, n, blocks = stbi__jpeg_mcu_blocks(z);
+   for (m=first; m < first+count; ++m) {
+      for (k=0; k < blocks; ++k) {
+         short *block = coeff ? coeff + 64 * ((m-first)*blocks + k) : data;
+         stbi_uc *out = stbi__jpeg_block_out(z, m, k, &n);
+         int ha = z->img_comp[n].ha;
+         if (!stbi__jpeg_decode_block(z, block, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         if (!coeff) z->idct_block_kernel(out, z->img_comp[n].w2, block);
+      }
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         if (!STBI__RESTART(z->marker)) {
+            *done = m - first + 1;
+            return 2;
+         }
+         stbi__jpeg_reset(z);
+      }
+   }
+   *done = count;
+   return 1;
+}
+
+// the start of every restart interval's data and the marker ending the scan; 0
+// unless exactly the expected number of intervals is there
+static int stbi__jpeg_find_restarts(stbi__jpeg *z, stbi_uc **starts, int intervals, stbi_uc **end)
+{
+   stbi_uc *p = z->s->img_buffer, *e = z->s->img_buffer_end;
+   int found = 1;
+   starts[0] = p;
+   for (; p+1 < e; ++p) {
+      // 0xff is stuffed as ff 00 in the data and markers may be padded with more 0xff
+      if (p[0] != 0xff || p[1] == 0x00 || p[1] == 0xff) continue;
+      if (!STBI__RESTART(p[1])) {
+         *end = p;
+         return found == intervals;
+      }
+      if (found == intervals) return 0;
+      starts[found++] = p+2;
+      ++p;
+   }
+   return 0;
+}
+
+static void stbi__jpeg_restart_task(void *context, int index)
+{
+   stbi__jpeg_tasks *t = (stbi__jpeg_tasks *) context;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   stbi__context s;
+   int i, done, last = (index+1) * t->per_task;
+   t->status[index] = -1;
+   if (!z) return;
+   // its own decoder state and read position; tables and components are shared
+   *z = *t->z;
+   s = *t->z->s;
+   z->s = &s;
+   if (last > t->intervals) last = t->intervals;
+   t->status[index] = 1;
+   for (i=index * t->per_task; i < last; ++i) {
+      int first = i * z->restart_interval, count = t->mcus - first;
+      if (count > z->restart_interval) count = z->restart_interval;
+      s.img_buffer = t->starts[i];
+      stbi__jpeg_reset(z);
+      if (!stbi__jpeg_decode_mcus(z, first, count, NULL, &done)) {
+         t->status[index] = 0;
+         break;
+      }
+   }
+   stbi__free(z);
+}
+
+static void stbi__jpeg_band_task(void *context, int index)
+{
+   stbi__jpeg_tasks *t = (stbi__jpeg_tasks *) context;
+   stbi__jpeg *z = t->z;
+   if (index == 0) {
+      if (t->next_count)
+         t->status[0] = stbi__jpeg_decode_mcus(z, t->next_first, t->next_count, t->coeff[t->next], &t->next_done);
+   } else {
+      int m, k, n;
+      int m0 = t->idct_first + (index-1) * t->per_row, m1 = m0 + t->per_row;
+      short *coeff = t->coeff[t->next ^ 1];
+      if (m1 > t->idct_first + t->idct_done) m1 = t->idct_first + t->idct_done;
+      for (m=m0; m < m1; ++m)
+         for (k=0; k < t->blocks; ++k) {
+            stbi_uc *out = stbi__jpeg_block_out(z, m, k, &n);
+            z->idct_block_kernel(out, z->img_comp[n].w2, coeff + 64 * ((m - t->idct_first)*t->blocks + k));
+         }
+   }
+}
+
+static int stbi__jpeg_parse_baseline_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_tasks t;
+   int i, rows, band_rows, band_mcus;
+   void *raw;
+   memset(&t, 0, sizeof(t));
+   t.z = z;
+   t.blocks = stbi__jpeg_mcu_blocks(z);
+   if (z->scan_n == 1) {
+      t.per_row = (z->img_comp[z->order[0]].x+7) >> 3;
+      rows = (z->img_comp[z->order[0]].y+7) >> 3;
+   } else {
+      t.per_row = z->img_mcu_x;
+      rows = z->img_mcu_y;
+   }
+   t.mcus = t.per_row * rows;
+
+   if (z->restart_interval && !z->s->read_from_callbacks) {
+      stbi_uc *end;
+      t.intervals = (t.mcus + z->restart_interval-1) / z->restart_interval;
+      t.starts = (stbi_uc **) stbi__malloc_mad2(t.intervals, sizeof(stbi_uc *), 0);
+      if (t.starts && stbi__jpeg_find_restarts(z, t.starts, t.intervals, &end)) {
+         int tasks = t.intervals < STBI__JPEG_MAX_TASKS ? t.intervals : STBI__JPEG_MAX_TASKS;
+         t.per_task = (t.intervals + tasks-1) / tasks;
+         tasks = (t.intervals + t.per_task-1) / t.per_task;
+         stbi__parallel_for(stbi__parallel_for_user, tasks, stbi__jpeg_restart_task, &t);
+         stbi__free(t.starts);
+         for (i=0; i < tasks; ++i) {
+            if (t.status[i] < 0) return stbi__err("outofmem", "Out of memory");
+            if (t.status[i] == 0) return stbi__err("bad huffman code","Corrupt JPEG");
+         }
+         // where the serial decoder would have stopped
+         z->s->img_buffer = end + 2;
+         z->marker = end[1];
+         z->nomore = 1;
+         return 1;
+      }
+      stbi__free(t.starts);
+   }
+
+   // bands of about 64 pixel rows, double buffered
+   band_rows = 64 / (z->scan_n == 1 ? 8 : z->img_mcu_h);
+   if (band_rows < 1) band_rows = 1;
+   if (band_rows > STBI__JPEG_MAX_TASKS-1) band_rows = STBI__JPEG_MAX_TASKS-1;
+   band_mcus = band_rows * t.per_row;
+   raw = stbi__malloc_mad3(band_mcus, t.blocks, 2 * 64 * sizeof(short), 15);
+   if (!raw) return stbi__err("outofmem", "Out of memory");
+   t.coeff[0] = (short *) (((size_t) raw + 15) & ~15);
+   t.coeff[1] = t.coeff[0] + 64 * band_mcus * t.blocks;
+   t.next = 0;
+   t.next_first = 0;
+   for (;;) {
+      int stopped = t.status[0] == 2 || t.next_first >= t.mcus;
+      t.next_count = stopped ? 0 : t.mcus - t.next_first < band_mcus ? t.mcus - t.next_first : band_mcus;
+      if (!t.next_count && !t.idct_done) break;
+      t.next_done = 0;
+      if (t.status[0] != 2) t.status[0] = 1;
+      stbi__parallel_for(stbi__parallel_for_user, 1 + (t.idct_done + t.per_row-1) / t.per_row, stbi__jpeg_band_task, &t);
+      if (t.status[0] == 0) {
+         stbi__free(raw);
+         return stbi__err("bad huffman code","Corrupt JPEG");
+      }
+      t.idct_first = t.next_first;
+      t.idct_done = t.next_done;
+      t.next_first += t.next_count;
+      t.next ^= 1;
+   }
+   stbi__free(raw);
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
+   if (!z->progressive && stbi__parallel_for)
+      return stbi__jpeg_parse_baseline_parallel(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
@@ -2680,21 +3138,47 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
       data[i] *= dequant[i];
 }
 
+// dequantize and idct block row j of component n
+static void stbi__jpeg_finish_row(stbi__jpeg *z, int n, int j)
+{
+   int i, w = (z->img_comp[n].x+7) >> 3;
+   for (i=0; i < w; ++i) {
+      short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+      stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+      z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+   }
+}
+
+// task index runs over the block rows of every component in turn
+static void stbi__jpeg_finish_task(void *context, int index)
+{
+   stbi__jpeg *z = (stbi__jpeg *) context;
+   int n;
+   for (n=0; n < z->s->img_n; ++n) {
+      int h = (z->img_comp[n].y+7) >> 3;
+      if (index < h) {
+         stbi__jpeg_finish_row(z, n, index);
+         return;
+      }
+      index -= h;
+   }
+}
+
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
       // dequantize and idct the data
-      int i,j,n;
+      int j,n,rows = 0;
+      if (stbi__parallel_for) {
+         for (n=0; n < z->s->img_n; ++n)
+            rows += (z->img_comp[n].y+7) >> 3;
+         stbi__parallel_for(stbi__parallel_for_user, rows, stbi__jpeg_finish_task, z);
+         return;
+      }
       for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
-         }
+         for (j=0; j < h; ++j)
+            stbi__jpeg_finish_row(z, n, j);
       }
    }
 }
@@ -2846,17 +3330,17 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3445,6 +3929,155 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// resample and color-convert output rows [y0, y1), row j at output + stride*j
+// (stride is negative when flipping), res_comp holding the resampler state for row
+// y0. With 3 channels the loops write a 4th byte past the row, so those rows are
+// converted in row_buf (n*img_x+1 bytes) and copied: with every_row when the output
+// isn't our own tightly packed buffer, else only the last row, when it's a band
+// that isn't the bottom one, not to race the band below.
+static void stbi__jpeg_output_rows(stbi__jpeg *z, stbi_uc *output, int stride, int n, int decode_n, int is_rgb, stbi__resample *res_comp, stbi_uc **linebuf, unsigned int y0, unsigned int y1, stbi_uc *row_buf, int every_row)
+{
+   unsigned int i,j;
+   int k;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *row = row_buf && (every_row || j+1 == y1) ? row_buf : output + (ptrdiff_t) stride * j;
+      stbi_uc *out = row;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+      if (row == row_buf)
+         memcpy(output + (ptrdiff_t) stride * j, row_buf, n * z->s->img_x);
+   }
+}
+
+// the resampler state after the first y output rows
+static void stbi__resample_seek(stbi__jpeg *z, stbi__resample *r, int k, int y)
+{
+   int t = (r->vs >> 1) + y, wraps = t / r->vs, last = z->img_comp[k].y - 1;
+   r->ystep = t % r->vs;
+   r->ypos  = wraps;
+   r->line1 = z->img_comp[k].data + z->img_comp[k].w2 * (wraps < last ? wraps : last);
+   r->line0 = wraps ? z->img_comp[k].data + z->img_comp[k].w2 * (wraps-1 < last ? wraps-1 : last) : z->img_comp[k].data;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc *output, *linebufs;
+   int stride, n, decode_n, is_rgb, every_row, rows_per_task, task_bytes;
+   stbi__resample *res_comp; // for row 0
+} stbi__jpeg_output_tasks;
+
+static void stbi__jpeg_output_task(void *context, int index)
+{
+   stbi__jpeg_output_tasks *t = (stbi__jpeg_output_tasks *) context;
+   stbi__jpeg *z = t->z;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4], *row_buf;
+   unsigned int y0 = index * t->rows_per_task, y1 = y0 + t->rows_per_task;
+   int k;
+   if (y1 > z->s->img_y) y1 = z->s->img_y;
+   // per task: decode_n line buffers, then a row of output
+   linebuf[0] = t->linebufs + index * t->task_bytes;
+   for (k=0; k < t->decode_n; ++k) {
+      res_comp[k] = t->res_comp[k];
+      stbi__resample_seek(z, &res_comp[k], k, y0);
+      linebuf[k] = linebuf[0] + k * (z->s->img_x + 3);
+   }
+   row_buf = linebuf[0] + t->decode_n * (z->s->img_x + 3);
+   stbi__jpeg_output_rows(z, t->output, t->stride, t->n, t->decode_n, t->is_rgb, res_comp, linebuf, y0, y1,
+                          t->every_row || y1 < z->s->img_y ? row_buf : NULL, t->every_row);
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3472,10 +4105,11 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      int k, tasks, stride, every_row;
+      stbi_uc *output, *row_buf = NULL;
+      stbi_uc *linebuf[4];
+      stbi__destination *dest = z->s->dest;
+      stbi__jpeg_output_tasks t;
 
       stbi__resample res_comp[4];
 
@@ -3501,106 +4135,60 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          else                               r->resample = stbi__resample_row_generic;
       }
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+      // can't error after this so, this is safe; stbi_load_into_from_memory's rows go
+      // straight to its buffer, flipped by walking it bottom-up
+      stride = n * z->s->img_x;
+      every_row = 0;
+      if (dest) {
+         if (dest->stride < stride || (size_t) dest->stride * (z->s->img_y-1) + stride > dest->size) { stbi__cleanup_jpeg(z); return stbi__errpuc("buffer too small", "Output buffer too small"); }
+         stride = dest->stride;
+         output = dest->out;
+         if (dest->flip) {
+            output += (ptrdiff_t) stride * (z->s->img_y-1);
+            stride = -stride;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
+         every_row = n == 3;
+         if (every_row) {
+            row_buf = (stbi_uc *) stbi__malloc(n * z->s->img_x + 1);
+            if (!row_buf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
          }
+      } else {
+         output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+         if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
       }
+
+      // now go ahead and resample, in bands of rows on the app's threads if it gave us
+      // some; each band seeks its own resampler state and has its own line buffers
+      tasks = stbi__parallel_for ? (z->s->img_y + 31) / 32 : 1;
+      if (tasks > STBI__JPEG_MAX_TASKS) tasks = STBI__JPEG_MAX_TASKS;
+      if (tasks > 1) {
+         t.task_bytes = decode_n * (z->s->img_x + 3) + n * z->s->img_x + 1;
+         t.linebufs = (stbi_uc *) stbi__malloc_mad2(tasks, t.task_bytes, 0);
+         if (!t.linebufs) tasks = 1;
+      }
+      if (tasks > 1) {
+         t.z = z;
+         t.output = output;
+         t.stride = stride;
+         t.every_row = every_row;
+         t.n = n;
+         t.decode_n = decode_n;
+         t.is_rgb = is_rgb;
+         t.rows_per_task = (z->s->img_y + tasks-1) / tasks;
+         t.res_comp = res_comp;
+         stbi__parallel_for(stbi__parallel_for_user, (z->s->img_y + t.rows_per_task-1) / t.rows_per_task, stbi__jpeg_output_task, &t);
+         stbi__free(t.linebufs);
+      } else {
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_output_rows(z, output, stride, n, decode_n, is_rgb, res_comp, linebuf, 0, z->s->img_y, row_buf, every_row);
+      }
+      stbi__free(row_buf);
       stbi__cleanup_jpeg(z);
+      if (dest) {
+         dest->written = 1;
+         output = dest->out;
+      }
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
       if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
@@ -3617,7 +4205,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    j->s = s;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 
@@ -3630,7 +4218,7 @@ static int stbi__jpeg_test(stbi__context *s)
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
@@ -3653,7 +4241,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    if (!j) return stbi__err("outofmem", "Out of memory");
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 #endif
@@ -3672,6 +4260,13 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
+// the fast inflate path decodes a whole symbol, length or distance base and extra
+// bit count included, from one lookup into these wider tables
+#define STBI__ZWIDE_BITS       11
+#define STBI__ZWIDE_MASK       ((1 << STBI__ZWIDE_BITS) - 1)
+#define STBI__ZWIDE_DIST_BITS  10
+#define STBI__ZWIDE_DIST_MASK  ((1 << STBI__ZWIDE_DIST_BITS) - 1)
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -3766,6 +4361,8 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   stbi__uint32 wide_length[1 << STBI__ZWIDE_BITS];
+   stbi__uint32 wide_distance[1 << STBI__ZWIDE_DIST_BITS];
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -3851,7 +4448,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -3874,7 +4471,162 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int stbi__parse_huffman_block(stbi__zbuf *a)
+static int stbi__zlib_fast = 1;
+
+STBIDEF void stbi_set_zlib_fast(int flag_true_if_should_use_fast_inflate)
+{
+   stbi__zlib_fast = flag_true_if_should_use_fast_inflate;
+}
+
+#if defined(_MSC_VER) && _MSC_VER < 1600
+typedef unsigned __int64 stbi__zbits;
+#else
+typedef unsigned long long stbi__zbits;
+#endif
+
+// wide table entry: bits 0-3 code length (0 = not in the table), 4-7 extra bits,
+// 8-9 kind (0 literal, 1 length or distance, 2 end of block, 3 invalid), 16-31 the
+// literal or the length/distance base
+static stbi__uint32 stbi__zwide_entry(int symbol, int size, int distance)
+{
+   if (distance)
+      return symbol < 30 ? ((stbi__uint32) stbi__zdist_base[symbol] << 16) | (stbi__zdist_extra[symbol] << 4) | (1 << 8) | size : (3 << 8) | size;
+   if (symbol < 256) return ((stbi__uint32) symbol << 16) | size;
+   if (symbol == 256) return (2 << 8) | size;
+   symbol -= 257;
+   return symbol < 29 ? ((stbi__uint32) stbi__zlength_base[symbol] << 16) | (stbi__zlength_extra[symbol] << 4) | (1 << 8) | size : (3 << 8) | size;
+}
+
+// sizelist has been through stbi__zbuild_huffman already, so it's a valid code
+static void stbi__zbuild_wide(stbi__uint32 *table, int bits, const stbi_uc *sizelist, int num, int distance)
+{
+   int i, code, next_code[16], sizes[16];
+   memset(sizes, 0, sizeof(sizes));
+   memset(table, 0, sizeof(*table) << bits);
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   sizes[0] = 0;
+   code = 0;
+   for (i=1; i < 16; ++i) {
+      next_code[i] = code;
+      code = (code + sizes[i]) << 1;
+   }
+   for (i=0; i < num; ++i) {
+      int s = sizelist[i];
+      if (s && s <= bits) {
+         stbi__uint32 e = stbi__zwide_entry(i, s, distance);
+         int j = stbi__bit_reverse(next_code[s], s);
+         for (; j < (1 << bits); j += 1 << s)
+            table[j] = e;
+      }
+      if (s) ++next_code[s];
+   }
+}
+
+// codes longer than the wide table; 0 for an invalid code
+static stbi__uint32 stbi__zwide_slowpath(stbi__zhuffman *z, unsigned int bits, int distance)
+{
+   int b,s,k = stbi__bit_reverse(bits & 0xffff, 16);
+   for (s=1; s < 16; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s >= 16) return 0;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b >= STBI__ZNSYMS || z->size[b] != s) return 0;
+   return stbi__zwide_entry(z->value[b], s, distance);
+}
+
+stbi_inline static stbi__zbits stbi__zload64(const stbi_uc *p)
+{
+   // byte by byte so it's right on any endianness; compilers merge it into one load
+   return (stbi__zbits) p[0]       | (stbi__zbits) p[1] << 8  | (stbi__zbits) p[2] << 16 | (stbi__zbits) p[3] << 24 |
+          (stbi__zbits) p[4] << 32 | (stbi__zbits) p[5] << 40 | (stbi__zbits) p[6] << 48 | (stbi__zbits) p[7] << 56;
+}
+
+#define STBI__ZWIDE_SLACK  (258 + 16) // longest match plus what the copy loop overwrites
+
+// decodes while at least 8 input bytes and a full match plus slack of output are
+// left, refilling a 64-bit buffer without branches: the next 8 bytes are ORed in
+// and the pointer advances by the whole bytes that fit, so a byte already partly
+// held is read again with the same bits. 56 bits cover a length and a distance
+// with their extra bits. Returns 1 at the end of the block, 0 on error, 2 when
+// the rest is left to the byte-at-a-time loop, with the whole bytes still
+// buffered handed back to the input.
+static int stbi__parse_huffman_block_wide(stbi__zbuf *a)
+{
+   stbi__zbits bits = a->code_buffer;
+   int count = a->num_bits, result = 2;
+   stbi_uc *in = a->zbuffer, *in_end = a->zbuffer_end;
+   stbi_uc *zout = (stbi_uc *) a->zout, *zout_start = (stbi_uc *) a->zout_start, *zout_end = (stbi_uc *) a->zout_end;
+   if (in_end - in < 8 || zout_end - zout < STBI__ZWIDE_SLACK) return 2;
+   do {
+      stbi__uint32 e;
+      int n, len, dist;
+      stbi_uc *p;
+      bits |= stbi__zload64(in) << count;
+      in += (63 - count) >> 3;
+      count |= 56;
+
+      e = a->wide_length[bits & STBI__ZWIDE_MASK];
+      if (!e) e = stbi__zwide_slowpath(&a->z_length, (unsigned int) bits, 0);
+      if (!e) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      n = e & 15;
+      bits >>= n;
+      count -= n;
+      if (!(e & 0x300)) {
+         *zout++ = (stbi_uc) (e >> 16);
+         continue;
+      }
+      if ((e & 0x300) != 0x100) {
+         result = (e & 0x300) == 0x200 ? 1 : stbi__err("bad huffman code","Corrupt PNG");
+         break;
+      }
+      n = (e >> 4) & 15;
+      len = (int) (e >> 16) + (int) (bits & ((1u << n) - 1));
+      bits >>= n;
+      count -= n;
+
+      e = a->wide_distance[bits & STBI__ZWIDE_DIST_MASK];
+      if (!e) e = stbi__zwide_slowpath(&a->z_distance, (unsigned int) bits, 1);
+      if (!e || (e & 0x300) != 0x100) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      n = e & 15;
+      bits >>= n;
+      count -= n;
+      n = (e >> 4) & 15;
+      dist = (int) (e >> 16) + (int) (bits & ((1u << n) - 1));
+      bits >>= n;
+      count -= n;
+      if (zout - zout_start < dist) { result = stbi__err("bad dist","Corrupt PNG"); break; }
+
+      // whole chunks may run up to 15 bytes past the match, inside the slack; a
+      // chunk never overlaps its own source, and later chunks read earlier ones
+      p = zout - dist;
+      if (dist >= 16) {
+         stbi_uc *end = zout + len;
+         do { memcpy(zout, p, 16); zout += 16; p += 16; } while (zout < end);
+         zout = end;
+      } else if (dist >= 8) {
+         stbi_uc *end = zout + len;
+         do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < end);
+         zout = end;
+      } else if (dist == 1) {
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         do *zout++ = *p++; while (--len);
+      }
+   } while (in_end - in >= 8 && zout_end - zout >= STBI__ZWIDE_SLACK);
+
+   a->zbuffer = in - (count >> 3);
+   count &= 7;
+   a->code_buffer = (stbi__uint32) bits & ((1u << count) - 1);
+   a->num_bits = count;
+   a->zout = (char *) zout;
+   return result;
+}
+
+// with hand_back, returns 2 right after growing the output so the wide loop can take over again
+static int stbi__parse_huffman_block_bytewise(stbi__zbuf *a, int hand_back)
 {
    char *zout = a->zout;
    for(;;) {
@@ -3884,6 +4636,11 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          if (zout >= a->zout_end) {
             if (!stbi__zexpand(a, zout, 1)) return 0;
             zout = a->zout;
+            if (hand_back) {
+               *zout++ = (char) z;
+               a->zout = zout;
+               return 2;
+            }
          }
          *zout++ = (char) z;
       } else {
@@ -3894,16 +4651,18 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
             return 1;
          }
          z -= 257;
+         if (z >= 29) return stbi__err("bad huffman code","Corrupt PNG");
          len = stbi__zlength_base[z];
          if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
          z = stbi__zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return stbi__err("bad huffman code","Corrupt PNG");
+         if (z < 0 || z >= 30) return stbi__err("bad huffman code","Corrupt PNG");
          dist = stbi__zdist_base[z];
          if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
          if (zout - a->zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
          if (zout + len > a->zout_end) {
             if (!stbi__zexpand(a, zout, len)) return 0;
             zout = a->zout;
+            hand_back = hand_back ? 2 : 0;
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
@@ -3912,10 +4671,27 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
+         if (hand_back == 2) {
+            a->zout = zout;
+            return 2;
+         }
       }
    }
 }
 
+static int stbi__parse_huffman_block(stbi__zbuf *a)
+{
+   for (;;) {
+      int r;
+      if (stbi__zlib_fast) {
+         r = stbi__parse_huffman_block_wide(a);
+         if (r != 2) return r;
+      }
+      r = stbi__parse_huffman_block_bytewise(a, stbi__zlib_fast);
+      if (r != 2) return r;
+   }
+}
+
 static int stbi__compute_huffman_codes(stbi__zbuf *a)
 {
    static const stbi_uc length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
@@ -3963,6 +4739,10 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   if (stbi__zlib_fast) {
+      stbi__zbuild_wide(a->wide_length, STBI__ZWIDE_BITS, lencodes, hlit, 0);
+      stbi__zbuild_wide(a->wide_distance, STBI__ZWIDE_DIST_BITS, lencodes+hlit, hdist, 1);
+   }
    return 1;
 }
 
@@ -4056,6 +4836,10 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            if (stbi__zlib_fast) {
+               stbi__zbuild_wide(a->wide_length, STBI__ZWIDE_BITS, stbi__zdefault_length, STBI__ZNSYMS, 0);
+               stbi__zbuild_wide(a->wide_distance, STBI__ZWIDE_DIST_BITS, stbi__zdefault_distance, 32, 1);
+            }
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4086,7 +4870,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4107,7 +4891,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4134,7 +4918,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4224,6 +5008,129 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+static int stbi__png_simd = 1;
+
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use_simd)
+{
+   stbi__png_simd = flag_true_if_should_use_simd;
+}
+
+#ifdef STBI_SSE2
+// one pixel of n = 3, 4, 6 or 8 bytes in the low lanes; memcpy so that nothing
+// past the pixel is touched
+static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+   stbi__uint32 lo = 0, hi = 0;
+   switch (n) {
+      case 3: memcpy(&lo, p, 3); break;
+      case 4: memcpy(&lo, p, 4); break;
+      case 6: memcpy(&lo, p, 4); memcpy(&hi, p+4, 2); break;
+      default: return _mm_loadl_epi64((const __m128i *) p);
+   }
+   return _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) lo), _mm_cvtsi32_si128((int) hi));
+}
+
+static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n)
+{
+   stbi__uint32 lo = (stbi__uint32) _mm_cvtsi128_si32(v), hi;
+   switch (n) {
+      case 3: memcpy(p, &lo, 3); break;
+      case 4: memcpy(p, &lo, 4); break;
+      case 6: hi = (stbi__uint32) _mm_cvtsi128_si32(_mm_srli_si128(v, 4)); memcpy(p, &lo, 4); memcpy(p+4, &hi, 2); break;
+      default: _mm_storel_epi64((__m128i *) p, v); break;
+   }
+}
+
+// reverses one row's filter from its second pixel on, like the scalar loops in
+// stbi__create_png_image_raw; bpp is the filter's byte distance, so 16-bit rows
+// are 6 or 8. Up is 16 bytes at a time. Sub with 4 or 8 bytes per pixel is a
+// prefix sum within the register; the rest depends on the previous pixel and goes
+// one pixel per step in a register. Per pixel only pays off with enough bytes per
+// pixel, so where it measured no faster than the compiled scalar loop (Sub with 3,
+// Avg below 8, Paeth with 3) this returns 0 and the scalar loop runs.
+static int stbi__png_unfilter_row_sse2(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk, int bpp)
+{
+   int k = 0;
+   __m128i zero = _mm_setzero_si128();
+   if (!stbi__png_simd || !stbi__sse2_available()) return 0;
+   if (bpp != 3 && bpp != 4 && bpp != 6 && bpp != 8) return 0;
+   if (bpp == 3 && filter != STBI__F_up) return 0;
+   if (bpp != 8 && filter == STBI__F_avg) return 0;
+
+   switch (filter) {
+      case STBI__F_up:
+         for (; k+16 <= nk; k += 16)
+            _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw+k)), _mm_loadu_si128((const __m128i *) (prior+k))));
+         for (; k < nk; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         return 1;
+
+      case STBI__F_sub: {
+         __m128i a = stbi__png_load_pixel(cur - bpp, bpp);
+         if (bpp == 4 || bpp == 8) {
+            a = bpp == 4 ? _mm_shuffle_epi32(a, 0x00) : _mm_unpacklo_epi64(a, a);
+            for (; k+16 <= nk; k += 16) {
+               __m128i d = _mm_loadu_si128((const __m128i *) (raw+k));
+               if (bpp == 4) {
+                  d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+                  d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+               } else
+                  d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+               d = _mm_add_epi8(d, a);
+               _mm_storeu_si128((__m128i *) (cur+k), d);
+               a = bpp == 4 ? _mm_shuffle_epi32(d, 0xff) : _mm_unpackhi_epi64(d, d);
+            }
+         }
+         for (; k < nk; k += bpp) {
+            a = _mm_add_epi8(stbi__png_load_pixel(raw+k, bpp), a);
+            stbi__png_store_pixel(cur+k, a, bpp);
+         }
+         return 1;
+      }
+
+      case STBI__F_avg: {
+         __m128i a = stbi__png_load_pixel(cur - bpp, bpp);
+         for (; k < nk; k += bpp) {
+            __m128i b = stbi__png_load_pixel(prior+k, bpp);
+            // _mm_avg_epu8 rounds up, PNG rounds down
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            a = _mm_add_epi8(stbi__png_load_pixel(raw+k, bpp), avg);
+            stbi__png_store_pixel(cur+k, a, bpp);
+         }
+         return 1;
+      }
+
+      case STBI__F_paeth: {
+         // in 16-bit lanes: pa = |b-c|, pb = |a-c|, pc = |a+b-2c|, and the first of
+         // a, b, c whose distance is the smallest wins, as in stbi__paeth
+         __m128i a = _mm_unpacklo_epi8(stbi__png_load_pixel(cur - bpp, bpp), zero);
+         __m128i c = _mm_unpacklo_epi8(stbi__png_load_pixel(prior - bpp, bpp), zero);
+         for (; k < nk; k += bpp) {
+            __m128i b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior+k, bpp), zero);
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i smallest, use_a, use_b, predicted, x;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(_mm_min_epi16(pa, pb), pc);
+            use_a = _mm_cmpeq_epi16(smallest, pa);
+            use_b = _mm_cmpeq_epi16(smallest, pb);
+            predicted = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+            predicted = _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, predicted));
+            x = _mm_add_epi8(stbi__png_load_pixel(raw+k, bpp), _mm_packus_epi16(predicted, predicted));
+            stbi__png_store_pixel(cur+k, x, bpp);
+            a = _mm_unpacklo_epi8(x, zero);
+            c = b;
+         }
+         return 1;
+      }
+   }
+   return 0;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4311,6 +5218,10 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          #define STBI__CASE(f) \
              case f:     \
                 for (k=0; k < nk; ++k)
+#ifdef STBI_SSE2
+         if (depth >= 8 && stbi__png_unfilter_row_sse2(filter, cur, raw, prior, nk, filter_bytes))
+            filter = -1; // done, skip the scalar loops
+#endif
          switch (filter) {
             // "none" filter turns into a memcpy here; make that explicit.
             case STBI__F_none:         memcpy(cur, raw, nk); break;
@@ -4463,7 +5374,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4474,7 +5385,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4563,7 +5474,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+   stbi__free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -4760,7 +5671,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
                STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -4778,7 +5689,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            stbi__free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
@@ -4804,7 +5715,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;
@@ -4857,9 +5768,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5156,7 +6067,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5168,7 +6079,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5225,13 +6136,13 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
       for (j=0; j < (int) s->img_y; ++j) {
          if (easy) {
@@ -5499,7 +6410,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5508,7 +6419,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5519,8 +6430,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
       }
@@ -5601,7 +6512,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
+         stbi__free( tga_palette );
       }
    }
 
@@ -5793,7 +6704,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -6085,7 +6996,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
@@ -6199,13 +7110,13 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
    if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
@@ -6509,12 +7420,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 
 static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
 {
-   STBI_FREE(g->out);
-   STBI_FREE(g->history);
-   STBI_FREE(g->background);
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
 
-   if (out) STBI_FREE(out);
-   if (delays && *delays) STBI_FREE(*delays);
+   if (out) stbi__free(out);
+   if (delays && *delays) stbi__free(*delays);
    return stbi__errpuc("outofmem", "Out of memory");
 }
 
@@ -6549,7 +7460,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             stride = g.w * g.h * 4;
 
             if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
+               void *tmp = (stbi_uc*) stbi__realloc_sized(out, out_size, layers * stride );
                if (!tmp)
                   return stbi__load_gif_main_outofmem(&g, out, delays);
                else {
@@ -6558,7 +7469,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
                }
 
                if (delays) {
-                  int *new_delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized(*delays, delays_size, sizeof(int) * layers );
                   if (!new_delays)
                      return stbi__load_gif_main_outofmem(&g, out, delays);
                   *delays = new_delays;
@@ -6588,9 +7499,9 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
 
       // do the final conversion after loading everything;
       if (req_comp && req_comp != 4)
@@ -6622,12 +7533,12 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
          u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -6713,24 +7624,19 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
    }
 }
 
-static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+// the header, up to the first scanline
+static int stbi__hdr_header(stbi__context *s, int *x, int *y)
 {
    char buffer[STBI__HDR_BUFLEN];
    char *token;
    int valid = 0;
    int width, height;
-   stbi_uc *scanline;
-   float *hdr_data;
-   int len;
-   unsigned char count, value;
-   int i, j, k, c1,c2, z;
    const char *headerToken;
-   STBI_NOTUSED(ri);
 
    // Check identifier
    headerToken = stbi__hdr_gettoken(s,buffer);
    if (strcmp(headerToken, "#?RADIANCE") != 0 && strcmp(headerToken, "#?RGBE") != 0)
-      return stbi__errpf("not HDR", "Corrupt HDR image");
+      return stbi__err("not HDR", "Corrupt HDR image");
 
    // Parse header
    for(;;) {
@@ -6739,21 +7645,90 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
       if (strcmp(token, "FORMAT=32-bit_rle_rgbe") == 0) valid = 1;
    }
 
-   if (!valid)    return stbi__errpf("unsupported format", "Unsupported HDR format");
+   if (!valid)    return stbi__err("unsupported format", "Unsupported HDR format");
 
    // Parse width and height
    // can't use sscanf() if we're not using stdio!
    token = stbi__hdr_gettoken(s,buffer);
-   if (strncmp(token, "-Y ", 3))  return stbi__errpf("unsupported data layout", "Unsupported HDR format");
+   if (strncmp(token, "-Y ", 3))  return stbi__err("unsupported data layout", "Unsupported HDR format");
    token += 3;
    height = (int) strtol(token, &token, 10);
    while (*token == ' ') ++token;
-   if (strncmp(token, "+X ", 3))  return stbi__errpf("unsupported data layout", "Unsupported HDR format");
+   if (strncmp(token, "+X ", 3))  return stbi__err("unsupported data layout", "Unsupported HDR format");
    token += 3;
    width = (int) strtol(token, NULL, 10);
 
-   if (height > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
-   if (width > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
+   if (height > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+   if (width > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+   if (width <= 0 || height <= 0) return stbi__err("bad size", "Corrupt HDR image");
+
+   *x = width;
+   *y = height;
+   return 1;
+}
+
+// one scanline of RGBE, stored flat or run-length coded a channel at a time. Once a
+// scanline turns out to be flat, *flat latches: the rest of the image is stored so too
+static int stbi__hdr_scanline(stbi__context *s, stbi_uc *rgbe, int width, int *flat)
+{
+   int i, k, z, len, c1, c2;
+   unsigned char count, value;
+
+   if (*flat || width < 8 || width >= 32768) {
+      stbi__getn(s, rgbe, width * 4);
+      return 1;
+   }
+   c1 = stbi__get8(s);
+   c2 = stbi__get8(s);
+   len = stbi__get8(s);
+   if (c1 != 2 || c2 != 2 || (len & 0x80)) {
+      // not run-length encoded, so we have to actually use THIS data as a decoded
+      // pixel (note this can't be a valid pixel--one of RGB must be >= 128)
+      rgbe[0] = (stbi_uc) c1;
+      rgbe[1] = (stbi_uc) c2;
+      rgbe[2] = (stbi_uc) len;
+      rgbe[3] = (stbi_uc) stbi__get8(s);
+      stbi__getn(s, rgbe + 4, (width - 1) * 4);
+      *flat = 1;
+      return 1;
+   }
+   len <<= 8;
+   len |= stbi__get8(s);
+   if (len != width) return stbi__err("invalid decoded scanline length", "corrupt HDR");
+
+   for (k = 0; k < 4; ++k) {
+      int nleft;
+      i = 0;
+      while ((nleft = width - i) > 0) {
+         count = stbi__get8(s);
+         if (count > 128) {
+            // Run
+            value = stbi__get8(s);
+            count -= 128;
+            if (count > nleft) return stbi__err("corrupt", "bad RLE data in HDR");
+            for (z = 0; z < count; ++z)
+               rgbe[i++ * 4 + k] = value;
+         } else {
+            // Dump; an empty one is only ever what reading past the end gives
+            if (count == 0 || count > nleft) return stbi__err("corrupt", "bad RLE data in HDR");
+            for (z = 0; z < count; ++z)
+               rgbe[i++ * 4 + k] = stbi__get8(s);
+         }
+      }
+   }
+   return 1;
+}
+
+static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   int width, height;
+   stbi_uc *scanline;
+   float *hdr_data;
+   int i, j, flat = 0;
+   STBI_NOTUSED(ri);
+
+   if (!stbi__hdr_header(s, &width, &height))
+      return NULL;
 
    *x = width;
    *y = height;
@@ -6766,82 +7741,63 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 
    // Read data
    hdr_data = (float *) stbi__malloc_mad4(width, height, req_comp, sizeof(float), 0);
-   if (!hdr_data)
+   scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
+   if (!hdr_data || !scanline) {
+      stbi__free(scanline);
+      stbi__free(hdr_data);
       return stbi__errpf("outofmem", "Out of memory");
+   }
 
-   // Load image data
-   // image data is stored as some number of sca
-   if ( width < 8 || width >= 32768) {
-      // Read flat data
-      for (j=0; j < height; ++j) {
-         for (i=0; i < width; ++i) {
-            stbi_uc rgbe[4];
-           main_decode_loop:
-            stbi__getn(s, rgbe, 4);
-            stbi__hdr_convert(hdr_data + j * width * req_comp + i * req_comp, rgbe, req_comp);
-         }
+   for (j = 0; j < height; ++j) {
+      if (!stbi__hdr_scanline(s, scanline, width, &flat)) {
+         stbi__free(scanline);
+         stbi__free(hdr_data);
+         return NULL;
       }
-   } else {
-      // Read RLE-encoded data
-      scanline = NULL;
-
-      for (j = 0; j < height; ++j) {
-         c1 = stbi__get8(s);
-         c2 = stbi__get8(s);
-         len = stbi__get8(s);
-         if (c1 != 2 || c2 != 2 || (len & 0x80)) {
-            // not run-length encoded, so we have to actually use THIS data as a decoded
-            // pixel (note this can't be a valid pixel--one of RGB must be >= 128)
-            stbi_uc rgbe[4];
-            rgbe[0] = (stbi_uc) c1;
-            rgbe[1] = (stbi_uc) c2;
-            rgbe[2] = (stbi_uc) len;
-            rgbe[3] = (stbi_uc) stbi__get8(s);
-            stbi__hdr_convert(hdr_data, rgbe, req_comp);
-            i = 1;
-            j = 0;
-            STBI_FREE(scanline);
-            goto main_decode_loop; // yes, this makes no sense
-         }
-         len <<= 8;
-         len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) {
-            scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
-            if (!scanline) {
-               STBI_FREE(hdr_data);
-               return stbi__errpf("outofmem", "Out of memory");
-            }
-         }
+      for (i=0; i < width; ++i)
+         stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
+   }
+   stbi__free(scanline);
+   return hdr_data;
+}
 
-         for (k = 0; k < 4; ++k) {
-            int nleft;
-            i = 0;
-            while ((nleft = width - i) > 0) {
-               count = stbi__get8(s);
-               if (count > 128) {
-                  // Run
-                  value = stbi__get8(s);
-                  count -= 128;
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = value;
-               } else {
-                  // Dump
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = stbi__get8(s);
-               }
-            }
-         }
-         for (i=0; i < width; ++i)
-            stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
-      }
-      if (scanline)
-         STBI_FREE(scanline);
+struct stbi_hdr_stream
+{
+   stbi__context s;
+   int width, height;
+   int row, flat;
+};
+
+STBIDEF stbi_hdr_stream *stbi_hdr_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi_hdr_stream *h = (stbi_hdr_stream *) STBI_MALLOC(sizeof(stbi_hdr_stream));
+   if (!h) {
+      stbi__err("outofmem", "Out of memory");
+      return NULL;
+   }
+   stbi__start_mem(&h->s, buffer, len);
+   if (!stbi__hdr_header(&h->s, &h->width, &h->height)) {
+      STBI_FREE(h);
+      return NULL;
    }
+   h->row = h->flat = 0;
+   *x = h->width;
+   *y = h->height;
+   return h;
+}
 
-   return hdr_data;
+STBIDEF int stbi_hdr_read_rgbe(stbi_hdr_stream *h, stbi_uc *rgbe, int rows)
+{
+   int n;
+   for (n = 0; n < rows && h->row < h->height; ++n, ++h->row)
+      if (!stbi__hdr_scanline(&h->s, rgbe + (size_t) n * h->width * 4, h->width, &h->flat))
+         return 0;
+   return n;
+}
+
+STBIDEF void stbi_hdr_close(stbi_hdr_stream *h)
+{
+   STBI_FREE(h);
 }
 
 static int stbi__hdr_info(stbi__context *s, int *x, int *y, int *comp)
@@ -0,0 +1,465 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stb_image.h>
+#include "imaging.hpp"
+#include "jobs.hpp"
+#include "mappedfile.hpp"
+
+#include <iostream>
+
+// skyline bottom-left rectangle packing: the free space is the area above a
+// piecewise constant skyline, and each rectangle goes where its top ends lowest,
+// ties to where it wastes the least area under it. Never moves what's placed, so
+// rectangles can keep coming for as long as there's room.
+class SkylinePacker
+{
+public:
+    SkylinePacker() { init(0, 0); }
+
+    void init(int packWidth, int packHeight)
+    {
+        width = packWidth;
+        height = packHeight;
+        usedArea = 0;
+        skyline.assign(1, Segment());
+        skyline[0].x = skyline[0].y = 0;
+        skyline[0].width = width;
+    }
+
+    // false if there's no room left for w x h
+    bool insert(int w, int h, int &x, int &y)
+    {
+        int best = -1, bestTop = INT_MAX;
+        int64_t bestWaste = INT64_MAX;
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            int top;
+            int64_t waste;
+            if (fits(i, w, h, top, waste) && (top < bestTop || (top == bestTop && waste < bestWaste)))
+            {
+                best = (int)i;
+                bestTop = top;
+                bestWaste = waste;
+            }
+        }
+        if (best < 0)
+            return false;
+        x = skyline[best].x;
+        y = bestTop - h;
+
+        // the new segment, then whatever of the following ones it covers cut away
+        Segment segment;
+        segment.x = x;
+        segment.y = bestTop;
+        segment.width = w;
+        skyline.insert(skyline.begin() + best, segment);
+        for (size_t i = best + 1; i < skyline.size();)
+        {
+            int overlap = x + w - skyline[i].x;
+            if (overlap <= 0)
+                break;
+            if (overlap < skyline[i].width)
+            {
+                skyline[i].x += overlap;
+                skyline[i].width -= overlap;
+                break;
+            }
+            skyline.erase(skyline.begin() + i);
+        }
+        for (size_t i = 0; i + 1 < skyline.size();)
+            if (skyline[i].y == skyline[i + 1].y)
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            }
+            else
+                i++;
+        usedArea += (int64_t)w * h;
+        return true;
+    }
+
+    // the fraction of the area rectangles were placed in
+    float occupancy() const { return width && height ? (float)usedArea / ((float)width * height) : 0.0f; }
+
+private:
+    struct Segment
+    {
+        int x, y, width;
+    };
+
+    std::vector<Segment> skyline; // left to right, covering the whole width
+    int width, height;
+    int64_t usedArea;
+
+    // whether w x h fits with its left edge on segment i, resting on the highest
+    // segment under it: then where its top ends and the area it leaves beneath
+    bool fits(size_t i, int w, int h, int &top, int64_t &waste) const
+    {
+        int x = skyline[i].x;
+        if (x + w > width)
+            return false;
+        int y = 0;
+        for (size_t j = i; j < skyline.size() && skyline[j].x < x + w; j++)
+            y = std::max(y, skyline[j].y);
+        if (y + h > height)
+            return false;
+        waste = 0;
+        for (size_t j = i; j < skyline.size() && skyline[j].x < x + w; j++)
+            waste += (int64_t)(y - skyline[j].y) * (std::min(skyline[j].x + skyline[j].width, x + w) - skyline[j].x);
+        top = y + h;
+        return true;
+    }
+};
+
+// where an image ended up: its page, its texels there (without the padding) and the
+// matching UV rectangle, (u0, v0, u1, v1), v counting rows as they are stored
+struct AtlasEntry
+{
+    int page; // -1 if it didn't fit a page
+    int x, y, width, height;
+    glm::vec4 uv;
+};
+
+// packs many small images into a few RGBA8 atlas pages so everything drawn from
+// them can share one texture binding and go in one draw call.
+//
+// Each image is padded on every side by repeating its edge texels, so bilinear
+// filtering never reaches a neighbour, and the padded cell is rounded up to a
+// multiple of 2^(mipLevels - 1) texels and placed on that grid. Every mip level is
+// then box filtered (in linear light, imaging.hpp) from cells of whole 2x2 blocks,
+// so no level mixes two images either; pages stop at mipLevels levels, past which
+// that would no longer hold.
+//
+// Images can be added at any time, from any thread: pages and their mip levels are
+// kept in memory, each page remembers the cells that changed, and upload() on the GL
+// thread creates new pages and sends only those rectangles with glTexSubImage2D.
+// Every member takes the lock, and the accessors return copies, so nothing they hand
+// out changes under a reader while another thread adds.
+class TextureAtlas
+{
+public:
+    TextureAtlas(int pageSize = 2048, int padding = 4, int mipLevels = 3)
+    {
+        size = pageSize;
+        pad = padding;
+        levels = std::max(1, std::min(mipLevels, 8));
+        grid = 1 << (levels - 1);
+    }
+
+    ~TextureAtlas() { deleteTextures(); }
+
+    // an 8-bit image with 1 to 4 channels, rows top down; the image's id, its index
+    // in remapTable(), or -1 if it can never fit a page
+    int add(const unsigned char *pixels, int width, int height, int channels)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        AtlasEntry entry = {-1, 0, 0, width, height, glm::vec4(0.0f)};
+        entries.push_back(entry);
+        place((int)entries.size() - 1, pixels, width, height, channels);
+        return entries[entries.size() - 1].page < 0 ? -1 : (int)entries.size() - 1;
+    }
+
+    // an image file, decoded by stb_image; -1 if it can't be
+    int add(const std::string &path)
+    {
+        MappedFile file;
+        int width, height, channels;
+        unsigned char *pixels = file.open(path.c_str()) ? stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, 4) : NULL;
+        if (!pixels)
+        {
+            std::cout << "ERROR::ATLAS::CANNOT_DECODE: " << path << std::endl;
+            return -1;
+        }
+        int id = add(pixels, width, height, 4);
+        stbi_image_free(pixels);
+        return id;
+    }
+
+    // a batch of image files, decoded on the job system if there is one and packed
+    // tallest first, which packs tighter than arrival order; ids in the order of
+    // paths, -1 where one failed
+    std::vector<int> add(const std::vector<std::string> &paths, JobSystem *jobs)
+    {
+        struct Decoded
+        {
+            unsigned char *pixels;
+            int width, height;
+        };
+        std::vector<Decoded> images(paths.size());
+        auto decode = [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                MappedFile file;
+                int channels;
+                images[i].pixels = file.open(paths[i].c_str())
+                                       ? stbi_load_from_memory(file.data, (int)file.size, &images[i].width, &images[i].height, &channels, 4)
+                                       : NULL;
+            }
+        };
+        if (jobs)
+            jobs->parallelFor(0, (unsigned int)paths.size(), decode);
+        else
+            decode(0, (unsigned int)paths.size());
+
+        std::vector<unsigned int> order(paths.size());
+        for (unsigned int i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+            return (images[a].pixels ? images[a].height : 0) > (images[b].pixels ? images[b].height : 0);
+        });
+        std::vector<int> ids(paths.size(), -1);
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t first = entries.size();
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            AtlasEntry entry = {-1, 0, 0, images[i].width, images[i].height, glm::vec4(0.0f)};
+            entries.push_back(entry);
+        }
+        for (unsigned int i : order)
+        {
+            if (!images[i].pixels)
+            {
+                std::cout << "ERROR::ATLAS::CANNOT_DECODE: " << paths[i] << std::endl;
+                continue;
+            }
+            place((int)(first + i), images[i].pixels, images[i].width, images[i].height, 4);
+            stbi_image_free(images[i].pixels);
+            ids[i] = entries[first + i].page < 0 ? -1 : (int)(first + i);
+        }
+        return ids;
+    }
+
+    AtlasEntry entry(int id) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries[id];
+    }
+
+    int count() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)entries.size();
+    }
+
+    int pageCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)pages.size();
+    }
+
+    int pageSize() const { return size; }
+    int mipLevels() const { return levels; }
+
+    float occupancy(int page) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pages[page].packer.occupancy();
+    }
+
+    // a copy of one level of a page, RGBA8, (pageSize() >> level) texels a side
+    std::vector<unsigned char> pageLevel(int page, int level) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pages[page].levels[level];
+    }
+
+    // an image's own UV (0..1 over the image) to its page's
+    glm::vec2 remap(int id, glm::vec2 uv) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const glm::vec4 &rect = entries[id].uv;
+        return glm::vec2(rect.x, rect.y) + uv * glm::vec2(rect.z - rect.x, rect.w - rect.y);
+    }
+
+    // per id the (scale.u, scale.v, offset.u, offset.v) remap() applies, to upload as a
+    // uniform array or buffer texture and remap in the shader
+    std::vector<glm::vec4> remapTable() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<glm::vec4> table(entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const glm::vec4 &rect = entries[i].uv;
+            table[i] = glm::vec4(rect.z - rect.x, rect.w - rect.y, rect.x, rect.y);
+        }
+        return table;
+    }
+
+    // GL thread: storage for pages added since the last call, then every changed
+    // cell on every level; returns the bytes sent
+    uint64_t upload()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t bytes = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t p = 0; p < pages.size(); p++)
+        {
+            Page &page = pages[p];
+            if (page.dirty.empty())
+                continue;
+            if (!page.texture)
+            {
+                glGenTextures(1, &page.texture);
+                glBindTexture(GL_TEXTURE_2D, page.texture);
+                for (int level = 0; level < levels; level++)
+                    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, size >> level, size >> level, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+            else
+                glBindTexture(GL_TEXTURE_2D, page.texture);
+
+            // past a few dozen rectangles one bounding box is cheaper than the calls
+            if (page.dirty.size() > 32)
+            {
+                Rect bounds = page.dirty[0];
+                for (size_t i = 1; i < page.dirty.size(); i++)
+                {
+                    const Rect &r = page.dirty[i];
+                    int right = std::max(bounds.x + bounds.width, r.x + r.width), bottom = std::max(bounds.y + bounds.height, r.y + r.height);
+                    bounds.x = std::min(bounds.x, r.x);
+                    bounds.y = std::min(bounds.y, r.y);
+                    bounds.width = right - bounds.x;
+                    bounds.height = bottom - bounds.y;
+                }
+                page.dirty.assign(1, bounds);
+            }
+            for (size_t i = 0; i < page.dirty.size(); i++)
+                for (int level = 0; level < levels; level++)
+                {
+                    // cells sit on the grid, so every level's rectangle is whole texels
+                    const Rect &r = page.dirty[i];
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, size >> level);
+                    glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x >> level);
+                    glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y >> level);
+                    glTexSubImage2D(GL_TEXTURE_2D, level, r.x >> level, r.y >> level, r.width >> level, r.height >> level, GL_RGBA,
+                                    GL_UNSIGNED_BYTE, &page.levels[level][0]);
+                    bytes += (uint64_t)(r.width >> level) * (r.height >> level) * 4;
+                }
+            page.dirty.clear();
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return bytes;
+    }
+
+    // the page's texture, 0 until upload() has created it
+    unsigned int texture(int page) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pages[page].texture;
+    }
+
+    // GL thread
+    void deleteTextures()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t p = 0; p < pages.size(); p++)
+            if (pages[p].texture)
+            {
+                glDeleteTextures(1, &pages[p].texture);
+                pages[p].texture = 0;
+            }
+    }
+
+private:
+    struct Rect
+    {
+        int x, y, width, height;
+    };
+
+    struct Page
+    {
+        unsigned int texture;
+        SkylinePacker packer; // in grid cells
+        std::vector<unsigned char> levels[8];
+        std::vector<Rect> dirty; // cells not uploaded yet, in level 0 texels
+    };
+
+    int size, pad, levels, grid;
+    std::vector<Page> pages;
+    std::vector<AtlasEntry> entries;
+    mutable std::mutex mutex;
+
+    // mutex held: packs entries[id] into the first page with room, a new one if none has
+    void place(int id, const unsigned char *pixels, int width, int height, int channels)
+    {
+        int cellWidth = (width + 2 * pad + grid - 1) / grid, cellHeight = (height + 2 * pad + grid - 1) / grid;
+        if (width <= 0 || height <= 0 || cellWidth * grid > size || cellHeight * grid > size)
+        {
+            std::cout << "ERROR::ATLAS::TOO_LARGE: " << width << "x" << height << " doesn't fit a " << size << " page" << std::endl;
+            return;
+        }
+        int page = 0, x = 0, y = 0;
+        while (page < (int)pages.size() && !pages[page].packer.insert(cellWidth, cellHeight, x, y))
+            page++;
+        if (page == (int)pages.size())
+        {
+            pages.push_back(Page());
+            pages.back().texture = 0;
+            pages.back().packer.init(size / grid, size / grid);
+            for (int level = 0; level < levels; level++)
+                pages.back().levels[level].assign((size_t)(size >> level) * (size >> level) * 4, 0);
+            pages.back().packer.insert(cellWidth, cellHeight, x, y);
+        }
+
+        Page &target = pages[page];
+        Rect cell = {x * grid, y * grid, cellWidth * grid, cellHeight * grid};
+        AtlasEntry &entry = entries[id];
+        entry.page = page;
+        entry.x = cell.x + pad;
+        entry.y = cell.y + pad;
+        entry.uv = glm::vec4(entry.x, entry.y, entry.x + width, entry.y + height) / (float)size;
+
+        // the image, its edges repeated out to the cell's edges
+        static const int expand[5][4] = {{0, 0, 0, -1}, {0, 0, 0, -1}, {0, 0, 0, 1}, {0, 1, 2, -1}, {0, 1, 2, 3}};
+        for (int cy = 0; cy < cell.height; cy++)
+        {
+            int sy = std::min(std::max(cy - pad, 0), height - 1);
+            unsigned char *out = &target.levels[0][((size_t)(cell.y + cy) * size + cell.x) * 4];
+            for (int cx = 0; cx < cell.width; cx++, out += 4)
+            {
+                const unsigned char *in = pixels + ((size_t)sy * width + std::min(std::max(cx - pad, 0), width - 1)) * channels;
+                for (int c = 0; c < 4; c++)
+                    out[c] = expand[channels][c] < 0 ? 255 : in[expand[channels][c]];
+            }
+        }
+
+        // each level from the one before, box filtered in 2x2 blocks that never leave the cell
+        std::vector<unsigned char> block, half;
+        for (int level = 1; level < levels; level++)
+        {
+            int w = cell.width >> (level - 1), h = cell.height >> (level - 1), stride = size >> (level - 1);
+            block.resize((size_t)w * h * 4);
+            half.resize((size_t)(w / 2) * (h / 2) * 4);
+            for (int row = 0; row < h; row++)
+                memcpy(&block[(size_t)row * w * 4], &target.levels[level - 1][((size_t)((cell.y >> (level - 1)) + row) * stride + (cell.x >> (level - 1))) * 4],
+                       (size_t)w * 4);
+            downsampleImage(&block[0], w, h, 4, &half[0], FILTER_BOX, IMAGE_SRGB);
+            for (int row = 0; row < h / 2; row++)
+                memcpy(&target.levels[level][((size_t)((cell.y >> level) + row) * (size >> level) + (cell.x >> level)) * 4], &half[(size_t)row * (w / 2) * 4],
+                       (size_t)(w / 2) * 4);
+        }
+        target.dirty.push_back(cell);
+    }
+
+    TextureAtlas(const TextureAtlas &);
+    TextureAtlas &operator=(const TextureAtlas &);
+};
+
+#endif
@@ -0,0 +1,541 @@
+#ifndef BC_H
+#define BC_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "jobs.hpp"
+
+// S3TC (BC1-3) is an extension to GL 3.2 core, so glad doesn't have its enums;
+// RGTC (BC4/5) is core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// block compression of 8-bit images on the CPU, 4x4 texels to a block:
+// BC1 rgb in 8 bytes, BC3 rgba in 16 (BC4 alpha then BC1 colour), BC4 one channel
+// in 8, BC5 two channels in 16 (normal maps' x and y). BC_FAST takes the endpoints
+// from the bounding box, BC_HIGH from the principal axis and refines them by least
+// squares; both pick each texel's index from the palette with SSE2. Images go by
+// rows of blocks, over a JobSystem if given one.
+enum BcFormat
+{
+    BC1,
+    BC3,
+    BC4,
+    BC5
+};
+
+enum BcQuality
+{
+    BC_FAST,
+    BC_HIGH
+};
+
+// the format for an image with so many channels
+inline BcFormat bcFormatFor(int channels)
+{
+    static const BcFormat byChannels[5] = {BC3, BC4, BC5, BC1, BC3};
+    return byChannels[channels];
+}
+
+inline unsigned int bcBlockBytes(BcFormat format) { return format == BC1 || format == BC4 ? 8 : 16; }
+
+// the channels a format keeps
+inline int bcChannels(BcFormat format)
+{
+    static const int channels[4] = {3, 4, 1, 2};
+    return channels[format];
+}
+
+inline GLenum bcInternalFormat(BcFormat format)
+{
+    static const GLenum formats[4] = {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2};
+    return formats[format];
+}
+
+inline size_t bcCompressedSize(BcFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * bcBlockBytes(format);
+}
+
+// GL thread: BC4/5 are core, BC1/3 need EXT_texture_compression_s3tc
+inline bool bcSupported(BcFormat format)
+{
+    if (format == BC4 || format == BC5)
+        return true;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+            return true;
+    }
+    return false;
+}
+
+// a block's texels as r, g, b, a rows of 16 floats; 1 channel is grey, 2 are red
+// and green, a missing alpha is opaque
+struct BcBlock
+{
+    float c[4][16];
+};
+
+inline void bcLoadBlock(const unsigned char *pixels, int width, int height, int channels, int bx, int by, BcBlock &block)
+{
+    for (int y = 0; y < 4; y++)
+    {
+        // the edge texels stand in for the ones past the image
+        const unsigned char *row = pixels + (size_t)std::min(4 * by + y, height - 1) * width * channels;
+        for (int x = 0; x < 4; x++)
+        {
+            const unsigned char *p = row + std::min(4 * bx + x, width - 1) * channels;
+            int i = 4 * y + x;
+            block.c[0][i] = p[0];
+            block.c[1][i] = channels == 1 ? p[0] : p[1];
+            block.c[2][i] = channels == 1 ? p[0] : channels == 2 ? 0.0f : p[2];
+            block.c[3][i] = channels == 4 ? p[3] : 255.0f;
+        }
+    }
+}
+
+// for each texel the index of the nearest palette entry; returns the summed squared
+// error. colours are the first 3 of block's rows against palette entries of 3,
+// a single row is values against entries of 1.
+template <int Entries, int Channels>
+inline float bcNearest(const float (*rows)[16], const float (*palette)[Channels], unsigned char index[16])
+{
+    float error = 0.0f;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    glm_vec4 total = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 4)
+    {
+        glm_vec4 texel[Channels];
+        for (int c = 0; c < Channels; c++)
+            texel[c] = _mm_loadu_ps(rows[c] + i);
+        glm_vec4 best = _mm_set1_ps(1e30f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int e = 0; e < Entries; e++)
+        {
+            glm_vec4 distance = _mm_setzero_ps();
+            for (int c = 0; c < Channels; c++)
+            {
+                glm_vec4 d = _mm_sub_ps(texel[c], _mm_set1_ps(palette[e][c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, bestIndex));
+        }
+        total = _mm_add_ps(total, best);
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, bestIndex);
+        for (int k = 0; k < 4; k++)
+            index[i + k] = (unsigned char)lanes[k];
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, total);
+    error = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    for (int i = 0; i < 16; i++)
+    {
+        float best = 1e30f;
+        for (int e = 0; e < Entries; e++)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < Channels; c++)
+                distance += (rows[c][i] - palette[e][c]) * (rows[c][i] - palette[e][c]);
+            if (distance < best)
+            {
+                best = distance;
+                index[i] = (unsigned char)e;
+            }
+        }
+        error += best;
+    }
+#endif
+    return error;
+}
+
+inline int bcPack565(const float *rgb)
+{
+    int r = std::min(31, std::max(0, (int)(rgb[0] * (31.0f / 255.0f) + 0.5f)));
+    int g = std::min(63, std::max(0, (int)(rgb[1] * (63.0f / 255.0f) + 0.5f)));
+    int b = std::min(31, std::max(0, (int)(rgb[2] * (31.0f / 255.0f) + 0.5f)));
+    return r << 11 | g << 5 | b;
+}
+
+// the 4 colours a BC1 block in 4-colour mode decodes to
+inline void bcColorPalette(int c0, int c1, float palette[4][3])
+{
+    int ends[2] = {c0, c1};
+    for (int e = 0; e < 2; e++)
+    {
+        int r = ends[e] >> 11, g = ends[e] >> 5 & 63, b = ends[e] & 31;
+        palette[e][0] = (float)(r << 3 | r >> 2);
+        palette[e][1] = (float)(g << 2 | g >> 4);
+        palette[e][2] = (float)(b << 3 | b >> 2);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+}
+
+// the 8 values of a BC4 block: a0 > a1 interpolates 6 between them, otherwise 4
+// and then 0 and 255
+inline void bcValuePalette(int a0, int a1, float palette[8][1])
+{
+    palette[0][0] = (float)a0;
+    palette[1][0] = (float)a1;
+    if (a0 > a1)
+        for (int i = 2; i < 8; i++)
+            palette[i][0] = ((8 - i) * a0 + (i - 1) * a1) / 7.0f;
+    else
+    {
+        for (int i = 2; i < 6; i++)
+            palette[i][0] = ((6 - i) * a0 + (i - 1) * a1) / 5.0f;
+        palette[6][0] = 0.0f;
+        palette[7][0] = 255.0f;
+    }
+}
+
+// BC1 colour block of the texels' rgb, always in 4-colour mode, which is the only one
+// BC3 reads
+inline void bcEncodeColor(const BcBlock &block, BcQuality quality, unsigned char *out)
+{
+    float mean[3] = {0.0f, 0.0f, 0.0f}, lo[3] = {255.0f, 255.0f, 255.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+    for (int c = 0; c < 3; c++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            mean[c] += block.c[c][i];
+            lo[c] = std::min(lo[c], block.c[c][i]);
+            hi[c] = std::max(hi[c], block.c[c][i]);
+        }
+        mean[c] /= 16.0f;
+    }
+    float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; i++)
+    {
+        float r = block.c[0][i] - mean[0], g = block.c[1][i] - mean[1], b = block.c[2][i] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // the bounding box diagonal, each channel's sign following its covariance with the
+    // widest one; BC_HIGH also tries the principal axis, from a power iteration
+    int widest = hi[1] - lo[1] > hi[0] - lo[0] ? 1 : 0;
+    widest = hi[2] - lo[2] > hi[widest] - lo[widest] ? 2 : widest;
+    static const int pair[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+    float axes[2][3];
+    for (int c = 0; c < 3; c++)
+        axes[0][c] = axes[1][c] = covariance[pair[widest][c]] < 0.0f ? lo[c] - hi[c] : hi[c] - lo[c];
+    for (int iteration = 0; quality == BC_HIGH && iteration < 8; iteration++)
+    {
+        float next[3], length = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            next[c] = covariance[pair[c][0]] * axes[1][0] + covariance[pair[c][1]] * axes[1][1] + covariance[pair[c][2]] * axes[1][2];
+            length = std::max(length, std::fabs(next[c]));
+        }
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axes[1][c] = next[c] / length;
+    }
+
+    unsigned char index[16], bestIndex[16];
+    int c0 = 0, c1 = 0;
+    float palette[4][3], error = 1e30f, end0[3], end1[3];
+    if (axes[0][0] * axes[0][0] + axes[0][1] * axes[0][1] + axes[0][2] * axes[0][2] < 1e-6f)
+    {
+        // one colour
+        c0 = c1 = bcPack565(mean);
+        memset(bestIndex, 0, sizeof(bestIndex));
+    }
+    else
+    {
+        // the extreme projections on the axis through the mean, moved in by 1/16 of their
+        // distance, which the rounding to 565 and the thirds between favour; BC_HIGH keeps
+        // the best of both axes, with and without the inset
+        for (int candidate = 0; candidate < (quality == BC_HIGH ? 4 : 1); candidate++)
+        {
+            const float *axis = axes[candidate >> 1];
+            float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2], tMin = 1e30f, tMax = -1e30f;
+            if (length < 1e-6f)
+                continue;
+            for (int i = 0; i < 16; i++)
+            {
+                float t = ((block.c[0][i] - mean[0]) * axis[0] + (block.c[1][i] - mean[1]) * axis[1] + (block.c[2][i] - mean[2]) * axis[2]) / length;
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+            float inset = candidate & 1 ? 0.0f : (tMax - tMin) / 16.0f;
+            for (int c = 0; c < 3; c++)
+            {
+                end0[c] = mean[c] + axis[c] * (tMax - inset);
+                end1[c] = mean[c] + axis[c] * (tMin + inset);
+            }
+            int r0 = bcPack565(end0), r1 = bcPack565(end1);
+            bcColorPalette(r0, r1, palette);
+            float candidateError = bcNearest<4, 3>(block.c, palette, index);
+            if (candidateError < error)
+            {
+                error = candidateError;
+                c0 = r0;
+                c1 = r1;
+                memcpy(bestIndex, index, sizeof(index));
+            }
+        }
+
+        // least squares endpoints for the chosen indices, kept while they do better
+        for (int round = 0; quality == BC_HIGH && round < 4; round++)
+        {
+            static const float weight[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+            for (int i = 0; i < 16; i++)
+            {
+                float a = weight[bestIndex[i]], b = 1.0f - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 3; c++)
+                {
+                    ax[c] += a * block.c[c][i];
+                    bx[c] += b * block.c[c][i];
+                }
+            }
+            float determinant = aa * bb - ab * ab;
+            if (std::fabs(determinant) < 1e-6f)
+                break;
+            for (int c = 0; c < 3; c++)
+            {
+                end0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+                end1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+            }
+            int r0 = bcPack565(end0), r1 = bcPack565(end1);
+            bcColorPalette(r0, r1, palette);
+            float refined = bcNearest<4, 3>(block.c, palette, index);
+            if (refined >= error)
+                break;
+            error = refined;
+            c0 = r0;
+            c1 = r1;
+            memcpy(bestIndex, index, sizeof(index));
+        }
+    }
+
+    // 4-colour mode needs c0 > c1: swapping the ends swaps indices 0/1 and 2/3; equal
+    // ends mean one colour, which index 0 is in either mode
+    if (c0 < c1)
+    {
+        std::swap(c0, c1);
+        for (int i = 0; i < 16; i++)
+            bestIndex[i] ^= 1;
+    }
+    else if (c0 == c1)
+        memset(bestIndex, 0, sizeof(bestIndex));
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)bestIndex[i] << (2 * i);
+    out[0] = (unsigned char)c0;
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)c1;
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int k = 0; k < 4; k++)
+        out[4 + k] = (unsigned char)(bits >> (8 * k));
+}
+
+// BC4 block of one row of a block: BC3's alpha, either half of BC5
+inline void bcEncodeValues(const float *values, BcQuality quality, unsigned char *out)
+{
+    float lo = 255.0f, hi = 0.0f, inLo = 255.0f, inHi = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+        // without the 0 and 255 that the 6-value mode has for free
+        if (values[i] > 0.0f && values[i] < 255.0f)
+        {
+            inLo = std::min(inLo, values[i]);
+            inHi = std::max(inHi, values[i]);
+        }
+    }
+    const float(*row)[16] = (const float(*)[16])values;
+    unsigned char index[16], bestIndex[16];
+    float palette[8][1];
+    int a0 = (int)(hi + 0.5f), a1 = (int)(lo + 0.5f);
+    bcValuePalette(a0, a1, palette);
+    float error = bcNearest<8, 1>(row, palette, bestIndex);
+
+    if (quality == BC_HIGH && a0 > a1)
+    {
+        // least squares ends for the 8-value indices, if they stay in that mode
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax = 0.0f, bx = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float a = bestIndex[i] == 0 ? 1.0f : bestIndex[i] == 1 ? 0.0f : (8 - bestIndex[i]) / 7.0f, b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            ax += a * values[i];
+            bx += b * values[i];
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) > 1e-6f)
+        {
+            int r0 = std::min(255, std::max(0, (int)((ax * bb - bx * ab) / determinant + 0.5f)));
+            int r1 = std::min(255, std::max(0, (int)((bx * aa - ax * ab) / determinant + 0.5f)));
+            if (r0 > r1)
+            {
+                bcValuePalette(r0, r1, palette);
+                float refined = bcNearest<8, 1>(row, palette, index);
+                if (refined < error)
+                {
+                    error = refined;
+                    a0 = r0;
+                    a1 = r1;
+                    memcpy(bestIndex, index, sizeof(index));
+                }
+            }
+        }
+    }
+    if (quality == BC_HIGH && (lo == 0.0f || hi == 255.0f))
+    {
+        // the 6-value mode, its ends around what isn't 0 or 255
+        int r0 = inLo <= inHi ? (int)(inLo + 0.5f) : 0, r1 = inLo <= inHi ? (int)(inHi + 0.5f) : 0;
+        bcValuePalette(r0, r1, palette);
+        float sixValues = bcNearest<8, 1>(row, palette, index);
+        if (sixValues < error)
+        {
+            a0 = r0;
+            a1 = r1;
+            memcpy(bestIndex, index, sizeof(index));
+        }
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint64_t)bestIndex[i] << (3 * i);
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    for (int k = 0; k < 6; k++)
+        out[2 + k] = (unsigned char)(bits >> (8 * k));
+}
+
+// block rows [firstRow, endRow) of the image
+inline void bcCompressRows(const unsigned char *pixels, int width, int height, int channels, BcFormat format, BcQuality quality,
+                           unsigned char *out, int firstRow, int endRow)
+{
+    int blocksWide = (width + 3) / 4;
+    unsigned int blockBytes = bcBlockBytes(format);
+    BcBlock block;
+    for (int by = firstRow; by < endRow; by++)
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            unsigned char *target = out + ((size_t)by * blocksWide + bx) * blockBytes;
+            bcLoadBlock(pixels, width, height, channels, bx, by, block);
+            switch (format)
+            {
+            case BC1:
+                bcEncodeColor(block, quality, target);
+                break;
+            case BC3:
+                bcEncodeValues(block.c[3], quality, target);
+                bcEncodeColor(block, quality, target + 8);
+                break;
+            case BC4:
+                bcEncodeValues(block.c[0], quality, target);
+                break;
+            case BC5:
+                bcEncodeValues(block.c[0], quality, target);
+                bcEncodeValues(block.c[1], quality, target + 8);
+                break;
+            }
+        }
+}
+
+// an 8-bit image with 1 to 4 channels into bcCompressedSize(format, width, height) bytes
+inline void bcCompress(const unsigned char *pixels, int width, int height, int channels, BcFormat format, BcQuality quality,
+                       unsigned char *out, JobSystem *jobs = NULL)
+{
+    int rows = (height + 3) / 4;
+    if (jobs)
+        jobs->parallelFor(0, rows, [&](unsigned int begin, unsigned int end) {
+            bcCompressRows(pixels, width, height, channels, format, quality, out, begin, end);
+        });
+    else
+        bcCompressRows(pixels, width, height, channels, format, quality, out, 0, rows);
+}
+
+// a block back to texels, in the layout bcLoadBlock makes, for the channels the
+// format keeps
+inline void bcDecodeBlock(const unsigned char *in, BcFormat format, BcBlock &block)
+{
+    const unsigned char *values[2] = {format == BC3 || format == BC4 || format == BC5 ? in : NULL, format == BC5 ? in + 8 : NULL};
+    int valueRows[2] = {format == BC3 ? 3 : 0, 1};
+    for (int v = 0; v < 2; v++)
+        if (values[v])
+        {
+            float palette[8][1];
+            bcValuePalette(values[v][0], values[v][1], palette);
+            uint64_t bits = 0;
+            for (int k = 0; k < 6; k++)
+                bits |= (uint64_t)values[v][2 + k] << (8 * k);
+            for (int i = 0; i < 16; i++)
+                block.c[valueRows[v]][i] = std::floor(palette[bits >> (3 * i) & 7][0] + 0.5f);
+        }
+    if (format == BC1 || format == BC3)
+    {
+        const unsigned char *color = format == BC3 ? in + 8 : in;
+        float palette[4][3];
+        bcColorPalette(color[0] | color[1] << 8, color[2] | color[3] << 8, palette);
+        uint32_t bits = color[4] | color[5] << 8 | color[6] << 16 | (uint32_t)color[7] << 24;
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                block.c[c][i] = std::floor(palette[bits >> (2 * i) & 3][c] + 0.5f);
+    }
+}
+
+// peak signal to noise ratio of the compressed image against the source, in dB over
+// the channels the format keeps
+inline double bcPsnr(const unsigned char *pixels, int width, int height, int channels, BcFormat format, const unsigned char *blocks)
+{
+    static const int kept[4][4] = {{0, 1, 2, -1}, {0, 1, 2, 3}, {0, -1, -1, -1}, {0, 1, -1, -1}};
+    int blocksWide = (width + 3) / 4;
+    double squares = 0.0;
+    BcBlock source, decoded;
+    for (int by = 0; by < (height + 3) / 4; by++)
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            bcLoadBlock(pixels, width, height, channels, bx, by, source);
+            bcDecodeBlock(blocks + ((size_t)by * blocksWide + bx) * bcBlockBytes(format), format, decoded);
+            for (int i = 0; i < 16; i++)
+            {
+                if (4 * bx + i % 4 >= width || 4 * by + i / 4 >= height)
+                    continue;
+                for (int k = 0; k < 4 && kept[format][k] >= 0; k++)
+                {
+                    double d = source.c[kept[format][k]][i] - decoded.c[kept[format][k]][i];
+                    squares += d * d;
+                }
+            }
+        }
+    double mse = squares / ((double)width * height * bcChannels(format));
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+#endif
@@ -0,0 +1,1441 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "shapes.hpp"
+#include "geometry.hpp"
+#include "raytracer.hpp"
+#include "spatial.hpp"
+#include "jobs.hpp"
+#include "textures.hpp"
+#include "imaging.hpp"
+#include "hdr.hpp"
+#include "atlas.hpp"
+#include "vtex.hpp"
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include <iostream>
+
+// headless micro benchmarks, run with ./app --bench [name]
+
+inline double benchMilliseconds()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// SIMD geometry stage against plain glm on a million-vertex prism
+inline int benchGeometry()
+{
+    const int runs = 20;
+    Prism mesh(500000);
+    unsigned int vertexCount = mesh.vertices.size() / 3;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.4f, 3.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1.0, 0));
+    // off to the side, so part of the mesh is outside the frustum
+    glm::mat4 mvp = projection * view * glm::translate(glm::mat4(1.0f), glm::vec3(1.2f, 0.0f, 0.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.6f));
+
+    GeometryStage scalar(1024, 1024), simd(1024, 1024);
+    double t0 = benchMilliseconds();
+    for (int i = 0; i < runs; i++)
+        scalar.transformScalar(mesh.vertices, mvp);
+    double t1 = benchMilliseconds();
+    for (int i = 0; i < runs; i++)
+        simd.transform(mesh.vertices, mvp);
+    double t2 = benchMilliseconds();
+    for (int i = 0; i < runs; i++)
+        simd.cull(mesh.indices, mesh.ranges);
+    double t3 = benchMilliseconds();
+
+    float maxError = 0.0f;
+    unsigned int outcodeMismatches = 0;
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        maxError = std::max(maxError, std::fabs(scalar.clipW[i] - simd.clipW[i]) + std::fabs(scalar.clipX[i] - simd.clipX[i]));
+        outcodeMismatches += scalar.outcodes[i] != simd.outcodes[i];
+    }
+
+    double mverts = vertexCount * (double)runs / 1000.0;
+    std::cout << "geometry: " << vertexCount << " vertices, " << simd.trianglesIn << " triangles\n"
+              << "  transform scalar glm " << mverts / (t1 - t0) << " Mverts/s\n"
+              << "  transform simd       " << mverts / (t2 - t1) << " Mverts/s (max abs diff " << maxError << ")\n"
+              << "  cull                 " << simd.trianglesIn * (double)runs / 1000.0 / (t3 - t2) << " Mtris/s\n"
+              << "  kept " << simd.indices.size() / 3 << ", frustum " << simd.frustumCulled << ", backface "
+              << simd.backfaceCulled << ", small " << simd.smallCulled << "\n"
+              << "  " << outcodeMismatches << " outcodes differ from scalar" << std::endl;
+    return outcodeMismatches || !simd.frustumCulled ? 1 : 0;
+}
+
+// BVH build time, Mrays/s for packets and single rays, and agreement with glm::intersectRayTriangle
+inline int benchRaytrace()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.4f, 3.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1.0, 0));
+    glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(0.6f));
+
+    // a 32x32 field of prisms and pyramids; a single huge prism is mostly cap fans,
+    // which says more about the mesh than about the tracer
+    RayTracer tracer(1024, 1024);
+    Prism prism(64);
+    Pyramid pyramid(64);
+    for (int z = 0; z < 32; z++)
+    {
+        for (int x = 0; x < 32; x++)
+        {
+            glm::mat4 at = glm::translate(glm::mat4(1.0f), glm::vec3(x - 15.5f, -1.0f, -z * 1.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.3f));
+            if ((x + z) % 2)
+                tracer.addMesh(prism, at);
+            else
+                tracer.addMesh(pyramid, at);
+        }
+    }
+    double t0 = benchMilliseconds();
+    tracer.build();
+    double t1 = benchMilliseconds();
+    tracer.setCamera(projection, view);
+    tracer.render();
+    double t2 = benchMilliseconds();
+
+    unsigned int rays = 0;
+    for (int y = 0; y < tracer.height; y += 2)
+        for (int x = 0; x < tracer.width; x++, rays++)
+            tracer.pick((float)x, (float)y);
+    double t3 = benchMilliseconds();
+
+    std::cout << "raytrace: " << tracer.triangles.size() << " triangles, " << tracer.nodes.size() << " BVH nodes, "
+              << tracer.numThreads << " threads\n"
+              << "  build           " << t1 - t0 << " ms\n"
+              << "  packets         " << tracer.width * tracer.height / 1000.0 / (t2 - t1) << " Mrays/s\n"
+              << "  single (1 core) " << rays / 1000.0 / (t3 - t2) << " Mrays/s\n";
+
+    // the reference is brute force, so validate on a smaller mesh
+    RayTracer small(256, 256);
+    small.addMesh(Prism(500), model);
+    small.build();
+    small.setCamera(projection, view);
+    int mismatches = 0, hits = 0;
+    for (int y = 0; y < small.height; y += 2)
+    {
+        for (int x = 0; x < small.width; x += 2)
+        {
+            glm::vec3 origin, dir;
+            small.primaryRay((x + 0.5f) / small.width, (y + 0.5f) / small.height, origin, dir);
+            RayTracer::Hit a = small.intersect(origin, dir), b = small.intersectReference(origin, dir);
+            hits += a.triangle >= 0;
+            if ((a.triangle >= 0) != (b.triangle >= 0) || (a.triangle >= 0 && std::fabs(a.t - b.t) > 1e-4f))
+                mismatches++;
+        }
+    }
+    std::cout << "  reference check " << mismatches << " mismatches in " << hits << " hits" << std::endl;
+    return mismatches ? 1 : 0;
+}
+
+// dynamic AABB tree with 100k prisms: build, frustum query and moving a tenth of them per frame
+inline int benchSpatial()
+{
+    const unsigned int count = 100000, frames = 20;
+    Prism prism(16);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 60.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1.0, 0));
+    Frustum frustum(projection * view);
+
+    srand(0);
+    std::vector<glm::mat4> models(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        glm::vec3 at(rand() % 2000 * 0.1f - 100.0f, rand() % 2000 * 0.1f - 100.0f, rand() % 2000 * 0.1f - 100.0f);
+        models[i] = glm::scale(glm::translate(glm::mat4(1.0f), at), glm::vec3(0.2f));
+    }
+
+    AABBTree tree;
+    std::vector<int> proxies(count);
+    glm::vec3 boundsMin, boundsMax;
+    double t0 = benchMilliseconds();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        transformBounds(prism.boundsMin, prism.boundsMax, models[i], boundsMin, boundsMax);
+        proxies[i] = tree.createProxy(boundsMin, boundsMax, i);
+    }
+    double t1 = benchMilliseconds();
+
+    std::vector<unsigned int> visible;
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        visible.clear();
+        tree.query(frustum, visible);
+    }
+    double t2 = benchMilliseconds();
+
+    unsigned int moved = 0, reinserted = 0;
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        for (unsigned int i = f % 10; i < count; i += 10, moved++)
+        {
+            models[i] = glm::translate(glm::mat4(1.0f), glm::vec3(0.05f, 0, 0)) * models[i];
+            transformBounds(prism.boundsMin, prism.boundsMax, models[i], boundsMin, boundsMax);
+            reinserted += tree.moveProxy(proxies[i], boundsMin, boundsMax);
+        }
+    }
+    double t3 = benchMilliseconds();
+
+    // brute force over every object, to check the query and for scale
+    unsigned int expected = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        transformBounds(prism.boundsMin, prism.boundsMax, models[i], boundsMin, boundsMax);
+        unsigned int mask = 0x3f;
+        expected += frustum.classify(boundsMin, boundsMax, mask) != Frustum::OUTSIDE;
+    }
+    double t4 = benchMilliseconds();
+    visible.clear();
+    tree.query(frustum, visible);
+
+    std::cout << "spatial: " << count << " objects, tree height " << tree.height() << "\n"
+              << "  build        " << t1 - t0 << " ms\n"
+              << "  query        " << (t2 - t1) / frames << " ms, " << visible.size() << " visible (brute force "
+              << expected << " in " << t4 - t3 << " ms)\n"
+              << "  move         " << (t3 - t2) * 1000.0 / moved << " us/object, " << reinserted << " of " << moved << " reinserted" << std::endl;
+    return visible.size() >= expected ? 0 : 1;
+}
+
+inline void benchAppendBytes(void *context, void *data, int size)
+{
+    std::vector<unsigned char> *bytes = (std::vector<unsigned char> *)context;
+    bytes->insert(bytes->end(), (unsigned char *)data, (unsigned char *)data + size);
+}
+
+// job system scaling from one worker up to every hardware thread: mesh generation,
+// PNG decoding through stb_image and the geometry stage's vertex transform
+inline int benchJobs()
+{
+    const unsigned int meshes = 64, images = 32, imageSize = 512;
+
+    // compressible but not trivial test images, encoded once up front
+    std::vector<std::vector<unsigned char> > pngs(images);
+    std::vector<unsigned char> pixels(imageSize * imageSize * 4);
+    srand(0);
+    for (unsigned int n = 0; n < images; n++)
+    {
+        for (unsigned int i = 0; i < imageSize * imageSize; i++)
+        {
+            unsigned int x = i % imageSize, y = i / imageSize;
+            pixels[4 * i + 0] = (unsigned char)(x + n * 8);
+            pixels[4 * i + 1] = (unsigned char)(y ^ x);
+            pixels[4 * i + 2] = (unsigned char)(rand() & 15);
+            pixels[4 * i + 3] = 255;
+        }
+        stbi_write_png_to_func(benchAppendBytes, &pngs[n], imageSize, imageSize, 4, &pixels[0], imageSize * 4);
+    }
+    Prism big(500000);
+    glm::mat4 mvp = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f) *
+                    glm::lookAt(glm::vec3(0.5f, 0.4f, 3.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1.0, 0));
+
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double base[3] = {0, 0, 0};
+    int failures = 0;
+    std::cout << "jobs: " << meshes << " x Prism(20000), " << images << " PNG " << imageSize << "x" << imageSize
+              << ", transform of " << big.vertices.size() / 3 << " vertices\n";
+    for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(2 * threads, maxThreads) : threads + 1)
+    {
+        JobSystem jobs(threads);
+        std::vector<unsigned int> vertexCounts(meshes);
+        double t0 = benchMilliseconds();
+        jobs.parallelFor(0, meshes, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++)
+                vertexCounts[i] = Prism(20000).vertices.size() / 3;
+        });
+        double t1 = benchMilliseconds();
+        std::vector<int> decoded(images, 0);
+        jobs.parallelFor(0, images, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                int w, h, channels;
+                unsigned char *image = stbi_load_from_memory(&pngs[i][0], pngs[i].size(), &w, &h, &channels, 4);
+                decoded[i] = image && w == (int)imageSize && h == (int)imageSize;
+                stbi_image_free(image);
+            }
+        });
+        double t2 = benchMilliseconds();
+        GeometryStage geometry(1024, 1024);
+        geometry.jobs = &jobs;
+        for (int run = 0; run < 10; run++)
+            geometry.transform(big.vertices, mvp);
+        double t3 = benchMilliseconds();
+
+        for (unsigned int i = 0; i < images; i++)
+            failures += !decoded[i];
+        for (unsigned int i = 0; i < meshes; i++)
+            failures += vertexCounts[i] != 40002;
+        double times[3] = {t1 - t0, t2 - t1, (t3 - t2) / 10};
+        if (threads == 1)
+            for (int i = 0; i < 3; i++)
+                base[i] = times[i];
+        std::cout << "  " << threads << " threads: meshes " << times[0] << " ms (" << base[0] / times[0] << "x), decode "
+                  << times[1] << " ms (" << base[1] / times[1] << "x), transform " << times[2] << " ms (" << base[2] / times[2] << "x)\n";
+    }
+    std::cout << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// a 500-texture scene from disk: the stock single-threaded stbi_load through stdio
+// against the TextureLoader's mapped files decoded on one up to every hardware thread
+inline int benchTextures()
+{
+    const unsigned int textures = 500, imageSize = 256;
+    const std::string directory = "bench-textures";
+#ifdef _WIN32
+    CreateDirectoryA(directory.c_str(), NULL);
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    std::vector<unsigned char> pixels(imageSize * imageSize * 4), png;
+    std::vector<std::string> paths;
+    srand(0);
+    for (unsigned int n = 0; n < textures; n++)
+    {
+        for (unsigned int i = 0; i < imageSize * imageSize; i++)
+        {
+            unsigned int x = i % imageSize, y = i / imageSize;
+            pixels[4 * i + 0] = (unsigned char)(x * (n % 7 + 1));
+            pixels[4 * i + 1] = (unsigned char)((y + n) ^ x);
+            pixels[4 * i + 2] = (unsigned char)(rand() & 15);
+            pixels[4 * i + 3] = 255;
+        }
+        png.clear();
+        stbi_write_png_to_func(benchAppendBytes, &png, imageSize, imageSize, 4, &pixels[0], imageSize * 4);
+        char name[32];
+        snprintf(name, sizeof(name), "/%03u.png", n);
+        paths.push_back(directory + name);
+        FILE *file = fopen(paths.back().c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "ERROR::BENCH::CANNOT_WRITE: " << paths.back() << std::endl;
+            return 1;
+        }
+        fwrite(&png[0], 1, png.size(), file);
+        fclose(file);
+    }
+
+    int failures = 0;
+    double mb = textures * imageSize * imageSize * 4 / 1048576.0;
+    double t0 = benchMilliseconds();
+    for (unsigned int i = 0; i < textures; i++)
+    {
+        int w, h, channels;
+        unsigned char *image = stbi_load(paths[i].c_str(), &w, &h, &channels, 4);
+        failures += !image;
+        stbi_image_free(image);
+    }
+    double stock = benchMilliseconds() - t0;
+    std::cout << "textures: " << textures << " PNG " << imageSize << "x" << imageSize << ", " << mb << " MB decoded\n"
+              << "  stbi_load, 1 thread: " << stock << " ms, " << mb / (stock / 1000.0) << " MB/s\n";
+
+    // what TextureLoader did before, decoding to the heap and copying into the vector
+    // the uploader takes, against decoding straight into it with a reused scratch arena
+    double perImage[2];
+    std::vector<unsigned char> scratchMemory;
+    for (int into = 0; into < 2; into++)
+    {
+        double t1 = benchMilliseconds();
+        for (unsigned int i = 0; i < textures; i++)
+        {
+            MappedFile file;
+            std::vector<unsigned char> target;
+            int w = 0, h = 0, channels;
+            if (!file.open(paths[i].c_str()))
+            {
+                failures++;
+                continue;
+            }
+            if (!into)
+            {
+                unsigned char *image = stbi_load_from_memory(file.data, (int)file.size, &w, &h, &channels, 4);
+                failures += !image;
+                if (image)
+                    target.assign(image, image + (size_t)w * h * 4);
+                stbi_image_free(image);
+            }
+            else if (stbi_info_from_memory(file.data, (int)file.size, &w, &h, &channels))
+            {
+                target.resize((size_t)w * h * 4);
+                stbi_scratch arena = {scratchMemory.empty() ? NULL : &scratchMemory[0], scratchMemory.size(), 0, 0, 0};
+                failures += !stbi_load_into_from_memory(file.data, (int)file.size, &w, &h, &channels, 4, &target[0], target.size(), w * 4, &arena);
+                if (arena.peak > scratchMemory.size())
+                    scratchMemory.resize(arena.peak);
+            }
+            else
+                failures++;
+        }
+        perImage[into] = benchMilliseconds() - t1;
+    }
+    std::cout << "  stbi_load_from_memory + copy, 1 thread: " << perImage[0] << " ms; stbi_load_into_from_memory: " << perImage[1]
+              << " ms (" << perImage[0] / perImage[1] << "x), " << scratchMemory.size() / 1024 << " KB scratch\n";
+
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(2 * threads, maxThreads) : threads + 1)
+    {
+        JobSystem jobs(threads);
+        TextureLoader loader(&jobs); // as it comes: decoding alone, as stbi_load does, mips left to the GL
+        double t1 = benchMilliseconds();
+        loader.load(paths);
+        loader.wait();
+        double t2 = benchMilliseconds();
+        DecodedImage image;
+        unsigned int images = 0;
+        while (loader.take(image))
+            images += image.width == (int)imageSize && image.height == (int)imageSize && image.channels == 4;
+        failures += textures - images;
+        std::cout << "  TextureLoader, " << threads << " threads: " << t2 - t1 << " ms, " << mb / ((t2 - t1) / 1000.0)
+                  << " MB/s (" << stock / (t2 - t1) << "x)\n";
+    }
+
+    // what baking the mip chains on the workers adds to that, with no cache to keep them
+    {
+        JobSystem jobs(maxThreads);
+        TextureLoader plain(&jobs), baking(&jobs);
+        baking.cpuMipmaps = true;
+        double t1 = benchMilliseconds();
+        plain.load(paths);
+        plain.wait();
+        double t2 = benchMilliseconds();
+        baking.load(paths);
+        baking.wait();
+        double t3 = benchMilliseconds();
+        DecodedImage image;
+        unsigned int images = 0;
+        while (baking.take(image))
+            images += image.baked && image.baked->levels() == 9 && image.baked->color() == IMAGE_SRGB;
+        failures += textures - images;
+        std::cout << "  TextureLoader, " << maxThreads << " threads, default: " << t2 - t1 << " ms; cpuMipmaps: " << t3 - t2
+                  << " ms (" << (t3 - t2) / (t2 - t1) << "x the time)\n";
+    }
+
+    // a cold run bakes every image into a texture cache, a warm one maps the baked
+    // levels and only hashes the sources; level 0 has to match what stb_image decodes
+    const std::string cache = "bench-texture-cache";
+    double passes[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        JobSystem jobs(maxThreads);
+        TextureLoader loader(&jobs);
+        loader.cacheDirectory = cache;
+        double t1 = benchMilliseconds();
+        loader.load(paths);
+        loader.wait();
+        passes[pass] = benchMilliseconds() - t1;
+        failures += pass ? textures - loader.cacheHits.load() : textures - loader.cacheBakes.load();
+        DecodedImage image;
+        while (loader.take(image))
+        {
+            if (!pass || image.index % 50)
+                continue;
+            int w, h, channels;
+            unsigned char *decoded = stbi_load(paths[image.index].c_str(), &w, &h, &channels, 4);
+            failures += !decoded || !image.baked || image.baked->levels() != 9 ||
+                        memcmp(decoded, image.baked->level(0), image.baked->levelSize(0)) != 0;
+            stbi_image_free(decoded);
+        }
+    }
+    std::cout << "  texture cache, " << maxThreads << " threads: bake " << passes[0] << " ms, load " << passes[1] << " ms, "
+              << mb / (passes[1] / 1000.0) << " MB/s (" << stock / passes[1] << "x stbi_load)\n";
+    for (unsigned int i = 0; i < textures; i++)
+        remove(bakedTexturePath(cache, paths[i]).c_str());
+#ifdef _WIN32
+    RemoveDirectoryA(cache.c_str());
+#else
+    rmdir(cache.c_str());
+#endif
+
+    for (unsigned int i = 0; i < textures; i++)
+        remove(paths[i].c_str());
+#ifdef _WIN32
+    RemoveDirectoryA(directory.c_str());
+#else
+    rmdir(directory.c_str());
+#endif
+    std::cout << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// defined in stb_image_write.h, not declared in its header
+unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+inline void benchAppendChunk(std::vector<unsigned char> &png, const char *type, const std::vector<unsigned char> &data)
+{
+    static unsigned int crcTable[256];
+    if (!crcTable[1])
+        for (unsigned int n = 0; n < 256; n++)
+        {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+    unsigned int length = data.size(), crc = 0xffffffffu;
+    unsigned char header[8] = {(unsigned char)(length >> 24), (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length,
+                               (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3]};
+    png.insert(png.end(), header, header + 8);
+    png.insert(png.end(), data.begin(), data.end());
+    for (unsigned int i = 4; i < 8; i++)
+        crc = crcTable[(crc ^ header[i]) & 0xff] ^ (crc >> 8);
+    for (unsigned int i = 0; i < length; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    crc ^= 0xffffffffu;
+    unsigned char trailer[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc};
+    png.insert(png.end(), trailer, trailer + 4);
+}
+
+// a PNG whose rows cycle through all five filter types; samples are big endian,
+// depth 8 or 16, channels 3 or 4 (stbi_write_png only writes 8 bits and picks filters itself)
+inline std::vector<unsigned char> benchEncodePng(const std::vector<unsigned char> &samples, int width, int height, int channels, int depth)
+{
+    int bpp = channels * depth / 8, rowBytes = width * bpp;
+    std::vector<unsigned char> filtered;
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *row = &samples[(size_t)y * rowBytes], *prior = y ? row - rowBytes : NULL;
+        int filter = y % 5;
+        filtered.push_back((unsigned char)filter);
+        for (int i = 0; i < rowBytes; i++)
+        {
+            int a = i >= bpp ? row[i - bpp] : 0, b = prior ? prior[i] : 0, c = prior && i >= bpp ? prior[i - bpp] : 0;
+            int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            int predicted[5] = {0, a, b, (a + b) >> 1, pa <= pb && pa <= pc ? a : pb <= pc ? b : c};
+            filtered.push_back((unsigned char)(row[i] - predicted[filter]));
+        }
+    }
+    int zlibSize;
+    unsigned char *zlib = stbi_zlib_compress(&filtered[0], filtered.size(), &zlibSize, 8);
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    std::vector<unsigned char> png(signature, signature + 8), header(13, 0);
+    for (int i = 0; i < 4; i++)
+    {
+        header[i] = (unsigned char)(width >> (24 - 8 * i));
+        header[4 + i] = (unsigned char)(height >> (24 - 8 * i));
+    }
+    header[8] = (unsigned char)depth;
+    header[9] = channels == 4 ? 6 : 2;
+    benchAppendChunk(png, "IHDR", header);
+    benchAppendChunk(png, "IDAT", std::vector<unsigned char>(zlib, zlib + zlibSize));
+    benchAppendChunk(png, "IEND", std::vector<unsigned char>());
+    free(zlib);
+    return png;
+}
+
+// PNG decoding of 8- and 16-bit RGB and RGBA with stb_image's scalar unfiltering
+// against the SSE2 one, checked against the source pixels
+inline int benchPng()
+{
+    const int width = 2048, height = 512, runs = 5;
+    const int formats[4][2] = {{3, 8}, {4, 8}, {3, 16}, {4, 16}};
+    int failures = 0;
+    srand(0);
+    std::cout << "png: " << width << "x" << height << ", rows cycling through all five filters\n";
+    for (int f = 0; f < 4; f++)
+    {
+        int channels = formats[f][0], depth = formats[f][1], bytes = depth / 8;
+        std::vector<unsigned char> samples((size_t)width * height * channels * bytes);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                for (int c = 0; c < channels; c++)
+                {
+                    unsigned int value = (unsigned int)(x * (c + 1) * 32 + y * 64 + (rand() & 255));
+                    if (c == 3)
+                        value = 0xff00 | (x & 255);
+                    unsigned char *sample = &samples[(((size_t)y * width + x) * channels + c) * bytes];
+                    if (bytes == 2)
+                    {
+                        sample[0] = (unsigned char)(value >> 8);
+                        sample[1] = (unsigned char)value;
+                    }
+                    else
+                        sample[0] = (unsigned char)(value >> 8);
+                }
+        std::vector<unsigned char> png = benchEncodePng(samples, width, height, channels, depth);
+
+        double best[2] = {1e30, 1e30};
+        for (int simd = 0; simd < 2; simd++)
+        {
+            stbi_set_png_simd(simd);
+            for (int run = 0; run < runs; run++)
+            {
+                int w, h, n;
+                double t0 = benchMilliseconds();
+                void *image = depth == 16 ? (void *)stbi_load_16_from_memory(&png[0], png.size(), &w, &h, &n, 0)
+                                          : (void *)stbi_load_from_memory(&png[0], png.size(), &w, &h, &n, 0);
+                best[simd] = std::min(best[simd], benchMilliseconds() - t0);
+                // stb_image hands 16-bit samples back in native order
+                bool same = image && w == width && h == height && n == channels;
+                for (size_t i = 0; same && i < samples.size() / bytes; i++)
+                    same = bytes == 2 ? ((unsigned short *)image)[i] == (samples[2 * i] << 8 | samples[2 * i + 1])
+                                      : ((unsigned char *)image)[i] == samples[i];
+                failures += !same;
+                stbi_image_free(image);
+            }
+        }
+        stbi_set_png_simd(1);
+        double mb = samples.size() / 1048576.0;
+        std::cout << "  " << (channels == 4 ? "RGBA" : "RGB ") << depth << (depth == 8 ? " " : "") << " (" << png.size() / 1024 << " KB): scalar "
+                  << best[0] << " ms, " << mb / (best[0] / 1000.0) << " MB/s; sse2 " << best[1] << " ms, " << mb / (best[1] / 1000.0)
+                  << " MB/s (" << best[0] / best[1] << "x)\n";
+    }
+    std::cout << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// zlib inflate with stb_image's original decoder against the 64-bit one, on noisy
+// and smooth filtered image rows and on text; both have to give back the input,
+// into a buffer of the exact size as for PNG and into a growing one
+inline int benchInflate()
+{
+    const int size = 8 << 20, runs = 5;
+    const char *names[3] = {"noisy rows", "smooth rows", "text"};
+    const char *words[8] = {"vertex ", "buffer ", "shader ", "texture ", "frame ", "the ", "of ", "render\n"};
+    int failures = 0;
+    srand(0);
+    std::cout << "inflate: " << size / 1048576 << " MB each\n";
+    for (int set = 0; set < 3; set++)
+    {
+        std::vector<unsigned char> data;
+        data.reserve(size);
+        while ((int)data.size() < size)
+        {
+            int i = data.size();
+            if (set == 2)
+            {
+                const char *word = words[rand() & 7];
+                data.insert(data.end(), word, word + strlen(word));
+            }
+            else
+                data.push_back((unsigned char)(set == 0 ? i * 7 + (rand() & 63) : (i / 4096 + (i % 4096 < 2048 ? 0 : rand() % 3))));
+        }
+        data.resize(size);
+        int zlibSize;
+        unsigned char *zlib = stbi_zlib_compress(&data[0], size, &zlibSize, 8);
+
+        double best[2] = {1e30, 1e30};
+        for (int fast = 0; fast < 2; fast++)
+        {
+            stbi_set_zlib_fast(fast);
+            for (int run = 0; run < runs; run++)
+            {
+                int length = 0, grownLength = 0;
+                double t0 = benchMilliseconds();
+                char *out = stbi_zlib_decode_malloc_guesssize((const char *)zlib, zlibSize, size, &length);
+                best[fast] = std::min(best[fast], benchMilliseconds() - t0);
+                char *grown = run ? NULL : stbi_zlib_decode_malloc((const char *)zlib, zlibSize, &grownLength);
+                failures += !out || length != size || memcmp(out, &data[0], size) != 0;
+                failures += !run && (!grown || grownLength != size || memcmp(grown, &data[0], size) != 0);
+                free(out);
+                free(grown);
+            }
+        }
+        stbi_set_zlib_fast(1);
+        free(zlib);
+        double mb = size / 1048576.0;
+        std::cout << "  " << names[set] << " (" << zlibSize / 1024 << " KB): bytewise " << best[0] << " ms, " << mb / (best[0] / 1000.0)
+                  << " MB/s; 64-bit " << best[1] << " ms, " << mb / (best[1] / 1000.0) << " MB/s (" << best[0] / best[1] << "x)\n";
+    }
+    std::cout << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// decoding a JPEG on the calling thread against across the job system, which splits
+// it at restart markers if it has them and otherwise pipelines entropy decoding with
+// the IDCT by bands of MCU rows, then resamples and converts bands of rows in parallel
+inline int benchJpeg(const std::string &path)
+{
+    const int runs = 5;
+    MappedFile file;
+    if (path.empty() || !file.open(path.c_str()))
+    {
+        std::cout << "ERROR: ./app --bench jpeg needs a JPEG file to decode" << (path.empty() ? "" : ", cannot open " + path) << "\n";
+        return 1;
+    }
+    // a DRI segment before the first scan means restart markers
+    bool restarts = false;
+    for (size_t i = 0; i + 1 < file.size && !(file.data[i] == 0xff && file.data[i + 1] == 0xda); i++)
+        restarts = restarts || (file.data[i] == 0xff && file.data[i + 1] == 0xdd);
+
+    double best[2] = {1e30, 1e30};
+    int width = 0, height = 0, channels = 0, failures = 0;
+    unsigned char *reference = NULL;
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        stbi_set_parallel_for(parallel ? stbiParallelFor : NULL, &jobSystem());
+        for (int run = 0; run < runs; run++)
+        {
+            double t0 = benchMilliseconds();
+            unsigned char *pixels = stbi_load_from_memory(file.data, file.size, &width, &height, &channels, 4);
+            best[parallel] = std::min(best[parallel], benchMilliseconds() - t0);
+            if (!pixels)
+            {
+                std::cout << "ERROR: cannot decode " << path << " (" << stbi_failure_reason() << ")\n";
+                stbi_image_free(reference);
+                return 1;
+            }
+            if (!reference)
+                reference = pixels;
+            else
+            {
+                failures += memcmp(reference, pixels, (size_t)width * height * 4) != 0;
+                stbi_image_free(pixels);
+            }
+        }
+    }
+    stbi_set_parallel_for(stbiParallelFor, &jobSystem());
+    stbi_image_free(reference);
+    double mb = (double)width * height * 4 / 1048576.0;
+    std::cout << "jpeg: " << path << ", " << width << "x" << height << ", " << channels << " channels, "
+              << (restarts ? "restart markers" : "no restart markers") << "\n"
+              << "  1 thread " << best[0] << " ms, " << mb / (best[0] / 1000.0) << " MB/s; " << jobSystem().threadCount() << " threads "
+              << best[1] << " ms, " << mb / (best[1] / 1000.0) << " MB/s (" << best[0] / best[1] << "x)\n"
+              << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// block compression of an image (a file or, without one, a procedural one with smooth
+// gradients, edges and noise) to every format at both qualities: encode rate on one
+// thread and on the job system, and PSNR against the source
+inline int benchBc(const std::string &path)
+{
+    const int runs = 3;
+    int width = 1024, height = 1024, fileChannels, failures = 0;
+    std::vector<unsigned char> rgba;
+    if (!path.empty())
+    {
+        unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &fileChannels, 4);
+        if (!pixels)
+        {
+            std::cout << "ERROR: cannot decode " << path << " (" << stbi_failure_reason() << ")\n";
+            return 1;
+        }
+        rgba.assign(pixels, pixels + (size_t)width * height * 4);
+        stbi_image_free(pixels);
+    }
+    else
+    {
+        rgba.resize((size_t)width * height * 4);
+        unsigned int seed = 1;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                int noise = (int)(seed >> 28) - 8;
+                unsigned char *p = &rgba[((size_t)y * width + x) * 4];
+                p[0] = (unsigned char)std::min(255, std::max(0, x / 4 + noise));
+                p[1] = (unsigned char)std::min(255, std::max(0, y / 4 + noise));
+                p[2] = (unsigned char)(((x / 64 + y / 64) & 1) ? 200 : 40);
+                p[3] = (unsigned char)(128 + 127 * std::sin(x * 0.02) * std::cos(y * 0.03));
+            }
+    }
+
+    const BcFormat formats[4] = {BC1, BC3, BC4, BC5};
+    const char *formatNames[4] = {"BC1", "BC3", "BC4", "BC5"};
+    const char *qualityNames[2] = {"fast", "high"};
+    double mpixels = (double)width * height / 1e6;
+    std::cout << "bc: " << (path.empty() ? "procedural" : path) << ", " << width << "x" << height << ", "
+              << jobSystem().threadCount() << " threads\n";
+    for (int f = 0; f < 4; f++)
+    {
+        int channels = bcChannels(formats[f]);
+        std::vector<unsigned char> source((size_t)width * height * channels);
+        for (size_t i = 0; i < (size_t)width * height; i++)
+            for (int c = 0; c < channels; c++)
+                source[i * channels + c] = rgba[i * 4 + c];
+        std::vector<unsigned char> serial(bcCompressedSize(formats[f], width, height)), threaded(serial.size());
+        double psnr[2];
+        for (int q = 0; q < 2; q++)
+        {
+            BcQuality quality = q ? BC_HIGH : BC_FAST;
+            double best[2] = {1e30, 1e30};
+            for (int run = 0; run < runs; run++)
+            {
+                double t0 = benchMilliseconds();
+                bcCompress(&source[0], width, height, channels, formats[f], quality, &serial[0]);
+                double t1 = benchMilliseconds();
+                bcCompress(&source[0], width, height, channels, formats[f], quality, &threaded[0], &jobSystem());
+                double t2 = benchMilliseconds();
+                best[0] = std::min(best[0], t1 - t0);
+                best[1] = std::min(best[1], t2 - t1);
+            }
+            failures += serial != threaded;
+            psnr[q] = bcPsnr(&source[0], width, height, channels, formats[f], &serial[0]);
+            std::cout << "  " << formatNames[f] << " " << qualityNames[q] << ": 1 thread " << mpixels / (best[0] / 1000.0)
+                      << " Mpixels/s, " << jobSystem().threadCount() << " threads " << mpixels / (best[1] / 1000.0)
+                      << " Mpixels/s, PSNR " << psnr[q] << " dB\n";
+        }
+        // the refinement may only ever help
+        failures += psnr[1] < psnr[0] - 0.01;
+    }
+    std::cout << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// the scalar 2x2 mean the texture cache used to bake mips with, sRGB values averaged
+// as they are (a lone row or column at the edge of an odd size is dropped)
+inline void benchDownsampleBox(const unsigned char *source, int width, int height, int channels, unsigned char *target)
+{
+    int w = width > 1 ? width / 2 : 1, h = height > 1 ? height / 2 : 1;
+    int dx = width > 1 ? channels : 0;
+    size_t dy = height > 1 ? (size_t)width * channels : 0;
+    for (int y = 0; y < h; y++)
+    {
+        const unsigned char *row = source + (size_t)(height > 1 ? 2 * y : y) * width * channels;
+        for (int x = 0; x < w; x++)
+        {
+            const unsigned char *p = row + (width > 1 ? 2 * x : x) * channels;
+            for (int c = 0; c < channels; c++)
+                *target++ = (unsigned char)((p[c] + p[c + dx] + p[c + dy] + p[c + dy + dx] + 2) >> 2);
+        }
+    }
+}
+
+// the same 2x2 mean done as the resampler's box does it, for like-for-like timing: RGBA,
+// colour decoded from sRGB through the same table, premultiplied by alpha, averaged,
+// unpremultiplied and encoded again, one texel at a time
+inline void benchDownsampleLinearBox(const unsigned char *source, int width, int height, unsigned char *target)
+{
+    const float *toLinear = imageSrgbToLinear();
+    const unsigned char *toSrgb = imageLinearToSrgb();
+    int w = width > 1 ? width / 2 : 1, h = height > 1 ? height / 2 : 1;
+    int dx = width > 1 ? 4 : 0;
+    size_t dy = height > 1 ? (size_t)width * 4 : 0;
+    for (int y = 0; y < h; y++)
+    {
+        const unsigned char *row = source + (size_t)(height > 1 ? 2 * y : y) * width * 4;
+        for (int x = 0; x < w; x++, target += 4)
+        {
+            const unsigned char *p = row + (width > 1 ? 2 * x : x) * 4;
+            const unsigned char *quad[4] = {p, p + dx, p + dy, p + dy + dx};
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (int k = 0; k < 4; k++)
+            {
+                float a = quad[k][3] / 255.0f;
+                for (int c = 0; c < 3; c++)
+                    sum[c] += toLinear[quad[k][c]] * a;
+                sum[3] += a;
+            }
+            for (int c = 0; c < 3; c++)
+                target[c] = sum[3] > 0.0f ? toSrgb[(int)(std::min(sum[c] / sum[3], 1.0f) * 65535.0f + 0.5f)] : 0;
+            target[3] = (unsigned char)(sum[3] * 0.25f * 255.0f + 0.5f);
+        }
+    }
+}
+
+// mip downsampling, resizing and blurring (imaging.hpp) of a procedural 2048x2048 RGBA
+// image with soft alpha, on one thread and on the job system, against the plain 8-bit
+// box loop and the same box in linear light one texel at a time. Checks: the sRGB
+// tables against glm's conversions, every code surviving the round trip, a black and
+// white checkerboard averaging to linear grey (sRGB 188, where averaging the codes
+// gives 128), a two-channel data image filtered channel by channel, the box matching
+// the linear-light loop, and the same output however the rows are banded.
+inline int benchMipmaps()
+{
+    const int size = 2048, runs = 3;
+    int failures = 0;
+    const float *toLinear = imageSrgbToLinear();
+    const unsigned char *toSrgb = imageLinearToSrgb();
+    for (int i = 0; i < 256; i++)
+    {
+        failures += std::fabs(toLinear[i] - glm::convertSRGBToLinear(glm::vec3(i / 255.0f)).x) > 1e-6f;
+        failures += toSrgb[(int)(toLinear[i] * 65535.0f + 0.5f)] != i;
+    }
+    for (int i = 0; i <= 65535; i += 7)
+        failures += std::abs((int)toSrgb[i] - (int)(glm::convertLinearToSRGB(glm::vec3(i / 65535.0f)).x * 255.0f + 0.5f)) > 1;
+
+    std::vector<unsigned char> checker(16 * 16 * 3), grey(8 * 8 * 3);
+    for (int i = 0; i < 16 * 16; i++)
+        memset(&checker[i * 3], ((i + i / 16) & 1) * 255, 3);
+    downsampleImage(&checker[0], 16, 16, 3, &grey[0], FILTER_BOX, IMAGE_SRGB);
+    for (size_t i = 0; i < grey.size(); i++)
+        failures += grey[i] != 188;
+
+    // a two-channel normal map's y isn't an alpha: x survives where y is 0, and neither
+    // goes through the sRGB curve
+    std::vector<unsigned char> normals(16 * 16 * 2), halfNormals(8 * 8 * 2);
+    for (int i = 0; i < 16 * 16; i++)
+    {
+        normals[i * 2] = (i & 1) ? 100 : 200;
+        normals[i * 2 + 1] = (i / 16 & 1) ? 0 : 64;
+    }
+    downsampleImage(&normals[0], 16, 16, 2, &halfNormals[0], FILTER_BOX, IMAGE_DATA);
+    for (int i = 0; i < 8 * 8; i++)
+        failures += halfNormals[i * 2] != 150 || halfNormals[i * 2 + 1] != 32;
+
+    std::vector<unsigned char> image((size_t)size * size * 4);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char *p = &image[((size_t)y * size + x) * 4];
+            p[0] = (unsigned char)(x * 255 / size);
+            p[1] = (unsigned char)(((x / 32 + y / 32) & 1) ? 220 : 30);
+            p[2] = (unsigned char)(128 + 127 * std::sin(x * 0.05) * std::cos(y * 0.07));
+            p[3] = (unsigned char)std::min(255, std::max(0, (int)(std::hypot(x - size / 2.0, y - size / 2.0) * 255 / size)));
+        }
+    std::vector<unsigned char> serial((size_t)size * size * 4), threaded(serial.size()), linearBox(serial.size());
+    double mpixels = (double)size * size / 1e6;
+    std::cout << "mipmaps: " << size << "x" << size << " RGBA, " << jobSystem().threadCount() << " threads\n";
+
+    double best = 1e30;
+    for (int run = 0; run < runs; run++)
+    {
+        double t0 = benchMilliseconds();
+        benchDownsampleBox(&image[0], size, size, 4, &serial[0]);
+        best = std::min(best, benchMilliseconds() - t0);
+    }
+    std::cout << "  8-bit box loop, 1 thread: " << best << " ms, " << mpixels / (best / 1000.0) << " Mpixels/s\n";
+    best = 1e30;
+    for (int run = 0; run < runs; run++)
+    {
+        double t0 = benchMilliseconds();
+        benchDownsampleLinearBox(&image[0], size, size, &linearBox[0]);
+        best = std::min(best, benchMilliseconds() - t0);
+    }
+    std::cout << "  linear-light box loop, 1 thread: " << best << " ms, " << mpixels / (best / 1000.0) << " Mpixels/s\n";
+
+    const char *names[5] = {"box", "kaiser", "lanczos", "resize lanczos to 1333x1333", "blur sigma 2"};
+    for (int kernel = 0; kernel < 5; kernel++)
+    {
+        double times[2] = {1e30, 1e30};
+        for (int run = 0; run < runs; run++)
+            for (int parallel = 0; parallel < 2; parallel++)
+            {
+                unsigned char *out = parallel ? &threaded[0] : &serial[0];
+                JobSystem *jobs = parallel ? &jobSystem() : NULL;
+                double t0 = benchMilliseconds();
+                if (kernel < 3)
+                    downsampleImage(&image[0], size, size, 4, out, (ImageFilter)kernel, IMAGE_SRGB, jobs);
+                else if (kernel == 3)
+                    resizeImage(&image[0], size, size, 4, out, 1333, 1333, FILTER_LANCZOS, IMAGE_SRGB, jobs);
+                else
+                    blurImage(&image[0], size, size, 4, out, 2.0f, IMAGE_SRGB, jobs);
+                times[parallel] = std::min(times[parallel], benchMilliseconds() - t0);
+            }
+        failures += serial != threaded;
+        // the resampler's box is the linear-light loop's mean, give or take rounding
+        for (size_t i = 0; kernel == FILTER_BOX && i < linearBox.size() / 4; i++)
+            failures += std::abs((int)serial[i] - (int)linearBox[i]) > 1;
+        std::cout << "  " << names[kernel] << ": 1 thread " << times[0] << " ms, " << mpixels / (times[0] / 1000.0) << " Mpixels/s; "
+                  << jobSystem().threadCount() << " threads " << times[1] << " ms (" << times[0] / times[1] << "x)\n";
+    }
+
+    // the whole chain the texture cache bakes
+    double t0 = benchMilliseconds();
+    const unsigned char *level = &image[0];
+    std::vector<unsigned char> levels[2];
+    int levelCount = 1;
+    for (int w = size; w > 1; w /= 2, levelCount++)
+    {
+        levels[levelCount & 1].resize((size_t)(w / 2) * (w / 2) * 4);
+        downsampleImage(level, w, w, 4, &levels[levelCount & 1][0], FILTER_KAISER, IMAGE_SRGB, &jobSystem());
+        level = &levels[levelCount & 1][0];
+    }
+    std::cout << "  kaiser mip chain, " << levelCount << " levels: " << benchMilliseconds() - t0 << " ms\n"
+              << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// an HDR image (a file or, without one, a procedural sky spanning a wide range of
+// exponents) decoded whole to floats by stbi_loadf against streamed to half floats a
+// band at a time as the PBO uploads do; every half must match the float it rounds
+inline int benchHdr(const std::string &path)
+{
+    const int runs = 5, band = 64;
+    std::string source = path;
+    if (source.empty())
+    {
+        const int width = 2048, height = 1024;
+        std::vector<float> sky((size_t)width * height * 3);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                float *p = &sky[((size_t)y * width + x) * 3];
+                float sun = std::exp(-((x - 1400.0f) * (x - 1400.0f) + (y - 200.0f) * (y - 200.0f)) / 800.0f);
+                float horizon = std::exp2(-y / 64.0f) * 4.0f;
+                p[0] = horizon + 50000.0f * sun + x * 1e-6f;
+                p[1] = horizon * 1.2f + 40000.0f * sun;
+                p[2] = horizon * 2.0f + (((x / 32 + y / 32) & 1) ? 0.001f : 0.0f);
+            }
+        source = "bench.hdr";
+        if (!stbi_write_hdr(source.c_str(), width, height, 3, &sky[0]))
+        {
+            std::cout << "ERROR::BENCH::CANNOT_WRITE: " << source << std::endl;
+            return 1;
+        }
+    }
+
+    MappedFile file;
+    HdrImage hdr;
+    if (!file.open(source.c_str()) || !hdr.open(source.c_str()))
+    {
+        std::cout << "ERROR: cannot open " << source << " as an HDR image\n";
+        return 1;
+    }
+    int width = hdr.width(), height = hdr.height(), channels, failures = 0;
+    double best[2] = {1e30, 1e30};
+    float *reference = NULL;
+    std::vector<uint16_t> halves((size_t)width * height * 3);
+    for (int run = 0; run < runs; run++)
+    {
+        double t0 = benchMilliseconds();
+        float *floats = stbi_loadf_from_memory(file.data, (int)file.size, &width, &height, &channels, 3);
+        double t1 = benchMilliseconds();
+        hdr.open(source.c_str());
+        for (int row = 0; row < height;)
+        {
+            int read = hdr.read(band, &halves[(size_t)row * width * 3]);
+            failures += read == 0;
+            row += read ? read : height;
+        }
+        double t2 = benchMilliseconds();
+        best[0] = std::min(best[0], t1 - t0);
+        best[1] = std::min(best[1], t2 - t1);
+        stbi_image_free(reference);
+        reference = floats;
+    }
+    for (size_t i = 0; reference && i < halves.size(); i++)
+        failures += halves[i] != glm::packHalf1x16(std::min(reference[i], 65504.0f));
+    failures += !reference;
+    stbi_image_free(reference);
+    if (path.empty())
+        remove(source.c_str());
+
+    double mpixels = (double)width * height / 1e6;
+    std::cout << "hdr: " << (path.empty() ? "procedural" : path) << ", " << width << "x" << height << "\n"
+              << "  stbi_loadf:       " << best[0] << " ms, " << mpixels / (best[0] / 1000.0) << " Mpixels/s, "
+              << (double)width * height * 12 / 1048576.0 << " MB of floats\n"
+              << "  streamed to half: " << best[1] << " ms, " << mpixels / (best[1] / 1000.0) << " Mpixels/s, "
+              << (double)band * hdr.rowBytes() / 1048576.0 << " MB per " << band << "-row band, "
+              << (double)width * height * 6 / 1048576.0 << " MB on the GPU (" << best[0] / best[1] << "x)\n"
+              << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// packing sprites into atlas pages: 2000 of random sizes and channel counts in a
+// batch, tallest first, then 1000 more one at a time in arrival order as at runtime.
+// Every image must come back out of its page with its edges repeated around it,
+// no two cells may overlap, and each mip level of a cell must be what the cell
+// alone filters down to, nothing of a neighbour in it
+inline int benchAtlas()
+{
+    const int batch = 2000, incremental = 1000, pageSize = 2048, padding = 4, mipLevels = 3;
+    struct Sprite
+    {
+        int width, height, channels;
+        std::vector<unsigned char> pixels;
+    };
+    std::vector<Sprite> sprites(batch + incremental);
+    unsigned int seed = 7;
+    for (size_t i = 0; i < sprites.size(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        sprites[i].width = 8 + (seed >> 8) % 89;
+        sprites[i].height = 8 + (seed >> 16) % 89;
+        sprites[i].channels = 1 + (seed >> 28) % 4;
+        sprites[i].pixels.resize((size_t)sprites[i].width * sprites[i].height * sprites[i].channels);
+        for (size_t k = 0; k < sprites[i].pixels.size(); k++)
+            sprites[i].pixels[k] = (unsigned char)((k * 2654435761u + i * 40503u) >> 11);
+    }
+    std::vector<unsigned int> order(batch);
+    for (int i = 0; i < batch; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sprites[a].height > sprites[b].height; });
+
+    TextureAtlas atlas(pageSize, padding, mipLevels);
+    std::vector<int> ids(sprites.size(), -1);
+    double t0 = benchMilliseconds();
+    for (int i = 0; i < batch; i++)
+        ids[order[i]] = atlas.add(&sprites[order[i]].pixels[0], sprites[order[i]].width, sprites[order[i]].height, sprites[order[i]].channels);
+    int batchPages = atlas.pageCount();
+    double t1 = benchMilliseconds();
+    for (size_t i = batch; i < sprites.size(); i++)
+        ids[i] = atlas.add(&sprites[i].pixels[0], sprites[i].width, sprites[i].height, sprites[i].channels);
+    double t2 = benchMilliseconds();
+
+    int failures = 0, grid = 1 << (mipLevels - 1);
+    std::vector<std::vector<int> > owner(atlas.pageCount(), std::vector<int>((pageSize / grid) * (pageSize / grid), -1));
+    std::vector<std::vector<unsigned char> > pageLevels(atlas.pageCount() * mipLevels);
+    for (int p = 0; p < atlas.pageCount(); p++)
+        for (int level = 0; level < mipLevels; level++)
+            pageLevels[p * mipLevels + level] = atlas.pageLevel(p, level);
+    std::vector<unsigned char> cell, half;
+    for (size_t i = 0; i < sprites.size(); i++)
+    {
+        if (ids[i] < 0)
+        {
+            failures++;
+            continue;
+        }
+        const Sprite &sprite = sprites[i];
+        AtlasEntry entry = atlas.entry(ids[i]);
+        glm::vec2 low = atlas.remap(ids[i], glm::vec2(0.0f)), high = atlas.remap(ids[i], glm::vec2(1.0f));
+        failures += glm::any(glm::greaterThan(glm::abs(low - glm::vec2(entry.x, entry.y) / (float)pageSize), glm::vec2(1e-6f))) ||
+                    glm::any(glm::greaterThan(glm::abs(high - glm::vec2(entry.x + sprite.width, entry.y + sprite.height) / (float)pageSize), glm::vec2(1e-6f)));
+
+        int cellX = entry.x - padding, cellY = entry.y - padding;
+        int cellWidth = (sprite.width + 2 * padding + grid - 1) / grid * grid, cellHeight = (sprite.height + 2 * padding + grid - 1) / grid * grid;
+        for (int y = cellY / grid; y < (cellY + cellHeight) / grid; y++)
+            for (int x = cellX / grid; x < (cellX + cellWidth) / grid; x++)
+            {
+                int &cellOwner = owner[entry.page][y * (pageSize / grid) + x];
+                failures += cellOwner >= 0;
+                cellOwner = (int)i;
+            }
+
+        // the cell as it should be: the sprite's texels, its edges repeated outwards
+        cell.resize((size_t)cellWidth * cellHeight * 4);
+        for (int y = 0; y < cellHeight; y++)
+            for (int x = 0; x < cellWidth; x++)
+            {
+                int sx = std::min(std::max(x - padding, 0), sprite.width - 1), sy = std::min(std::max(y - padding, 0), sprite.height - 1);
+                const unsigned char *in = &sprite.pixels[((size_t)sy * sprite.width + sx) * sprite.channels];
+                unsigned char *out = &cell[((size_t)y * cellWidth + x) * 4];
+                out[0] = in[0];
+                out[1] = sprite.channels >= 3 ? in[1] : in[0];
+                out[2] = sprite.channels >= 3 ? in[2] : in[0];
+                out[3] = sprite.channels == 2 ? in[1] : sprite.channels == 4 ? in[3] : 255;
+            }
+        for (int level = 0; level < mipLevels; level++)
+        {
+            int w = cellWidth >> level, h = cellHeight >> level, stride = pageSize >> level;
+            const unsigned char *page = &pageLevels[entry.page * mipLevels + level][0];
+            for (int y = 0; y < h; y++)
+                failures += memcmp(&cell[(size_t)y * w * 4], page + ((size_t)((cellY >> level) + y) * stride + (cellX >> level)) * 4, (size_t)w * 4) != 0;
+            if (level + 1 < mipLevels)
+            {
+                half.resize((size_t)(w / 2) * (h / 2) * 4);
+                downsampleImage(&cell[0], w, h, 4, &half[0], FILTER_BOX, IMAGE_SRGB);
+                cell.swap(half);
+            }
+        }
+    }
+
+    float occupancy = 0.0f;
+    for (int p = 0; p < atlas.pageCount(); p++)
+        occupancy += atlas.occupancy(p) / atlas.pageCount();
+    std::cout << "atlas: " << sprites.size() << " sprites 8 to 96 texels a side into " << pageSize << "x" << pageSize << " pages, "
+              << padding << " texels of padding, " << mipLevels << " mip levels\n"
+              << "  batch, tallest first: " << batch << " in " << t1 - t0 << " ms, " << batchPages << " pages\n"
+              << "  one at a time:        " << incremental << " in " << t2 - t1 << " ms, " << (t2 - t1) * 1000.0 / incremental << " us each\n"
+              << "  " << atlas.pageCount() << " pages, " << occupancy * 100.0f << "% of their area in cells\n"
+              << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// the feedback the virtual texture pass would read back for a 1280x720 view of a
+// plane holding the texture, seen square on around centre at density texels per
+// pixel, into a 160x90 target: what vtFeedback() writes, texel for texel
+inline void benchVirtualFeedback(const VirtualTexture &texture, glm::vec2 centre, float density, std::vector<unsigned char> &feedback)
+{
+    const int screenWidth = 1280, screenHeight = 720, width = 160, height = 90;
+    feedback.assign((size_t)width * height * 4, 0);
+    int level = std::min(std::max((int)std::floor(std::log2(density)), 0), texture.levels() - 1);
+    glm::vec2 span = glm::vec2(screenWidth, screenHeight) * density / glm::vec2(texture.width(), texture.height());
+    glm::vec2 levelSize = glm::max(glm::floor(glm::vec2(texture.width(), texture.height()) * std::exp2(-(float)level)), glm::vec2(1.0f));
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec2 uv = centre + (glm::vec2((x + 0.5f) / width, (y + 0.5f) / height) - 0.5f) * span;
+            if (uv.x < 0.0f || uv.y < 0.0f || uv.x >= 1.0f || uv.y >= 1.0f)
+                continue;
+            glm::ivec2 tile = glm::ivec2(glm::min(uv * levelSize, levelSize - 0.001f) / (float)VirtualTextureHeader::TILE_SIZE);
+            unsigned char *p = &feedback[((size_t)y * width + x) * 4];
+            p[0] = (unsigned char)(tile.x & 255);
+            p[1] = (unsigned char)(tile.y & 255);
+            p[2] = (unsigned char)((tile.x >> 8) | (tile.y >> 8) << 4);
+            p[3] = (unsigned char)(level + 1);
+        }
+}
+
+// a 4096x4096 virtual texture in 128x128 tiles through a 16x16 tile cache: baking the
+// tile file, then 400 frames of a camera panning and zooming over it, feedback to
+// update() each frame, and 30 more frames holding still. Every tile must hold its
+// texels and borders, every indirection texel must point at its own tile or an
+// ancestor in the cache, and once the camera holds still every tile it wants must
+// end up resident
+inline int benchVirtual()
+{
+    const int size = 4096, frames = 400, still = 30;
+    const std::string path = "bench.vtex";
+    std::vector<unsigned char> pixels((size_t)size * size * 4);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char *p = &pixels[((size_t)y * size + x) * 4];
+            p[0] = (unsigned char)(x >> 4);
+            p[1] = (unsigned char)(y >> 4);
+            p[2] = (unsigned char)((((x >> 6) ^ (y >> 6)) & 1) ? 220 : 30);
+            p[3] = (unsigned char)(x * 7 + y * 13);
+        }
+    double t0 = benchMilliseconds();
+    if (!bakeVirtualTexture(&pixels[0], size, size, path, &jobSystem()))
+        return 1;
+    double bake = benchMilliseconds() - t0;
+
+    VirtualTexture texture(16, 16);
+    if (!texture.open(path))
+    {
+        std::cout << "ERROR: cannot open " << path << std::endl;
+        return 1;
+    }
+    int failures = 0, slot = texture.slotSize(), border = VirtualTextureHeader::BORDER;
+    uint64_t tiles = 0, chainBytes = 0;
+    for (int l = 0; l < texture.levels(); l++)
+    {
+        tiles += (uint64_t)texture.tilesX(l) * texture.tilesY(l);
+        chainBytes += (uint64_t)std::max(size >> l, 1) * std::max(size >> l, 1) * 4;
+    }
+
+    // level 0's tiles are the source's texels, edges repeated at the image's edge
+    for (int ty = 0; ty < texture.tilesY(0); ty++)
+        for (int tx = 0; tx < texture.tilesX(0); tx++)
+        {
+            const unsigned char *tile = texture.tile(0, tx, ty);
+            for (int y = 0; y < slot; y++)
+            {
+                int sy = std::min(std::max(ty * 128 + y - border, 0), size - 1);
+                for (int x = 0; x < slot; x++)
+                {
+                    int sx = std::min(std::max(tx * 128 + x - border, 0), size - 1);
+                    failures += memcmp(tile + ((size_t)y * slot + x) * 4, &pixels[((size_t)sy * size + sx) * 4], 4) != 0;
+                }
+            }
+        }
+
+    std::vector<unsigned char> feedback;
+    double updating = 0.0;
+    for (int frame = 0; frame < frames + still; frame++)
+    {
+        float t = (float)std::min(frame, frames);
+        glm::vec2 centre(0.5f + 0.35f * std::cos(t * 0.02f), 0.5f + 0.35f * std::sin(t * 0.03f));
+        float density = std::exp2(3.0f * (0.5f + 0.5f * std::sin(t * 0.013f)));
+        benchVirtualFeedback(texture, centre, density, feedback);
+        double t1 = benchMilliseconds();
+        texture.request(&feedback[0], feedback.size() / 4);
+        texture.update();
+        updating += benchMilliseconds() - t1;
+
+        for (int l = 0; l < texture.levels(); l++)
+        {
+            const uint32_t *entries = texture.indirectionLevel(l);
+            for (int y = 0; y < texture.tilesY(l); y++)
+                for (int x = 0; x < texture.tilesX(l); x++)
+                {
+                    uint32_t entry = entries[y * texture.tilesX(l) + x];
+                    int level, tx, ty, found = (entry >> 16) & 255;
+                    bool ok = entry >> 24 == 255 && texture.slotTile((entry >> 8 & 255) * 16 + (entry & 255), level, tx, ty) && level == found &&
+                              level >= l && tx == std::min(x >> (level - l), texture.tilesX(level) - 1) &&
+                              ty == std::min(y >> (level - l), texture.tilesY(level) - 1);
+                    failures += !ok;
+                }
+        }
+    }
+    for (size_t i = 0; i < feedback.size(); i += 4)
+        if (feedback[i + 3])
+            failures += !texture.resident(feedback[i + 3] - 1, feedback[i] | (feedback[i + 2] & 15) << 8, feedback[i + 1] | (feedback[i + 2] >> 4) << 8);
+    remove(path.c_str());
+
+    double mb = 1.0 / 1048576.0;
+    std::cout << "virtual texture: " << size << "x" << size << ", " << texture.levels() << " levels, " << tiles << " tiles of " << slot << "x" << slot
+              << ", 16x16 slot cache\n"
+              << "  bake: " << bake << " ms, " << tiles * slot * slot * 4 * mb << " MB tile file\n"
+              << "  " << frames + still << " frames: request + update " << updating * 1000.0 / (frames + still) << " us per frame, "
+              << texture.hits << " hits, " << texture.misses << " misses, " << texture.loads << " tiles streamed, " << texture.evictions
+              << " evicted, " << texture.starvedFrames << " frames wanting more than the cache\n"
+              << "  cache " << texture.slotCount() * slot * slot * 4 * mb << " MB against " << chainBytes * mb << " MB for the whole mip chain\n"
+              << "  " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// the GL side of virtual textures, with a context current: virtualTextureGlsl()
+// compiled into a feedback and a drawing program, init(), two feedback frames through
+// begin/end and read(), upload(), then one draw sampling through the indirection.
+// glGetError must stay clean, the feedback must ask for the tile the camera sees and
+// the draw must come out in that tile's colour
+inline int benchVirtualGlChecks()
+{
+    const int size = 1024, block = 256, target = 32;
+    const std::string path = "bench-gl.vtex";
+    // a flat colour per 256x256 block, so filtering leaves the middle of each alone
+    std::vector<unsigned char> pixels((size_t)size * size * 4);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char *p = &pixels[((size_t)y * size + x) * 4];
+            p[0] = (unsigned char)(40 + 50 * (x / block));
+            p[1] = (unsigned char)(40 + 50 * (y / block));
+            p[2] = 128;
+            p[3] = 255;
+        }
+    if (!bakeVirtualTexture(&pixels[0], size, size, path))
+        return 1;
+    VirtualTexture texture(4, 4);
+    if (!texture.open(path))
+    {
+        std::cout << "ERROR: cannot open " << path << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    auto check = [&failures](const char *step) {
+        for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError())
+        {
+            std::cout << "ERROR::BENCH::GL: 0x" << std::hex << error << std::dec << " after " << step << std::endl;
+            failures++;
+        }
+    };
+    check("context creation");
+
+    // a full-screen triangle over uv (0, 0) to (0.125, 0.125): 128x128 texels of level
+    // 0, 4 texels to a feedback texel, so level 2's first tile, inside block (0, 0)
+    const char *vertexSource = "#version 330 core\n"
+                               "out vec2 uv;\n"
+                               "void main()\n"
+                               "{\n"
+                               "   vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0;\n"
+                               "   uv = corner * 0.125;\n"
+                               "   gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);\n"
+                               "}\n";
+    std::string header = std::string("#version 330 core\n") + virtualTextureGlsl() + "in vec2 uv;\nout vec4 FragColor;\n";
+    std::string feedbackSource = header + "void main() { FragColor = vtFeedback(uv); }\n";
+    std::string drawSource = header + "void main() { FragColor = vtSample(uv); }\n";
+    unsigned int feedbackProgram = ResourceLoader::buildProgram(vertexSource, feedbackSource.c_str());
+    unsigned int drawProgram = ResourceLoader::buildProgram(vertexSource, drawSource.c_str());
+    failures += !feedbackProgram + !drawProgram;
+    unsigned int vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    check("building the programs");
+
+    failures += !texture.init();
+    VirtualTextureFeedback feedback;
+    feedback.init(target, target);
+    check("init");
+
+    texture.upload(); // the pinned coarsest tile
+    bool read = false;
+    for (int frame = 0; frame < 2 && feedbackProgram; frame++)
+    {
+        feedback.begin();
+        glUseProgram(feedbackProgram);
+        texture.setUniforms(feedbackProgram, 0, 1, feedback.levelBias(target));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        feedback.end();
+        read = feedback.read(texture);
+    }
+    failures += !read;
+    check("the feedback pass");
+
+    texture.update();
+    uint64_t bytes = texture.upload();
+    failures += bytes == 0 || !texture.resident(2, 0, 0);
+    check("upload");
+
+    unsigned char colour[4] = {0, 0, 0, 0};
+    if (drawProgram)
+    {
+        glViewport(0, 0, target, target);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glUseProgram(drawProgram);
+        texture.setUniforms(drawProgram, 0, 1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(target / 2, target / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, colour);
+        for (int c = 0; c < 4; c++)
+            failures += std::abs((int)colour[c] - (int)pixels[c]) > 2;
+    }
+    check("drawing");
+
+    std::cout << "virtual texture GL: " << size << "x" << size << ", " << texture.levels() << " levels, " << target << "x" << target
+              << " feedback; " << texture.loads << " tiles requested, " << bytes << " bytes uploaded, drew (" << (int)colour[0] << ", "
+              << (int)colour[1] << ", " << (int)colour[2] << ", " << (int)colour[3] << ")\n"
+              << "  " << failures << " failures" << std::endl;
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(feedbackProgram);
+    glDeleteProgram(drawProgram);
+    feedback.deleteBuffers();
+    texture.deleteTextures();
+    return failures ? 1 : 0;
+}
+
+// the same in a hidden window's context, which headless builds (-DAPP_HEADLESS=ON)
+// get from OSMesa
+inline int benchVirtualGl()
+{
+    if (!glfwInit())
+    {
+        std::cout << "ERROR: cannot initialise GLFW" << std::endl;
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "bench", NULL, NULL);
+    if (!window)
+    {
+        std::cout << "ERROR: cannot create a GL 3.3 context" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    int result = 1;
+    if (gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        result = benchVirtualGlChecks();
+    else
+        std::cout << "ERROR: cannot load the GL functions" << std::endl;
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return result;
+}
+
+inline int runBenchmark(const std::string &name, const std::string &input = "")
+{
+    if (name == "geometry")
+        return benchGeometry();
+    if (name == "raytrace")
+        return benchRaytrace();
+    if (name == "spatial")
+        return benchSpatial();
+    if (name == "jobs")
+        return benchJobs();
+    if (name == "textures")
+        return benchTextures();
+    if (name == "png")
+        return benchPng();
+    if (name == "inflate")
+        return benchInflate();
+    if (name == "jpeg")
+        return benchJpeg(input);
+    if (name == "bc")
+        return benchBc(input);
+    if (name == "mipmaps")
+        return benchMipmaps();
+    if (name == "hdr")
+        return benchHdr(input);
+    if (name == "atlas")
+        return benchAtlas();
+    if (name == "virtual")
+        return benchVirtual();
+    if (name == "virtual-gl")
+        return benchVirtualGl();
+    std::cout << "ERROR: unknown benchmark '" << name << "', expected one of: geometry, raytrace, spatial, jobs, textures, png, inflate, jpeg file.jpg, bc [image], mipmaps, hdr [image.hdr], atlas, virtual, virtual-gl\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <iostream>
+
+// lock-free log-linear histogram of durations in microseconds: exact below 16us, then
+// 16 buckets per power of two (about 6% resolution) up to ~35 minutes. Any thread may
+// add() and read it at the same time.
+class TimeHistogram
+{
+public:
+    static const unsigned int SUB_BUCKETS = 16;
+    static const unsigned int BUCKETS = (31 - 3) * SUB_BUCKETS + SUB_BUCKETS;
+
+    TimeHistogram() { reset(); }
+
+    void reset()
+    {
+        for (unsigned int i = 0; i < BUCKETS; i++)
+            counts[i].store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sumMicroseconds.store(0, std::memory_order_relaxed);
+        maxMicroseconds.store(0, std::memory_order_relaxed);
+    }
+
+    void add(uint64_t microseconds)
+    {
+        counts[bucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sumMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+        uint64_t max = maxMicroseconds.load(std::memory_order_relaxed);
+        while (microseconds > max && !maxMicroseconds.compare_exchange_weak(max, microseconds, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    double meanMilliseconds() const
+    {
+        uint64_t n = count();
+        return n ? sumMicroseconds.load(std::memory_order_relaxed) / 1000.0 / n : 0.0;
+    }
+
+    double maxMilliseconds() const { return maxMicroseconds.load(std::memory_order_relaxed) / 1000.0; }
+
+    // p in [0, 1], the middle of the bucket holding it
+    double percentileMilliseconds(double p) const
+    {
+        uint64_t n = count();
+        if (!n)
+            return 0.0;
+        uint64_t rank = std::min(n - 1, (uint64_t)(p * n)), seen = 0;
+        for (unsigned int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen > rank)
+                return std::min((double)(lowerBound(i) + lowerBound(i + 1)) / 2000.0, maxMilliseconds());
+        }
+        return maxMilliseconds();
+    }
+
+    static unsigned int bucket(uint64_t v)
+    {
+        if (v < SUB_BUCKETS)
+            return (unsigned int)v;
+        unsigned int exponent = 63;
+        while (!(v >> exponent))
+            exponent--;
+        unsigned int index = (exponent - 3) * SUB_BUCKETS + (unsigned int)((v >> (exponent - 4)) & (SUB_BUCKETS - 1));
+        return std::min(index, BUCKETS - 1);
+    }
+
+    static uint64_t lowerBound(unsigned int index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+        unsigned int exponent = index / SUB_BUCKETS + 3;
+        return (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << (exponent - 4);
+    }
+
+private:
+    std::atomic<uint32_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sumMicroseconds;
+    std::atomic<uint64_t> maxMicroseconds;
+};
+
+// one presented frame, in milliseconds
+struct FrameSample
+{
+    uint64_t index;
+    double start;    // since the stats were created
+    float frame;     // swap to swap, i.e. what the display sees
+    float cpu;       // beginFrame to endCpu: input, simulation sampling, culling, draw calls
+    float swap;      // inside glfwSwapBuffers
+    bool hitch;
+};
+
+struct TimeSummary
+{
+    unsigned int count;
+    double mean, p50, p95, p99, max;
+};
+
+struct PacingSummary
+{
+    TimeSummary frame, cpu, swap;
+    double jitter;         // mean change between consecutive frame times, ms
+    unsigned int hitches;
+};
+
+// frame-time statistics on glfwGetTimerValue: per-frame frame/CPU/swap times go into
+// whole-run histograms and a sliding window of recent frames. A frame counts as a
+// hitch when it takes hitchFactor times the window's median. The built-in version of
+// what GLFW's tests/inputlag.c and tests/tearing.c measure by hand.
+//
+// beginFrame/endCpu/endFrame are called on the render thread, which also owns the
+// window; the histograms can be read from anywhere.
+class FrameStats
+{
+public:
+    TimeHistogram frameHistogram, cpuHistogram, swapHistogram;
+    unsigned int windowSize;
+    float hitchFactor;
+    unsigned int hitchCount;
+    bool keepLog;                 // keep every frame for writeCsv, not just the window
+    std::vector<FrameSample> log;
+    std::vector<FrameSample> recentHitches; // the last 64
+
+    FrameStats(unsigned int window = 240)
+    {
+        windowSize = std::max(window, 2u);
+        hitchFactor = 2.0f;
+        hitchCount = 0;
+        keepLog = false;
+        frequency = glfwGetTimerFrequency();
+        created = glfwGetTimerValue();
+        frameBegin = cpuEnd = lastSwap = 0;
+        frames = 0;
+    }
+
+    void beginFrame() { frameBegin = glfwGetTimerValue(); }
+
+    // the frame's work is submitted, glfwSwapBuffers comes next
+    void endCpu() { cpuEnd = glfwGetTimerValue(); }
+
+    // right after glfwSwapBuffers
+    void endFrame()
+    {
+        uint64_t now = glfwGetTimerValue();
+        if (!cpuEnd || cpuEnd < frameBegin)
+            cpuEnd = now;
+        // after an idle wait the interval since the last swap is not a frame
+        uint64_t since = lastSwap ? lastSwap : frameBegin;
+
+        FrameSample sample;
+        sample.index = frames++;
+        sample.start = milliseconds(frameBegin - created);
+        sample.frame = (float)milliseconds(now - since);
+        sample.cpu = (float)milliseconds(cpuEnd - frameBegin);
+        sample.swap = (float)milliseconds(now - cpuEnd);
+        sample.hitch = window.size() >= 8 && sample.frame > hitchFactor * median();
+
+        frameHistogram.add(microseconds(now - since));
+        cpuHistogram.add(microseconds(cpuEnd - frameBegin));
+        swapHistogram.add(microseconds(now - cpuEnd));
+        if (sample.hitch)
+        {
+            hitchCount++;
+            recentHitches.push_back(sample);
+            if (recentHitches.size() > 64)
+                recentHitches.erase(recentHitches.begin());
+        }
+        if (window.size() < windowSize)
+            window.push_back(sample);
+        else
+            window[sample.index % windowSize] = sample;
+        if (keepLog)
+            log.push_back(sample);
+
+        lastSwap = now;
+        cpuEnd = 0;
+    }
+
+    // the render thread slept (on-demand redraw): don't count the gap as a frame
+    void idle() { lastSwap = 0; }
+
+    uint64_t frameCount() const { return frames; }
+
+    // the last windowSize frames
+    PacingSummary windowSummary() const
+    {
+        std::vector<float> frame, cpu, swap;
+        PacingSummary summary;
+        summary.hitches = 0;
+        summary.jitter = 0.0;
+        for (unsigned int i = 0; i < window.size(); i++)
+        {
+            frame.push_back(window[i].frame);
+            cpu.push_back(window[i].cpu);
+            swap.push_back(window[i].swap);
+            summary.hitches += window[i].hitch;
+        }
+        // consecutive frames in order, oldest first
+        unsigned int n = window.size();
+        unsigned int oldest = n < windowSize ? 0 : frames % windowSize;
+        for (unsigned int i = 1; i < n; i++)
+            summary.jitter += std::fabs(window[(oldest + i) % n].frame - window[(oldest + i - 1) % n].frame);
+        if (n > 1)
+            summary.jitter /= n - 1;
+        summary.frame = summarize(frame);
+        summary.cpu = summarize(cpu);
+        summary.swap = summarize(swap);
+        return summary;
+    }
+
+    // every frame since the start, from the histograms
+    PacingSummary totalSummary() const
+    {
+        PacingSummary summary;
+        summary.frame = summarize(frameHistogram);
+        summary.cpu = summarize(cpuHistogram);
+        summary.swap = summarize(swapHistogram);
+        summary.jitter = windowSummary().jitter; // needs the order of frames, only the window has it
+        summary.hitches = hitchCount;
+        return summary;
+    }
+
+    // one line for the console, over the window or the whole run
+    void print(const char *label, bool wholeRun = false) const
+    {
+        PacingSummary s = wholeRun ? totalSummary() : windowSummary();
+        std::cout << label << ": frame ms mean " << s.frame.mean << ", p50 " << s.frame.p50 << ", p95 " << s.frame.p95
+                  << ", p99 " << s.frame.p99 << ", max " << s.frame.max << "; cpu p95 " << s.cpu.p95 << ", swap p95 "
+                  << s.swap.p95 << "; jitter " << s.jitter << " ms, " << s.hitches << " hitches" << std::endl;
+    }
+
+    // .json gets the summaries, anything else one CSV line per frame
+    bool write(const char *path) const
+    {
+        std::string name(path);
+        if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+            return writeJson(path);
+        return writeCsv(path);
+    }
+
+    bool writeJson(const char *path) const
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            std::cout << "ERROR::FRAMESTATS::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        PacingSummary total = totalSummary(), recent = windowSummary();
+        fprintf(file, "{\n  \"frames\": %llu,\n  \"hitchFactor\": %g,\n", (unsigned long long)frames, hitchFactor);
+        fprintf(file, "  \"total\": ");
+        writeJson(file, total);
+        fprintf(file, ",\n  \"window\": ");
+        writeJson(file, recent);
+        fprintf(file, ",\n  \"recentHitches\": [");
+        for (unsigned int i = 0; i < recentHitches.size(); i++)
+            fprintf(file, "%s{\"frame\": %llu, \"ms\": %.4f}", i ? ", " : "", (unsigned long long)recentHitches[i].index,
+                    recentHitches[i].frame);
+        fprintf(file, "]\n}\n");
+        fclose(file);
+        return true;
+    }
+
+    // the whole log when keepLog is set, otherwise the window
+    bool writeCsv(const char *path) const
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            std::cout << "ERROR::FRAMESTATS::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        fprintf(file, "frame,start_ms,frame_ms,cpu_ms,swap_ms,hitch\n");
+        if (keepLog)
+            for (size_t i = 0; i < log.size(); i++)
+                writeCsv(file, log[i]);
+        else
+        {
+            unsigned int n = window.size();
+            unsigned int oldest = n < windowSize ? 0 : frames % windowSize;
+            for (unsigned int i = 0; i < n; i++)
+                writeCsv(file, window[(oldest + i) % n]);
+        }
+        fclose(file);
+        return true;
+    }
+
+private:
+    std::vector<FrameSample> window; // ring, slot index % windowSize
+    uint64_t frequency, created;
+    uint64_t frameBegin, cpuEnd, lastSwap; // timer values, lastSwap 0 after idle()
+    uint64_t frames;
+
+    double milliseconds(uint64_t ticks) const { return ticks * 1000.0 / frequency; }
+
+    uint64_t microseconds(uint64_t ticks) const { return (uint64_t)(ticks * 1000000.0 / frequency); }
+
+    float median() const
+    {
+        std::vector<float> frame;
+        for (unsigned int i = 0; i < window.size(); i++)
+            frame.push_back(window[i].frame);
+        std::nth_element(frame.begin(), frame.begin() + frame.size() / 2, frame.end());
+        return frame[frame.size() / 2];
+    }
+
+    static TimeSummary summarize(std::vector<float> values)
+    {
+        TimeSummary summary = {0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        if (values.empty())
+            return summary;
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        double total = 0.0;
+        for (size_t i = 0; i < n; i++)
+            total += values[i];
+        summary.count = n;
+        summary.mean = total / n;
+        summary.p50 = values[n / 2];
+        summary.p95 = values[n * 95 / 100];
+        summary.p99 = values[n * 99 / 100];
+        summary.max = values[n - 1];
+        return summary;
+    }
+
+    static TimeSummary summarize(const TimeHistogram &histogram)
+    {
+        TimeSummary summary;
+        summary.count = histogram.count();
+        summary.mean = histogram.meanMilliseconds();
+        summary.p50 = histogram.percentileMilliseconds(0.50);
+        summary.p95 = histogram.percentileMilliseconds(0.95);
+        summary.p99 = histogram.percentileMilliseconds(0.99);
+        summary.max = histogram.maxMilliseconds();
+        return summary;
+    }
+
+    static void writeJson(FILE *file, const TimeSummary &s)
+    {
+        fprintf(file, "{\"count\": %u, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}", s.count,
+                s.mean, s.p50, s.p95, s.p99, s.max);
+    }
+
+    static void writeJson(FILE *file, const PacingSummary &s)
+    {
+        fprintf(file, "{\n    \"frameMs\": ");
+        writeJson(file, s.frame);
+        fprintf(file, ",\n    \"cpuMs\": ");
+        writeJson(file, s.cpu);
+        fprintf(file, ",\n    \"swapMs\": ");
+        writeJson(file, s.swap);
+        fprintf(file, ",\n    \"jitterMs\": %.4f,\n    \"hitches\": %u\n  }", s.jitter, s.hitches);
+    }
+
+    static void writeCsv(FILE *file, const FrameSample &s)
+    {
+        fprintf(file, "%llu,%.4f,%.4f,%.4f,%.4f,%d\n", (unsigned long long)s.index, s.start, s.frame, s.cpu, s.swap, s.hitch ? 1 : 0);
+    }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#include <glm/simd/matrix.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "shapes.hpp"
+#include "jobs.hpp"
+
+// CPU geometry stage in front of glDrawElements: transforms a vertex stream by the MVP
+// into SoA clip-space arrays, then drops triangles that are outside the frustum, facing
+// away or too small to cover a pixel center, and emits a compacted index buffer.
+class GeometryStage
+{
+public:
+    enum Outcode
+    {
+        CLIP_LEFT = 1,
+        CLIP_RIGHT = 2,
+        CLIP_BOTTOM = 4,
+        CLIP_TOP = 8,
+        CLIP_NEAR = 16,
+        CLIP_FAR = 32
+    };
+
+    int viewportWidth, viewportHeight;
+    bool backfaceCulling;
+    bool smallTriangleCulling;
+    GLenum frontFace; // the shapes in shapes.hpp are wound clockwise when seen from outside
+
+    // per-vertex results of transform(), structure of arrays
+    std::vector<float> clipX, clipY, clipZ, clipW;
+    std::vector<float> windowX, windowY;
+    std::vector<unsigned char> outcodes;
+
+    // compacted output of cull()
+    std::vector<unsigned int> indices;
+    std::vector<DrawRange> ranges;
+    unsigned int trianglesIn, frustumCulled, backfaceCulled, smallCulled;
+    unsigned int EBO;
+    JobSystem *jobs; // splits transform() across workers when set
+
+    GeometryStage(int width, int height)
+    {
+        viewportWidth = width;
+        viewportHeight = height;
+        backfaceCulling = true;
+        smallTriangleCulling = true;
+        frontFace = GL_CW;
+        trianglesIn = frustumCulled = backfaceCulled = smallCulled = 0;
+        EBO = 0;
+        jobs = NULL;
+    }
+
+    template <typename Shape>
+    void process(const Shape &shape, const glm::mat4 &mvp)
+    {
+        transform(shape.vertices, mvp);
+        cull(shape.indices, shape.ranges);
+    }
+
+    // transform tightly packed xyz positions, four vertices per step
+    void transform(const std::vector<float> &vertices, const glm::mat4 &mvp)
+    {
+        unsigned int count = vertices.size() / 3;
+        resize(count);
+        if (jobs && count >= 65536)
+        {
+            // in groups of four so every job but the last stays on the SIMD path
+            jobs->parallelFor(0, (count + 3) / 4, [&](unsigned int begin, unsigned int end) {
+                transformRange(vertices, mvp, 4 * begin, std::min(count, 4 * end));
+            }, 1024);
+        }
+        else
+            transformRange(vertices, mvp, 0, count);
+    }
+
+    // vertices [begin, end) of transform(), the arrays must already be sized
+    void transformRange(const std::vector<float> &vertices, const glm::mat4 &mvp, unsigned int begin, unsigned int end)
+    {
+        const float *src = vertices.empty() ? NULL : &vertices[0];
+        unsigned int i = begin;
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+        glm_vec4 m[4];
+        for (int c = 0; c < 4; c++)
+            m[c] = _mm_loadu_ps(glm::value_ptr(mvp) + 4 * c);
+        // broadcast each matrix element once, the loop then is pure mul/add
+        glm_vec4 e[4][4];
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                e[c][r] = _mm_set1_ps(mvp[c][r]);
+
+        // the unaligned loads read one float past the fourth vertex, so stop a batch early
+        for (; i + 4 <= end && 3 * i + 13 <= vertices.size(); i += 4)
+        {
+            glm_vec4 x = _mm_loadu_ps(src + 3 * i);
+            glm_vec4 y = _mm_loadu_ps(src + 3 * i + 3);
+            glm_vec4 z = _mm_loadu_ps(src + 3 * i + 6);
+            glm_vec4 w = _mm_loadu_ps(src + 3 * i + 9);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            glm_vec4 out[4];
+            for (int r = 0; r < 4; r++)
+                out[r] = glm_vec4_fma(e[0][r], x, glm_vec4_fma(e[1][r], y, glm_vec4_fma(e[2][r], z, e[3][r])));
+            _mm_storeu_ps(&clipX[i], out[0]);
+            _mm_storeu_ps(&clipY[i], out[1]);
+            _mm_storeu_ps(&clipZ[i], out[2]);
+            _mm_storeu_ps(&clipW[i], out[3]);
+            classify4(i, out[0], out[1], out[2], out[3]);
+        }
+
+        for (; i < end; i++)
+        {
+            glm_vec4 v = glm_mat4_mul_vec4(m, _mm_setr_ps(src[3 * i], src[3 * i + 1], src[3 * i + 2], 1.0f));
+            glm::vec4 clip;
+            _mm_storeu_ps(glm::value_ptr(clip), v);
+            store(i, clip);
+        }
+#endif
+        for (; i < end; i++)
+            store(i, mvp * glm::vec4(src[3 * i], src[3 * i + 1], src[3 * i + 2], 1.0f));
+    }
+
+    // plain glm reference for transform(), one vertex at a time
+    void transformScalar(const std::vector<float> &vertices, const glm::mat4 &mvp)
+    {
+        unsigned int count = vertices.size() / 3;
+        resize(count);
+        for (unsigned int i = 0; i < count; i++)
+            store(i, mvp * glm::vec4(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], 1.0f));
+    }
+
+    // rebuild indices/ranges from the triangles that survive; needs transform() first
+    void cull(const std::vector<unsigned int> &srcIndices, const std::vector<DrawRange> &srcRanges)
+    {
+        indices.clear();
+        ranges.clear();
+        trianglesIn = frustumCulled = backfaceCulled = smallCulled = 0;
+
+        for (unsigned int r = 0; r < srcRanges.size(); r++)
+        {
+            DrawRange range = srcRanges[r];
+            range.first = indices.size();
+            for (unsigned int i = srcRanges[r].first; i + 2 < srcRanges[r].first + srcRanges[r].count; i += 3)
+            {
+                trianglesIn++;
+                if (keepTriangle(srcIndices[i], srcIndices[i + 1], srcIndices[i + 2]))
+                {
+                    indices.push_back(srcIndices[i]);
+                    indices.push_back(srcIndices[i + 1]);
+                    indices.push_back(srcIndices[i + 2]);
+                }
+            }
+            range.count = indices.size() - range.first;
+            if (range.count)
+                ranges.push_back(range);
+        }
+    }
+
+    // draw the compacted ranges with the shape's VAO; the VAO keeps its own element buffer
+    void draw(unsigned int *VAO, unsigned int *shapeEBO, unsigned int shaderProg)
+    {
+        if (EBO == 0)
+            glGenBuffers(1, &EBO);
+        glBindVertexArray(*VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.empty() ? NULL : &indices[0], GL_STREAM_DRAW);
+
+        int vertexColorLocation = glGetUniformLocation(shaderProg, "color");
+        for (unsigned int i = 0; i < ranges.size(); i++)
+        {
+            glUniform4fv(vertexColorLocation, 1, glm::value_ptr(ranges[i].color));
+            glDrawElements(GL_TRIANGLES, ranges[i].count, GL_UNSIGNED_INT, (void *)(ranges[i].first * sizeof(unsigned int)));
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *shapeEBO);
+        glBindVertexArray(0);
+    }
+
+    void deleteBuffers()
+    {
+        if (EBO)
+            glDeleteBuffers(1, &EBO);
+        EBO = 0;
+    }
+
+private:
+    void resize(unsigned int count)
+    {
+        clipX.resize(count);
+        clipY.resize(count);
+        clipZ.resize(count);
+        clipW.resize(count);
+        windowX.resize(count);
+        windowY.resize(count);
+        outcodes.resize(count);
+    }
+
+    void store(unsigned int i, const glm::vec4 &clip)
+    {
+        clipX[i] = clip.x;
+        clipY[i] = clip.y;
+        clipZ[i] = clip.z;
+        clipW[i] = clip.w;
+        outcodes[i] = (clip.x < -clip.w) * CLIP_LEFT | (clip.x > clip.w) * CLIP_RIGHT |
+                      (clip.y < -clip.w) * CLIP_BOTTOM | (clip.y > clip.w) * CLIP_TOP |
+                      (clip.z < -clip.w) * CLIP_NEAR | (clip.z > clip.w) * CLIP_FAR;
+        // window coordinates as GL computes them, y pointing up
+        windowX[i] = (clip.x / clip.w * 0.5f + 0.5f) * viewportWidth;
+        windowY[i] = (clip.y / clip.w * 0.5f + 0.5f) * viewportHeight;
+    }
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    void classify4(unsigned int i, glm_vec4 x, glm_vec4 y, glm_vec4 z, glm_vec4 w)
+    {
+        // each plane's compare masked to its outcode bit, ORed per lane and packed down
+        // to the four bytes
+        glm_vec4 negW = _mm_sub_ps(_mm_setzero_ps(), w);
+        glm_vec4 code = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(x, negW), _mm_castsi128_ps(_mm_set1_epi32(CLIP_LEFT))),
+                                  _mm_and_ps(_mm_cmpgt_ps(x, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_RIGHT))));
+        code = _mm_or_ps(code, _mm_and_ps(_mm_cmplt_ps(y, negW), _mm_castsi128_ps(_mm_set1_epi32(CLIP_BOTTOM))));
+        code = _mm_or_ps(code, _mm_and_ps(_mm_cmpgt_ps(y, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_TOP))));
+        code = _mm_or_ps(code, _mm_and_ps(_mm_cmplt_ps(z, negW), _mm_castsi128_ps(_mm_set1_epi32(CLIP_NEAR))));
+        code = _mm_or_ps(code, _mm_and_ps(_mm_cmpgt_ps(z, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_FAR))));
+        __m128i codes = _mm_castps_si128(code);
+        codes = _mm_packus_epi16(_mm_packs_epi32(codes, codes), codes);
+        int packed = _mm_cvtsi128_si32(codes);
+        memcpy(&outcodes[i], &packed, 4);
+
+        glm_vec4 half = _mm_set1_ps(0.5f);
+        glm_vec4 rcpW = _mm_div_ps(half, w);
+        glm_vec4 wx = glm_vec4_mul(glm_vec4_fma(x, rcpW, half), _mm_set1_ps((float)viewportWidth));
+        glm_vec4 wy = glm_vec4_mul(glm_vec4_fma(y, rcpW, half), _mm_set1_ps((float)viewportHeight));
+        _mm_storeu_ps(&windowX[i], wx);
+        _mm_storeu_ps(&windowY[i], wy);
+    }
+#endif
+
+    bool keepTriangle(unsigned int a, unsigned int b, unsigned int c)
+    {
+        // trivial reject: all three vertices outside the same plane
+        if (outcodes[a] & outcodes[b] & outcodes[c])
+        {
+            frustumCulled++;
+            return false;
+        }
+        // straddling the near plane: window coordinates are meaningless, keep it
+        if ((outcodes[a] | outcodes[b] | outcodes[c]) & CLIP_NEAR)
+            return true;
+
+        if (backfaceCulling)
+        {
+            float area = (windowX[b] - windowX[a]) * (windowY[c] - windowY[a]) -
+                         (windowX[c] - windowX[a]) * (windowY[b] - windowY[a]);
+            if (frontFace == GL_CW)
+                area = -area;
+            if (!(area > 0.0f))
+            {
+                backfaceCulled++;
+                return false;
+            }
+        }
+
+        if (smallTriangleCulling)
+        {
+            // no pixel center (k + 0.5) inside the bounding box on one of the axes
+            float minX = std::min(windowX[a], std::min(windowX[b], windowX[c]));
+            float maxX = std::max(windowX[a], std::max(windowX[b], windowX[c]));
+            float minY = std::min(windowY[a], std::min(windowY[b], windowY[c]));
+            float maxY = std::max(windowY[a], std::max(windowY[b], windowY[c]));
+            if (std::ceil(minX - 0.5f) > std::floor(maxX - 0.5f) || std::ceil(minY - 0.5f) > std::floor(maxY - 0.5f))
+            {
+                smallCulled++;
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef HDR_H
+#define HDR_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#define HDR_F16C 1
+#endif
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stb_image.h>
+#include "mappedfile.hpp"
+
+// RGBE texels (Radiance .hdr) to half floats, 3 per texel for GL_RGB16F: each mantissa
+// times 2^(exponent - 136), the scale's bits made straight from the exponent with SSE2
+// instead of an ldexp per texel, then to halves with F16C when the build targets it
+// (-mf16c or -march=native), else by moving the float's bits over with SSE2, and
+// glm::packHalf4x16 without either. An 8-bit mantissa always fits a half's, so the
+// halves are exact down to the subnormals; values past the largest half (65504) are
+// clamped to it rather than becoming infinities.
+inline void rgbeToHalf(const unsigned char *rgbe, int count, uint16_t *out)
+{
+    int i = 0;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi32(136 - 127);
+    glm_vec4 largest = _mm_set1_ps(65504.0f);
+    // four texels at a time; each stores four halves, the fourth overwritten by the
+    // next texel's, so the last texel goes by the scalar path
+    for (; i + 5 <= count; i += 4)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(rgbe + 4 * i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i texels[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero), _mm_unpacklo_epi16(high, zero),
+                             _mm_unpackhi_epi16(high, zero)};
+        for (int t = 0; t < 4; t++)
+        {
+            // 2^(e - 136) is the float with exponent bits e - 9, and too small for a
+            // half to tell from 0 below e = 10, where those bits would run out
+            __m128i e = _mm_shuffle_epi32(texels[t], _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i scale = _mm_and_si128(_mm_slli_epi32(_mm_sub_epi32(e, bias), 23), _mm_cmpgt_epi32(e, _mm_set1_epi32(9)));
+            glm_vec4 v = _mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(texels[t]), _mm_castsi128_ps(scale)), largest);
+#ifdef HDR_F16C
+            _mm_storel_epi64((__m128i *)(out + 3 * (i + t)), _mm_cvtps_ph(v, 0));
+#else
+            // normal halves are the float's bits shifted down and rebiased; below 2^-14
+            // adding 0.5 lines the subnormal half up in the low bits, rounded
+            __m128i bits = _mm_castps_si128(v);
+            __m128i normal = _mm_sub_epi32(_mm_srli_epi32(bits, 13), _mm_set1_epi32((127 - 15) << 10));
+            __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(v, _mm_set1_ps(0.5f))), _mm_castps_si128(_mm_set1_ps(0.5f)));
+            __m128i small = _mm_castps_si128(_mm_cmplt_ps(v, _mm_set1_ps(1.0f / 16384.0f)));
+            __m128i halves = _mm_or_si128(_mm_and_si128(small, subnormal), _mm_andnot_si128(small, normal));
+            _mm_storel_epi64((__m128i *)(out + 3 * (i + t)), _mm_packs_epi32(halves, halves));
+#endif
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const unsigned char *p = rgbe + 4 * i;
+        float scale = p[3] ? std::ldexp(1.0f, p[3] - 136) : 0.0f;
+        glm::vec4 value = glm::min(glm::vec4(p[0] * scale, p[1] * scale, p[2] * scale, 0.0f), 65504.0f);
+        uint64_t halves = glm::packHalf4x16(value);
+        memcpy(out + 3 * i, &halves, 6);
+    }
+}
+
+// a Radiance .hdr file, mapped and decoded a scanline at a time into GL_RGB16F texels,
+// so a big environment map can go to the GL in bands without ever being whole in memory
+class HdrImage
+{
+public:
+    HdrImage()
+    {
+        stream = NULL;
+        imageWidth = imageHeight = row = 0;
+    }
+
+    ~HdrImage() { close(); }
+
+    // false if the file can't be mapped or isn't an HDR image
+    bool open(const char *path)
+    {
+        close();
+        if (!file.open(path))
+            return false;
+        stream = stbi_hdr_open_from_memory(file.data, (int)file.size, &imageWidth, &imageHeight);
+        rgbe.resize((size_t)imageWidth * 4);
+        return stream != NULL;
+    }
+
+    void close()
+    {
+        if (stream)
+            stbi_hdr_close(stream);
+        stream = NULL;
+        file.close();
+        imageWidth = imageHeight = row = 0;
+    }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int rowsLeft() const { return imageHeight - row; }
+    size_t rowBytes() const { return (size_t)imageWidth * 3 * sizeof(uint16_t); }
+
+    // the next rows scanlines, top down, as width * 3 halves each; how many were
+    // written, fewer at the bottom and 0 when the data is corrupt or it's closed
+    int read(int rows, uint16_t *out)
+    {
+        if (!stream)
+            return 0;
+        int done = 0;
+        for (; done < rows && row < imageHeight; done++, row++)
+        {
+            if (!stbi_hdr_read_rgbe(stream, &rgbe[0], 1))
+                return 0;
+            rgbeToHalf(&rgbe[0], imageWidth, out + (size_t)done * imageWidth * 3);
+        }
+        return done;
+    }
+
+private:
+    MappedFile file;
+    stbi_hdr_stream *stream;
+    std::vector<unsigned char> rgbe; // one scanline
+    int imageWidth, imageHeight, row;
+
+    HdrImage(const HdrImage &);
+    HdrImage &operator=(const HdrImage &);
+};
+
+#endif
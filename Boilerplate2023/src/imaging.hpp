@@ -0,0 +1,402 @@
+#ifndef IMAGING_H
+#define IMAGING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/color_space.hpp>
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#include <glm/simd/common.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "jobs.hpp"
+
+// separable resampling of 8-bit images with 1 to 4 channels: mip downsampling, resizing
+// and Gaussian blur. Colour is filtered as linear light, the colour channels decoded
+// from sRGB through a table and the alpha (the last of 2 or 4 channels) premultiplied,
+// then unpremultiplied and encoded again; data (normals, masks) is filtered as it is,
+// each channel on its own. Each texel is a vec4 (colour in x, y, z, alpha in w, or the
+// channels in order), so every filter tap is one SSE2 multiply-add whatever the count.
+// Work goes in bands of output rows, over a JobSystem if given one; a band keeps only
+// the input rows its filter taps reach, already resampled horizontally, in a ring, so
+// it runs out of cache however big the image. The results don't depend on the banding.
+enum ImageFilter
+{
+    FILTER_BOX,     // the mean of the texels under each target texel
+    FILTER_KAISER,  // Kaiser windowed sinc, 3 lobes, alpha 4: sharp mips without ringing
+    FILTER_LANCZOS, // Lanczos 3: sharper still, some ringing at hard edges
+    FILTER_GAUSSIAN // a blur, the width as sigma in texels
+};
+
+// what the channels of an image hold
+enum ImageColor
+{
+    IMAGE_SRGB,   // sRGB encoded colour, the last of 2 or 4 channels a linear alpha
+    IMAGE_LINEAR, // linear colour, the last of 2 or 4 channels alpha
+    IMAGE_DATA    // no colour or alpha: every channel linear and independent
+};
+
+// the IEC 61966-2-1 curve, the same glm::convertSRGBToLinear uses; 8 bits to linear
+inline const float *imageSrgbToLinear()
+{
+    struct Table
+    {
+        float values[256];
+        Table()
+        {
+            for (int i = 0; i < 256; i++)
+                values[i] = glm::convertSRGBToLinear(glm::vec3(i / 255.0f)).x;
+        }
+    };
+    static const Table table;
+    return table.values;
+}
+
+// linear to 8-bit sRGB, indexed by linear * 65535 rounded: fine enough that every code
+// survives the round trip through imageSrgbToLinear
+inline const unsigned char *imageLinearToSrgb()
+{
+    struct Table
+    {
+        unsigned char values[65536];
+        Table()
+        {
+            for (int i = 0; i < 65536; i++)
+            {
+                double linear = i / 65535.0;
+                double srgb = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+                values[i] = (unsigned char)(srgb * 255.0 + 0.5);
+            }
+        }
+    };
+    static const Table table;
+    return table.values;
+}
+
+inline float imageSinc(float x)
+{
+    if (std::fabs(x) < 1e-6f)
+        return 1.0f;
+    x *= 3.14159265358979f;
+    return std::sin(x) / x;
+}
+
+// modified Bessel function of the first kind, order 0, by its series
+inline float imageBessel0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; k++)
+    {
+        term *= (x * x / 4.0f) / (float)(k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// how far from its centre a filter reaches, in target texels
+inline float imageFilterSupport(ImageFilter filter, float sigma)
+{
+    switch (filter)
+    {
+    case FILTER_BOX:
+        return 0.5f;
+    case FILTER_GAUSSIAN:
+        return std::max(3.0f * sigma, 0.5f);
+    default:
+        return 3.0f;
+    }
+}
+
+inline float imageFilterWeight(ImageFilter filter, float x, float sigma)
+{
+    switch (filter)
+    {
+    case FILTER_BOX:
+        return x > -0.5f && x <= 0.5f ? 1.0f : 0.0f;
+    case FILTER_KAISER:
+    {
+        float t = x / 3.0f;
+        return t * t < 1.0f ? imageSinc(x) * imageBessel0(4.0f * std::sqrt(1.0f - t * t)) / imageBessel0(4.0f) : 0.0f;
+    }
+    case FILTER_LANCZOS:
+        return std::fabs(x) < 3.0f ? imageSinc(x) * imageSinc(x / 3.0f) : 0.0f;
+    case FILTER_GAUSSIAN:
+        return std::exp(-x * x / (2.0f * sigma * sigma));
+    }
+    return 0.0f;
+}
+
+// the taps along one axis: target texel i is the sum over k < taps of
+// weights[i * taps + k] times source texel first[i] + k. Edge texels are repeated
+// beyond the image, folded into the outermost taps so no index leaves it.
+struct ImageWeights
+{
+    int taps;
+    std::vector<int> first;
+    std::vector<float> weights;
+
+    void build(int source, int target, ImageFilter filter, float sigma)
+    {
+        float scale = (float)source / target, stretch = std::max(scale, 1.0f); // wider when minifying
+        float support = imageFilterSupport(filter, sigma) * stretch;
+        int reach = (int)std::ceil(2.0f * support) + 2;
+        std::vector<int> lo(target), hi(target);
+        std::vector<float> raw((size_t)target * reach);
+        taps = 1;
+        for (int i = 0; i < target; i++)
+        {
+            float centre = (i + 0.5f) * scale - 0.5f, sum = 0.0f, *w = &raw[(size_t)i * reach];
+            lo[i] = source;
+            hi[i] = -1;
+            for (int j = (int)std::floor(centre - support); j <= (int)std::ceil(centre + support); j++)
+            {
+                float weight = imageFilterWeight(filter, (j - centre) / stretch, sigma);
+                if (weight == 0.0f)
+                    continue;
+                // j only grows, so the clamped taps do too, one at a time
+                int clamped = std::min(std::max(j, 0), source - 1);
+                if (hi[i] < 0)
+                    lo[i] = clamped;
+                if (clamped > hi[i])
+                    w[clamped - lo[i]] = 0.0f;
+                hi[i] = clamped;
+                w[clamped - lo[i]] += weight;
+                sum += weight;
+            }
+            if (hi[i] < 0 || std::fabs(sum) < 1e-6f)
+            {
+                // nothing under the filter: the nearest texel
+                lo[i] = hi[i] = std::min(std::max((int)(centre + 0.5f), 0), source - 1);
+                w[0] = sum = 1.0f;
+            }
+            for (int k = 0; k <= hi[i] - lo[i]; k++)
+                w[k] /= sum;
+            taps = std::max(taps, hi[i] - lo[i] + 1);
+        }
+
+        // as few taps as the widest target texel needs, none of them past the edge
+        first.resize(target);
+        weights.assign((size_t)target * taps, 0.0f);
+        for (int i = 0; i < target; i++)
+        {
+            first[i] = std::min(lo[i], source - taps);
+            for (int j = lo[i]; j <= hi[i]; j++)
+                weights[(size_t)i * taps + j - first[i]] = raw[(size_t)i * reach + j - lo[i]];
+        }
+    }
+};
+
+// 8 bits to 0..1
+inline const float *imageUnormToFloat()
+{
+    struct Table
+    {
+        float values[256];
+        Table()
+        {
+            for (int i = 0; i < 256; i++)
+                values[i] = i / 255.0f;
+        }
+    };
+    static const Table table;
+    return table.values;
+}
+
+// one row of 8-bit texels to premultiplied linear vec4s, or for data the channels
+inline void imageLoadRow(const unsigned char *row, int width, int channels, ImageColor color, glm::vec4 *out)
+{
+    const float *unorm = imageUnormToFloat(), *colour = color == IMAGE_SRGB ? imageSrgbToLinear() : unorm;
+    if (color == IMAGE_DATA && (channels == 2 || channels == 4))
+    {
+        for (int x = 0; x < width; x++, row += channels)
+            out[x] = glm::vec4(unorm[row[0]], unorm[row[1]], channels == 4 ? unorm[row[2]] : 0.0f, channels == 4 ? unorm[row[3]] : 1.0f);
+        return;
+    }
+    switch (channels)
+    {
+    case 1:
+        for (int x = 0; x < width; x++)
+            out[x] = glm::vec4(colour[row[x]], 0.0f, 0.0f, 1.0f);
+        break;
+    case 2:
+        for (int x = 0; x < width; x++, row += 2)
+        {
+            float a = unorm[row[1]];
+            out[x] = glm::vec4(colour[row[0]] * a, 0.0f, 0.0f, a);
+        }
+        break;
+    case 3:
+        for (int x = 0; x < width; x++, row += 3)
+            out[x] = glm::vec4(colour[row[0]], colour[row[1]], colour[row[2]], 1.0f);
+        break;
+    default:
+        for (int x = 0; x < width; x++, row += 4)
+        {
+            float a = unorm[row[3]];
+            out[x] = glm::vec4(colour[row[0]] * a, colour[row[1]] * a, colour[row[2]] * a, a);
+        }
+    }
+}
+
+// the other way, clamping what the negative lobes over- and undershot
+inline void imageStoreRow(const glm::vec4 *in, int width, int channels, ImageColor color, unsigned char *row)
+{
+    const unsigned char *toSrgb = imageLinearToSrgb();
+    bool srgb = color == IMAGE_SRGB, alpha = color != IMAGE_DATA && (channels == 2 || channels == 4);
+    int colours = alpha ? channels - 1 : channels;
+    int x = 0;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    glm_vec4 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+    glm_vec4 scale = _mm_set1_ps(srgb ? 65535.0f : 255.0f);
+    for (; x < width; x++, row += channels)
+    {
+        glm_vec4 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&in[x].x), zero), one);
+        glm_vec4 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        // colour over alpha, none where there's no coverage
+        glm_vec4 colour = _mm_and_ps(_mm_min_ps(_mm_div_ps(v, _mm_max_ps(a, _mm_set1_ps(1e-12f))), one), _mm_cmpgt_ps(a, zero));
+        if (!alpha)
+            colour = v;
+        int codes[4], alphaCode = (int)(_mm_cvtss_f32(a) * 255.0f + 0.5f);
+        _mm_storeu_si128((__m128i *)codes, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(colour, scale), half)));
+        for (int c = 0; c < colours; c++)
+            row[c] = srgb ? toSrgb[codes[c]] : (unsigned char)codes[c];
+        if (alpha)
+            row[colours] = (unsigned char)alphaCode;
+    }
+#endif
+    for (; x < width; x++, row += channels)
+    {
+        glm::vec4 v = glm::clamp(in[x], 0.0f, 1.0f);
+        glm::vec4 colour = !alpha ? v : v.w > 0.0f ? glm::min(v / std::max(v.w, 1e-12f), 1.0f) : glm::vec4(0.0f);
+        for (int c = 0; c < colours; c++)
+            row[c] = srgb ? toSrgb[(int)(colour[c] * 65535.0f + 0.5f)] : (unsigned char)(colour[c] * 255.0f + 0.5f);
+        if (alpha)
+            row[colours] = (unsigned char)(v.w * 255.0f + 0.5f);
+    }
+}
+
+// out[i] = sum of weights[i * taps + k] * in[first[i] + k], for count vec4s of each row
+// in out when rows is set (the vertical pass, in as rows[k]), else along in
+inline void imageFilterRow(const glm::vec4 *in, const glm::vec4 *const *rows, const ImageWeights &weights, int count, glm::vec4 *out)
+{
+    int taps = weights.taps;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    if (rows)
+    {
+        // the vertical pass: the same taps for the whole row, four texels at a time
+        const float *w = &weights.weights[0];
+        int x = 0;
+        for (; x + 4 <= count; x += 4)
+        {
+            glm_vec4 sum[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+            for (int k = 0; k < taps; k++)
+            {
+                glm_vec4 wk = _mm_set1_ps(w[k]);
+                const float *p = &rows[k][x].x;
+                for (int t = 0; t < 4; t++)
+                    sum[t] = glm_vec4_fma(wk, _mm_loadu_ps(p + 4 * t), sum[t]);
+            }
+            for (int t = 0; t < 4; t++)
+                _mm_storeu_ps(&out[x + t].x, sum[t]);
+        }
+        for (; x < count; x++)
+        {
+            glm_vec4 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; k++)
+                sum = glm_vec4_fma(_mm_set1_ps(w[k]), _mm_loadu_ps(&rows[k][x].x), sum);
+            _mm_storeu_ps(&out[x].x, sum);
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const float *w = &weights.weights[(size_t)i * taps];
+        const glm::vec4 *p = in + weights.first[i];
+        glm_vec4 sum = _mm_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            sum = glm_vec4_fma(_mm_set1_ps(w[k]), _mm_loadu_ps(&p[k].x), sum);
+        _mm_storeu_ps(&out[i].x, sum);
+    }
+#else
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec4 sum(0.0f);
+        if (rows)
+            for (int k = 0; k < taps; k++)
+                sum += weights.weights[k] * rows[k][i];
+        else
+            for (int k = 0; k < taps; k++)
+                sum += weights.weights[(size_t)i * taps + k] * in[weights.first[i] + k];
+        out[i] = sum;
+    }
+#endif
+}
+
+// target rows [firstRow, endRow): each source row the band needs is loaded and resampled
+// horizontally once into a ring of rows.taps slots, then every target row is a
+// weighted sum down the ring
+inline void imageResampleRows(const unsigned char *pixels, int width, int channels, ImageColor color, const ImageWeights &columns,
+                              const ImageWeights &rows, int targetWidth, unsigned char *out, int firstRow, int endRow)
+{
+    std::vector<glm::vec4> line(width), ring((size_t)rows.taps * targetWidth), sum(targetWidth);
+    std::vector<const glm::vec4 *> taps(rows.taps);
+    ImageWeights vertical;
+    vertical.taps = rows.taps;
+    vertical.weights.resize(rows.taps);
+    int loaded = rows.first[firstRow];
+    for (int y = firstRow; y < endRow; y++)
+    {
+        int top = rows.first[y];
+        for (int j = std::max(loaded, top); j < top + rows.taps; j++)
+        {
+            imageLoadRow(pixels + (size_t)j * width * channels, width, channels, color, &line[0]);
+            imageFilterRow(&line[0], NULL, columns, targetWidth, &ring[(size_t)(j % rows.taps) * targetWidth]);
+        }
+        loaded = top + rows.taps;
+        for (int k = 0; k < rows.taps; k++)
+        {
+            taps[k] = &ring[(size_t)((top + k) % rows.taps) * targetWidth];
+            vertical.weights[k] = rows.weights[(size_t)y * rows.taps + k];
+        }
+        imageFilterRow(NULL, &taps[0], vertical, targetWidth, &sum[0]);
+        imageStoreRow(&sum[0], targetWidth, channels, color, out + (size_t)y * targetWidth * channels);
+    }
+}
+
+inline void imageResample(const unsigned char *pixels, int width, int height, int channels, unsigned char *out, int targetWidth,
+                          int targetHeight, ImageFilter filter, float sigma, ImageColor color, JobSystem *jobs)
+{
+    ImageWeights columns, rows;
+    columns.build(width, targetWidth, filter, sigma);
+    rows.build(height, targetHeight, filter, sigma);
+    if (jobs)
+        jobs->parallelFor(0, targetHeight, [&](unsigned int begin, unsigned int end) {
+            imageResampleRows(pixels, width, channels, color, columns, rows, targetWidth, out, begin, end);
+        }, 32);
+    else
+        imageResampleRows(pixels, width, channels, color, columns, rows, targetWidth, out, 0, targetHeight);
+}
+
+// an 8-bit image with 1 to 4 channels to targetWidth x targetHeight, filtered as color
+// says its channels hold
+inline void resizeImage(const unsigned char *pixels, int width, int height, int channels, unsigned char *out, int targetWidth,
+                        int targetHeight, ImageFilter filter, ImageColor color, JobSystem *jobs = NULL)
+{
+    imageResample(pixels, width, height, channels, out, targetWidth, targetHeight, filter, 1.0f, color, jobs);
+}
+
+// the next mip level, sized as GL sizes it
+inline void downsampleImage(const unsigned char *pixels, int width, int height, int channels, unsigned char *out, ImageFilter filter,
+                            ImageColor color, JobSystem *jobs = NULL)
+{
+    resizeImage(pixels, width, height, channels, out, std::max(width / 2, 1), std::max(height / 2, 1), filter, color, jobs);
+}
+
+// a Gaussian blur of sigma texels, the same size
+inline void blurImage(const unsigned char *pixels, int width, int height, int channels, unsigned char *out, float sigma, ImageColor color,
+                      JobSystem *jobs = NULL)
+{
+    imageResample(pixels, width, height, channels, out, width, height, FILTER_GAUSSIAN, sigma, color, jobs);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <atomic>
+
+// one GLFW input callback, stamped with the timer value it arrived at
+struct InputMessage
+{
+    enum Type
+    {
+        KEY,
+        CURSOR,
+        SCROLL
+    };
+
+    unsigned char type;
+    uint64_t time;
+    int key, action, mods; // KEY
+    float x, y;            // CURSOR position, SCROLL offset
+};
+
+// lock-free single producer / single consumer ring: the thread running the GLFW
+// callbacks pushes, the simulation thread drains. Capacity must be a power of two.
+template <typename T, unsigned int CAPACITY>
+class SpscRing
+{
+public:
+    unsigned int dropped; // pushes that found the ring full, producer side
+
+    SpscRing()
+    {
+        head.store(0);
+        tail.store(0);
+        dropped = 0;
+    }
+
+    bool push(const T &value)
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == CAPACITY)
+        {
+            dropped++;
+            return false;
+        }
+        slots[t & (CAPACITY - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // oldest entry without removing it, NULL if empty
+    const T *peek() const
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return NULL;
+        return &slots[h & (CAPACITY - 1)];
+    }
+
+    void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+    T slots[CAPACITY];
+    std::atomic<unsigned int> head; // next to read, written by the consumer
+    std::atomic<unsigned int> tail; // next to write, written by the producer
+};
+
+#endif
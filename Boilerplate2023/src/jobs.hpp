@@ -0,0 +1,343 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// number of jobs attached to it that haven't finished; children spawned from inside
+// a job join their parent's counter, so it only reaches zero once the whole tree is done
+class JobCounter
+{
+public:
+    std::atomic<int> pending;
+
+    JobCounter() { pending.store(0); }
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+struct Job
+{
+    std::function<void()> task;
+    JobCounter *counter;
+};
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing for
+// Weak Memory Models"): the owning worker pushes and pops at the bottom, thieves take
+// from the top. Fixed capacity; push() returns false when full and the caller runs the job itself.
+class WorkStealingDeque
+{
+public:
+    static const int64_t CAPACITY = 4096;
+
+    WorkStealingDeque()
+    {
+        top.store(0);
+        bottom.store(0);
+        for (int64_t i = 0; i < CAPACITY; i++)
+            buffer[i].store(NULL);
+    }
+
+    bool push(Job *job)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        buffer[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Job *pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        Job *job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // last one, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job *steal()
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return NULL;
+        Job *job = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return NULL;
+        return job;
+    }
+
+    int64_t size() const
+    {
+        return std::max<int64_t>(0, bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Job *> buffer[CAPACITY];
+};
+
+// a fixed set of worker threads, each with its own deque, stealing from the others when
+// they run dry. Threads that aren't workers (the GL thread, the simulation thread) submit
+// through a locked queue and help out while they wait.
+class JobSystem
+{
+public:
+    // threadCount 0 means one worker per hardware thread
+    JobSystem(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        running.store(true);
+        sleeping.store(0);
+        epoch.store(0);
+        queues.resize(threadCount);
+        for (unsigned int i = 0; i < threadCount; i++)
+            queues[i] = new WorkStealingDeque();
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running.store(false);
+        }
+        wake.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+        for (unsigned int i = 0; i < queues.size(); i++)
+            delete queues[i];
+    }
+
+    unsigned int threadCount() const { return workers.size(); }
+
+    // queue a job on counter; from inside a job, counter defaults to the running job's one
+    void run(const std::function<void()> &task, JobCounter *counter = NULL)
+    {
+        Job *job = new Job();
+        job->task = task;
+        job->counter = counter ? counter : currentCounter();
+        if (job->counter)
+            job->counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+        int index = workerIndex();
+        if (index >= 0)
+        {
+            if (!queues[index]->push(job))
+            {
+                execute(job);
+                return;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            injected.push_back(job);
+        }
+        // a parked worker either sees the new epoch before it sleeps or is counted in
+        // sleeping here; the lock keeps the notify from landing between its check and
+        // its wait
+        epoch.fetch_add(1);
+        if (sleeping.load())
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    // run other jobs until everything on counter has finished. Inside a job, only those
+    // from the deques, where its own children are, or queued on counter itself: a
+    // top-level job from the injected queue would stack under the waiting one, holding
+    // it up and its memory alive until the newcomer finished too.
+    void wait(JobCounter &counter)
+    {
+        JobCounter *only = currentCounter() ? &counter : NULL;
+        while (!counter.done())
+        {
+            Job *job = findJob(workerIndex(), only);
+            if (job)
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // body(begin, end) over [begin, end). Ranges are split lazily: a job only halves its
+    // range while its own deque is nearly empty, so the split depth adapts to how many
+    // workers are actually stealing, and never goes below minGrain.
+    template <typename Body>
+    void parallelFor(unsigned int begin, unsigned int end, const Body &body, unsigned int minGrain = 1)
+    {
+        if (begin >= end)
+            return;
+        unsigned int grain = std::max(minGrain, (end - begin) / (16 * threadCount()));
+        grain = std::max(grain, 1u);
+        JobCounter counter;
+        run([this, begin, end, grain, &body]() { splitRange(begin, end, grain, body); }, &counter);
+        wait(counter);
+    }
+
+    // -1 on threads that are not workers of this system
+    int workerIndex() const
+    {
+        return currentSystem() == this ? currentWorker() : -1;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::vector<WorkStealingDeque *> queues;
+    std::deque<Job *> injected;
+    std::mutex injectMutex;
+    std::atomic<bool> running;
+    std::atomic<int> sleeping;
+    std::atomic<uint64_t> epoch; // bumped by every run()
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    // per thread: which system and worker it belongs to, and the job it is running
+    static const JobSystem *&currentSystem()
+    {
+        static thread_local const JobSystem *system = NULL;
+        return system;
+    }
+    static int &currentWorker()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+    static JobCounter *&currentCounter()
+    {
+        static thread_local JobCounter *counter = NULL;
+        return counter;
+    }
+
+    template <typename Body>
+    void splitRange(unsigned int begin, unsigned int end, unsigned int grain, const Body &body)
+    {
+        int index = workerIndex();
+        while (end - begin > grain)
+        {
+            if (index < 0 || queues[index]->size() < 2)
+            {
+                unsigned int middle = begin + (end - begin) / 2;
+                run([this, middle, end, grain, &body]() { splitRange(middle, end, grain, body); });
+                end = middle;
+            }
+            else
+            {
+                body(begin, begin + grain);
+                begin += grain;
+            }
+        }
+        body(begin, end);
+    }
+
+    void execute(Job *job)
+    {
+        JobCounter *&current = currentCounter();
+        JobCounter *outer = current;
+        current = job->counter;
+        job->task();
+        current = outer;
+        if (job->counter)
+            job->counter->pending.fetch_sub(1, std::memory_order_release);
+        delete job;
+    }
+
+    // injected jobs only on counter unless it's NULL
+    Job *findJob(int index, JobCounter *counter = NULL)
+    {
+        Job *job = index >= 0 ? queues[index]->pop() : NULL;
+        if (job)
+            return job;
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            for (std::deque<Job *>::iterator i = injected.begin(); i != injected.end(); ++i)
+                if (!counter || (*i)->counter == counter)
+                {
+                    job = *i;
+                    injected.erase(i);
+                    return job;
+                }
+        }
+        // steal, starting from a different victim each time
+        static thread_local unsigned int seed = 0x9e3779b9u;
+        seed = seed * 1664525u + 1013904223u;
+        unsigned int count = queues.size();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned int victim = ((seed >> 8) + i) % count;
+            if ((int)victim == index)
+                continue;
+            job = queues[victim]->steal();
+            if (job)
+                return job;
+        }
+        return NULL;
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        currentSystem() = this;
+        currentWorker() = index;
+        unsigned int idle = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            uint64_t seen = epoch.load();
+            Job *job = findJob(index);
+            if (job)
+            {
+                execute(job);
+                idle = 0;
+            }
+            else if (++idle < 64)
+                std::this_thread::yield();
+            else
+            {
+                // park until a job is queued after the search that came up empty
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                sleeping.fetch_add(1);
+                wake.wait(lock, [this, seen]() { return !running.load() || epoch.load() != seen; });
+                sleeping.fetch_sub(1);
+                idle = 0;
+            }
+        }
+    }
+};
+
+// the shared system everything in the app submits to
+inline JobSystem &jobSystem()
+{
+    static JobSystem system;
+    return system;
+}
+
+#endif
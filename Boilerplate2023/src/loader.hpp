@@ -0,0 +1,377 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hdr.hpp"
+#include "texcache.hpp"
+
+#include <iostream>
+
+// one GL object made by the loader; name is valid in every context of the share group
+// once ready() said so on the thread that wants to use it
+struct GpuResource
+{
+    enum Type
+    {
+        BUFFER,
+        TEXTURE,
+        PROGRAM
+    };
+
+    enum State
+    {
+        QUEUED,
+        FENCED, // commands issued, fence not yet seen signaled
+        READY,
+        FAILED
+    };
+
+    unsigned char type;
+    std::atomic<int> state;
+    unsigned int name;
+    GLsync fence;
+    uint64_t bytes;
+
+    // the request, dropped once it has been uploaded
+    GLenum target, usage, format;
+    int width, height;
+    std::vector<unsigned char> data;
+    std::shared_ptr<BakedTexture> baked; // a texture's levels instead of data
+    std::shared_ptr<HdrImage> hdr;       // or its half floats, decoded as it uploads
+    std::string vertexSource, fragmentSource;
+
+    GpuResource()
+    {
+        state.store(QUEUED);
+        name = 0;
+        fence = 0;
+        bytes = 0;
+        target = usage = format = 0;
+        width = height = 0;
+    }
+};
+
+// uploads buffers and textures and compiles shaders on its own thread, in a hidden
+// window whose context shares objects with the render window (see GLFW's
+// examples/sharing.c), so the render thread never stalls on them. Each upload ends
+// with glFenceSync; the render thread polls the fence without blocking. Vertex
+// array objects are not shared between contexts, so those are still made on the
+// render thread once their buffers are ready.
+class ResourceLoader
+{
+public:
+    void (*onUploaded)(); // called on the loader thread after each upload is fenced or failed
+    std::atomic<uint64_t> uploadedBytes;
+
+    ResourceLoader()
+    {
+        onUploaded = NULL;
+        uploadedBytes.store(0);
+        context = NULL;
+        running.store(false);
+    }
+
+    ~ResourceLoader()
+    {
+        stop();
+        for (unsigned int i = 0; i < resources.size(); i++)
+            delete resources[i];
+    }
+
+    // main thread, after GL is loaded for share; the hidden window takes the current
+    // window hints, and GLFW_VISIBLE is back at its default afterwards so later windows
+    // show. Without a shared context everything runs inline on the caller's thread.
+    bool start(GLFWwindow *share)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "loader", NULL, share);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (!context)
+        {
+            std::cout << "ERROR::LOADER::NO_SHARED_CONTEXT: uploading on the render thread" << std::endl;
+            return false;
+        }
+        running.store(true);
+        thread = std::thread(&ResourceLoader::run, this);
+        return true;
+    }
+
+    // main thread; what is still queued is dropped
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            running.store(false);
+        }
+        wake.notify_one();
+        if (thread.joinable())
+            thread.join();
+        if (context)
+            glfwDestroyWindow(context);
+        context = NULL;
+    }
+
+    // copies the data
+    GpuResource *uploadBuffer(GLenum target, const void *data, size_t size, GLenum usage = GL_STATIC_DRAW)
+    {
+        GpuResource *resource = new GpuResource();
+        resource->type = GpuResource::BUFFER;
+        resource->target = target;
+        resource->usage = usage;
+        resource->data.assign((const unsigned char *)data, (const unsigned char *)data + size);
+        return submit(resource);
+    }
+
+    // 8 bits per channel, format GL_RED, GL_RG, GL_RGB or GL_RGBA; takes the pixels
+    // and builds the mipmaps
+    GpuResource *uploadTexture(int width, int height, GLenum format, std::vector<unsigned char> &pixels)
+    {
+        GpuResource *resource = new GpuResource();
+        resource->type = GpuResource::TEXTURE;
+        resource->width = width;
+        resource->height = height;
+        resource->format = format;
+        resource->data.swap(pixels);
+        return submit(resource);
+    }
+
+    // every level of a baked texture, uploaded from its mapping
+    GpuResource *uploadTexture(const std::shared_ptr<BakedTexture> &baked)
+    {
+        GpuResource *resource = new GpuResource();
+        resource->type = GpuResource::TEXTURE;
+        resource->width = baked->width();
+        resource->height = baked->height();
+        resource->format = baked->format();
+        resource->baked = baked;
+        return submit(resource);
+    }
+
+    // an HDR image as GL_RGB16F, decoded to half floats on the loader thread
+    GpuResource *uploadTexture(const std::shared_ptr<HdrImage> &hdr)
+    {
+        GpuResource *resource = new GpuResource();
+        resource->type = GpuResource::TEXTURE;
+        resource->width = hdr->width();
+        resource->height = hdr->height();
+        resource->format = GL_RGB;
+        resource->hdr = hdr;
+        return submit(resource);
+    }
+
+    GpuResource *compileProgram(const char *vertexSource, const char *fragmentSource)
+    {
+        GpuResource *resource = new GpuResource();
+        resource->type = GpuResource::PROGRAM;
+        resource->vertexSource = vertexSource;
+        resource->fragmentSource = fragmentSource;
+        return submit(resource);
+    }
+
+    // render thread: true once the object can be used here, never blocks
+    bool ready(GpuResource *resource)
+    {
+        int state = resource->state.load(std::memory_order_acquire);
+        if (state == GpuResource::FENCED)
+        {
+            GLenum result = glClientWaitSync(resource->fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                return false;
+            glDeleteSync(resource->fence);
+            resource->fence = 0;
+            resource->state.store(GpuResource::READY);
+            return true;
+        }
+        return state == GpuResource::READY;
+    }
+
+    bool failed(GpuResource *resource) const { return resource->state.load() == GpuResource::FAILED; }
+
+    // requests the loader hasn't got to yet
+    unsigned int queued()
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return queue.size();
+    }
+
+    // any thread with a context current: a linked program, 0 if it doesn't compile or
+    // link, the errors printed
+    static unsigned int buildProgram(const char *vertexSource, const char *fragmentSource)
+    {
+        int success;
+        char infoLog[512];
+        unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertexShader, 1, &vertexSource, NULL);
+        glCompileShader(vertexShader);
+        glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+                      << infoLog << std::endl;
+        }
+        unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+        glCompileShader(fragmentShader);
+        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
+                      << infoLog << std::endl;
+        }
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                      << infoLog << std::endl;
+            glDeleteProgram(program);
+            program = 0;
+        }
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return program;
+    }
+
+private:
+    GLFWwindow *context;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::mutex queueMutex;
+    std::condition_variable wake;
+    std::deque<GpuResource *> queue;
+    std::vector<GpuResource *> resources; // owned, freed with the loader
+
+    GpuResource *submit(GpuResource *resource)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            resources.push_back(resource);
+            if (running.load())
+            {
+                queue.push_back(resource);
+                wake.notify_one();
+                return resource;
+            }
+        }
+        // no loader thread: upload right here, already in order with the caller's commands
+        if (upload(*resource))
+            resource->state.store(GpuResource::READY);
+        return resource;
+    }
+
+    void run()
+    {
+        glfwMakeContextCurrent(context);
+        while (true)
+        {
+            GpuResource *resource;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                while (running.load() && queue.empty())
+                    wake.wait(lock);
+                if (!running.load())
+                    break;
+                resource = queue.front();
+                queue.pop_front();
+            }
+            if (upload(*resource))
+            {
+                // the fence has to reach the GPU before another context can wait on it
+                resource->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                resource->state.store(GpuResource::FENCED, std::memory_order_release);
+            }
+            if (onUploaded)
+                onUploaded();
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+
+    // false (and FAILED) when a shader doesn't build
+    bool upload(GpuResource &resource)
+    {
+        resource.bytes = resource.baked ? resource.baked->bytes() : resource.hdr ? resource.hdr->rowBytes() * resource.height : resource.data.size();
+        switch (resource.type)
+        {
+        case GpuResource::BUFFER:
+            glGenBuffers(1, &resource.name);
+            glBindBuffer(resource.target, resource.name);
+            glBufferData(resource.target, resource.data.size(), resource.data.empty() ? NULL : &resource.data[0], resource.usage);
+            glBindBuffer(resource.target, 0);
+            break;
+        case GpuResource::TEXTURE:
+        {
+            if (resource.baked)
+            {
+                glGenTextures(1, &resource.name);
+                glBindTexture(GL_TEXTURE_2D, resource.name);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                for (int level = 0; level < resource.baked->levels(); level++)
+                    resource.baked->specifyLevel(level, resource.baked->level(level));
+                resource.baked->finish();
+                glBindTexture(GL_TEXTURE_2D, 0);
+                break;
+            }
+            if (resource.hdr)
+            {
+                resource.data.resize(resource.hdr->rowBytes() * resource.height);
+                if (resource.hdr->read(resource.height, (uint16_t *)&resource.data[0]) != resource.height)
+                {
+                    std::cout << "ERROR::TEXTURE::CORRUPT_HDR: " << stbi_failure_reason() << std::endl;
+                    break;
+                }
+                glGenTextures(1, &resource.name);
+                glBindTexture(GL_TEXTURE_2D, resource.name);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, resource.width, resource.height, 0, GL_RGB, GL_HALF_FLOAT, &resource.data[0]);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                break;
+            }
+            GLenum internalFormat = resource.format == GL_RED ? GL_R8 : resource.format == GL_RG ? GL_RG8 : resource.format == GL_RGB ? GL_RGB8 : GL_RGBA8;
+            glGenTextures(1, &resource.name);
+            glBindTexture(GL_TEXTURE_2D, resource.name);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, resource.width, resource.height, 0, resource.format, GL_UNSIGNED_BYTE, &resource.data[0]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            break;
+        }
+        case GpuResource::PROGRAM:
+            resource.name = buildProgram(resource.vertexSource.c_str(), resource.fragmentSource.c_str());
+            break;
+        }
+        std::vector<unsigned char>().swap(resource.data);
+        resource.baked.reset();
+        resource.hdr.reset();
+        if (!resource.name)
+        {
+            resource.state.store(GpuResource::FAILED);
+            return false;
+        }
+        uploadedBytes += resource.bytes;
+        return true;
+    }
+};
+
+#endif
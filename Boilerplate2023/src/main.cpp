@@ -3,23 +3,61 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include "shapes.hpp"
+#include "rasterizer.hpp"
+#include "geometry.hpp"
+#include "raytracer.hpp"
+#include "occlusion.hpp"
+#include "spatial.hpp"
+#include "simulation.hpp"
+#include "jobs.hpp"
+#include "replay.hpp"
+#include "redraw.hpp"
+#include "framestats.hpp"
+#include "loader.hpp"
+#include "textures.hpp"
+#include "benchmark.hpp"
 
 #include <iostream>
+#include <string>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
-void processInput(GLFWwindow *window);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void cursor_position_callback(GLFWwindow *window, double xpos, double ypos);
+void window_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
+void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void wake_render_thread();
+int renderHeadless(int nsides, const char *outputPath, bool raytrace);
 
 // settings
 const unsigned int SCR_WIDTH = 1024;
 const unsigned int SCR_HEIGHT = 1024;
 
-int PYRAMID = 0;
+bool cpuCulling = false;
+bool occlusionCulling = false;
+bool printFrameStats = false;
+bool pboUploads = false;
+bool compressTextures = false;
+int stackSize = 0;
+std::vector<glm::mat4> stack; // model matrices of the stacked prisms behind the main object
 glm::vec3 shift, cameraPos, cameraTarget,
     cameraDirection, cameraUp, cameraRight;
 glm::mat4 rotation1, rotation;
+SimulationThread *simulationThread = NULL;                     // where the input callbacks post to
+SimulationThread::TimerFunction inputTimer = glfwGetTimerValue; // stamps the posted input
+InputRecorder recorder;
+InputReplay replay;
+RedrawTracker redraw;
+
+// the simulation's clock during a replay
+uint64_t replayTimerValue()
+{
+    return replay.clock;
+}
 
 Prism shapePrism(3);
 Pyramid shapePyramid(3);
@@ -44,6 +82,66 @@ const char *fragmentShaderSource = "#version 330 core\n"
 
 int main(int argc, char **argv)
 {
+    // headless: render the first frame on the CPU and write it out, no GL context needed
+    // -----------------------------------------------------------------------------------
+    if (argc == 4 && (std::string(argv[2]) == "--cpu" || std::string(argv[2]) == "--raytrace"))
+        return renderHeadless(atoi(argv[1]), argv[3], std::string(argv[2]) == "--raytrace");
+    if ((argc == 3 || argc == 4) && std::string(argv[1]) == "--bench")
+        return runBenchmark(argv[2], argc == 4 ? argv[3] : "");
+
+    const char *recordPath = NULL, *replayPath = NULL, *frameTimesPath = NULL, *textureDirectory = NULL, *textureCache = NULL;
+    for (int i = 2; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--cull")
+            cpuCulling = true;
+        else if (std::string(argv[i]) == "--occlusion")
+            occlusionCulling = true;
+        else if (std::string(argv[i]) == "--stack" && i + 1 < argc)
+            stackSize = atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (std::string(argv[i]) == "--frametimes" && i + 1 < argc)
+            frameTimesPath = argv[++i];
+        else if (std::string(argv[i]) == "--continuous")
+            redraw.continuous = true;
+        else if (std::string(argv[i]) == "--stats")
+            printFrameStats = true;
+        else if (std::string(argv[i]) == "--textures" && i + 1 < argc)
+            textureDirectory = argv[++i];
+        else if (std::string(argv[i]) == "--pbo")
+            pboUploads = true;
+        else if (std::string(argv[i]) == "--texture-cache" && i + 1 < argc)
+            textureCache = argv[++i];
+        else if (std::string(argv[i]) == "--compress")
+            compressTextures = true;
+        else
+        {
+            std::cout << "SYNTAX ERROR: unknown option or missing argument: " << argv[i] << "\n";
+            exit(1);
+        }
+    }
+    if (argc < 2)
+    {
+        std::cout << "SYNTAX ERROR: Should be ./app [no. of vertices] [--cull] [--stack n] [--occlusion] [--continuous] [--stats] [--textures dir [--pbo] [--texture-cache dir] [--compress]] [--frametimes out.csv|out.json] [--record log | --replay log], ./app [no. of vertices] --cpu|--raytrace output.png or ./app --bench [name] [input].\n";
+        exit(1);
+    }
+
+    int nsides = atoi(argv[1]);
+    if (nsides <= 2)
+    {
+        std::cout << "ERROR: no. of vertices should be >= 3.\n";
+        exit(1);
+    }
+
+    bool replaying = replayPath != NULL;
+    if (replaying && !replay.load(replayPath))
+        exit(1);
+    // a replay has to draw every recorded frame
+    if (replaying)
+        redraw.continuous = true;
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -54,6 +152,9 @@ int main(int argc, char **argv)
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+    // a replay never shows anything, on the null platform there is nothing to show it on
+    if (replaying)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     // glfw window creation
     // --------------------
@@ -66,6 +167,15 @@ int main(int argc, char **argv)
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetWindowSizeCallback(window, window_size_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSetCursorPosCallback(window, cursor_position_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    if (recordPath && !recorder.create(recordPath, glfwGetTimerFrequency(), glfwGetTimerValue()))
+        exit(1);
+    if (replaying)
+        glfwSwapInterval(0);
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
@@ -77,77 +187,91 @@ int main(int argc, char **argv)
 
 
 
+    // uploads and shader builds happen on the loader thread in a shared context, the
+    // window shows its first frames while they stream in
+    ResourceLoader loader;
+    loader.onUploaded = wake_render_thread;
+    loader.start(window);
+    // first frame right away, the scene follows once the loader is done
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glfwSwapBuffers(window);
+
     // build and compile our shader program
     // ------------------------------------
-    // vertex shader
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // check for shader compile errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // fragment shader
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // link shaders
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    GpuResource *program = loader.compileProgram(vertexShaderSource, fragmentShaderSource);
+    unsigned int shaderProgram = 0;
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
 
-    if (argc != 2)
-    {
-        std::cout << "SYNTAX ERROR: Should be ./app [no. of vertices].\n";
-        exit(1);
-    }
-
-    int nsides = atoi(argv[1]);
-    if (nsides <= 2)
-    {
-        std::cout << "ERROR: no. of vertices should be >= 3.\n";
-        exit(1);
-    }
-
-    shapePrism = Prism((unsigned int)nsides);
-    shapePyramid = Pyramid((unsigned int)nsides);
+    // build both meshes at once on the job system
+    JobCounter meshes;
+    jobSystem().run([nsides]() { shapePrism = Prism((unsigned int)nsides); }, &meshes);
+    jobSystem().run([nsides]() { shapePyramid = Pyramid((unsigned int)nsides); }, &meshes);
+    jobSystem().wait(meshes);
     shift = glm::vec3(0, 0, 0);
     rotation1 = glm::mat4(1.0f);
     rotation = glm::mat4(1.0f);
     glm::mat4 projection;
     projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 
-    unsigned int VBO_Prism, VBO_Pyramid, EBO_Prism, EBO_Pyramid, VAO_Prism, VAO_Pyramid;
-    shapePrism.initBuffers(&VAO_Prism, &VBO_Prism, &EBO_Prism);
-    shapePyramid.initBuffers(&VAO_Pyramid, &VBO_Pyramid, &EBO_Pyramid);
+    unsigned int VBO_Prism, VBO_Pyramid, EBO_Prism, EBO_Pyramid, VAO_Prism = 0, VAO_Pyramid = 0;
+    GpuResource *meshBuffers[4] = {
+        loader.uploadBuffer(GL_ARRAY_BUFFER, &shapePrism.vertices[0], shapePrism.vertices.size() * sizeof(float)),
+        loader.uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, &shapePrism.indices[0], shapePrism.indices.size() * sizeof(unsigned int)),
+        loader.uploadBuffer(GL_ARRAY_BUFFER, &shapePyramid.vertices[0], shapePyramid.vertices.size() * sizeof(float)),
+        loader.uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, &shapePyramid.indices[0], shapePyramid.indices.size() * sizeof(unsigned int))};
+    bool resourcesReady = false;
+
+    // every image in --textures dir, decoded on the job system and uploaded by the loader,
+    // or with --pbo streamed in from here through a PBO ring, 8 MB per frame at most;
+    // with --texture-cache baked once and mapped from there on later runs, with --compress
+    // block compressed to BC1/BC3/BC4/BC5 by channel count
+    TextureLoader textures(&jobSystem());
+    if (textureCache)
+        textures.cacheDirectory = textureCache;
+    if (compressTextures && !bcSupported(BC1))
+        std::cout << "ERROR::TEXTURE::NO_S3TC: GL_EXT_texture_compression_s3tc missing, textures stay uncompressed" << std::endl;
+    else
+        textures.compress = compressTextures;
+    stbi_set_parallel_for(stbiParallelFor, &jobSystem());
+    PboUploader pbo;
+    if (pboUploads)
+        pbo.init();
+    textures.onDecoded = wake_render_thread;
+    if (textureDirectory)
+        textures.load(listFiles(textureDirectory));
+    bool texturesLoaded = textureDirectory == NULL;
+
+    GeometryStage geometry(SCR_WIDTH, SCR_HEIGHT);
+    geometry.jobs = &jobSystem();
+
+    // an n x n x n block of touching prisms behind the main object, mostly hidden by its front layers
+    for (int z = 0; z < stackSize; z++)
+        for (int y = 0; y < stackSize; y++)
+            for (int x = 0; x < stackSize; x++)
+            {
+                glm::vec3 at((x - 0.5f * (stackSize - 1)) * 0.3f, (y - 0.5f * (stackSize - 1)) * 0.3f, -1.0f - z * 0.3f);
+                stack.push_back(glm::scale(glm::translate(glm::mat4(1.0f), at), glm::vec3(0.2f)));
+            }
+    OcclusionCuller occlusion;
+
+    // every drawable goes into the spatial index, the main object is the one after the stack
+    AABBTree objectTree;
+    glm::vec3 boundsMin, boundsMax;
+    for (unsigned int i = 0; i < stack.size(); i++)
+    {
+        transformBounds(shapePrism.boundsMin, shapePrism.boundsMax, stack[i], boundsMin, boundsMax);
+        objectTree.createProxy(boundsMin, boundsMax, i);
+    }
+    unsigned int mainObject = stack.size();
+    int mainProxy = objectTree.createProxy(shapePrism.boundsMin, shapePrism.boundsMax, mainObject);
+    std::vector<unsigned int> visibleObjects;
+    std::vector<unsigned int> stackOrder;
+    double lastReport = glfwGetTime();
+    double cullingTime = 0.0;
+    unsigned int cullingFrames = 0, cullingTested = 0, cullingCulled = 0;
 
     //  glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     // render loop
@@ -157,17 +281,115 @@ int main(int argc, char **argv)
     cameraPos = glm::vec3(0, 0, 3.0f);
     cameraTarget = glm::vec3(0, 0, 0);
 
+    // the simulation runs on its own thread at a fixed 60 ticks/s whatever the frame rate,
+    // at most 8 ticks per wakeup; this thread only reads its snapshots. A replay steps it
+    // here instead, once per frame on the recorded clock, so every replay ticks identically.
+    SimulationThread::TimerFunction timer = replaying ? replayTimerValue : glfwGetTimerValue;
+    SimulationThread simulation(timer, replaying ? replay.frequency : glfwGetTimerFrequency(), 60, 8);
+
+    // keys of the original boilerplate: the held ones move things every tick, T toggles the shape
+    static const struct
+    {
+        int key;
+        unsigned int action;
+    } heldKeys[] = {
+        {GLFW_KEY_I, ACTION_SHIFT_UP},
+        {GLFW_KEY_K, ACTION_SHIFT_DOWN},
+        {GLFW_KEY_J, ACTION_SHIFT_LEFT},
+        {GLFW_KEY_L, ACTION_SHIFT_RIGHT},
+        {GLFW_KEY_O, ACTION_SHIFT_FAR},
+        {GLFW_KEY_U, ACTION_SHIFT_NEAR},
+        {GLFW_KEY_W, ACTION_CAMERA_FORWARD},
+        {GLFW_KEY_S, ACTION_CAMERA_BACK},
+        {GLFW_KEY_A, ACTION_CAMERA_LEFT},
+        {GLFW_KEY_D, ACTION_CAMERA_RIGHT},
+        {GLFW_KEY_Q, ACTION_CAMERA_UP},
+        {GLFW_KEY_E, ACTION_CAMERA_DOWN},
+        {GLFW_KEY_R, ACTION_ROTATE},
+    };
+    for (unsigned int i = 0; i < sizeof(heldKeys) / sizeof(heldKeys[0]); i++)
+        simulation.bindings.bindHeld(heldKeys[i].key, heldKeys[i].action);
+    simulation.bindings.bindPress(GLFW_KEY_T, toggleShape);
+    simulation.onPublish = wake_render_thread;
+    simulationThread = &simulation;
+    inputTimer = timer;
+    simulation.start(SimState(), !replaying);
+    FrameStats frameStats;
+    // a CSV gets every frame of the run, the JSON summary only needs the window
+    std::string frameTimesName = frameTimesPath ? frameTimesPath : "";
+    frameStats.keepLog = frameTimesPath && (frameTimesName.size() < 5 || frameTimesName.compare(frameTimesName.size() - 5, 5, ".json") != 0);
+    double lastStatsReport = glfwGetTime();
+    uint64_t replayStart = glfwGetTimerValue();
+
     while (!glfwWindowShouldClose(window))
     {
         // input
         // -----
-        processInput(window);
+        uint64_t frameStart = glfwGetTimerValue();
+        frameStats.beginFrame();
+        redraw.beginFrame();
+        if (replaying && !replay.nextFrame(window))
+            break;
+        if (recorder.recording())
+            recorder.frame(frameStart);
+        if (replaying)
+            simulation.update();
+
+        // latest simulation state
+        // -----------------------
+        SimState frame = simulation.sample(timer());
+        shift = frame.shift;
+        cameraPos = frame.cameraPos;
+        rotation = glm::mat4_cast(frame.rotation);
 
         // render
         // ------
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        if (!texturesLoaded)
+        {
+            texturesLoaded = pboUploads ? textures.submit(pbo) : textures.submit(loader);
+            if (texturesLoaded)
+            {
+                textures.report();
+                if (pboUploads)
+                    std::cout << "  pbo: " << pbo.stalls << " frames cut short by a buffer still in flight" << std::endl;
+            }
+            else
+                redraw.scheduleIn(0.005);
+        }
+
+        // until the loader is done there is only the clear colour to show
+        if (!resourcesReady)
+        {
+            if (loader.failed(program))
+                break;
+            resourcesReady = loader.ready(program);
+            for (int i = 0; i < 4; i++)
+                resourcesReady = loader.ready(meshBuffers[i]) && resourcesReady;
+            if (resourcesReady)
+            {
+                shaderProgram = program->name;
+                VBO_Prism = meshBuffers[0]->name;
+                EBO_Prism = meshBuffers[1]->name;
+                VBO_Pyramid = meshBuffers[2]->name;
+                EBO_Pyramid = meshBuffers[3]->name;
+                shapePrism.initVertexArray(&VAO_Prism, VBO_Prism, EBO_Prism);
+                shapePyramid.initVertexArray(&VAO_Pyramid, VBO_Pyramid, EBO_Pyramid);
+            }
+            else
+            {
+                // uploaded but not yet signaled: look again shortly
+                frameStats.endCpu();
+                glfwSwapBuffers(window);
+                frameStats.endFrame();
+                redraw.scheduleIn(0.002);
+                redraw.waitEvents(window);
+                continue;
+            }
+        }
+
         // draw our first triangle
         glUseProgram(shaderProgram);
 
@@ -193,24 +415,132 @@ int main(int argc, char **argv)
         int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
         glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-        if (PYRAMID != 1)
-            shapePrism.draw(&VAO_Prism, shaderProgram);
+        // frustum culling: only what the spatial index returns gets drawn
+        if (!frame.pyramid)
+            transformBounds(shapePrism.boundsMin, shapePrism.boundsMax, trans, boundsMin, boundsMax);
         else
-            shapePyramid.draw(&VAO_Pyramid, shaderProgram);
+            transformBounds(shapePyramid.boundsMin, shapePyramid.boundsMax, trans, boundsMin, boundsMax);
+        objectTree.moveProxy(mainProxy, boundsMin, boundsMax);
+        visibleObjects.clear();
+        objectTree.query(Frustum(projection * view), visibleObjects);
+        bool mainVisible = std::find(visibleObjects.begin(), visibleObjects.end(), mainObject) != visibleObjects.end();
+
+        if (mainVisible)
+        {
+            if (cpuCulling)
+            {
+                // cull on the CPU and draw the compacted index buffer instead
+                int width, height;
+                glfwGetFramebufferSize(window, &width, &height);
+                geometry.viewportWidth = width;
+                geometry.viewportHeight = height;
+                if (!frame.pyramid)
+                {
+                    geometry.process(shapePrism, projection * view * trans);
+                    geometry.draw(&VAO_Prism, &EBO_Prism, shaderProgram);
+                }
+                else
+                {
+                    geometry.process(shapePyramid, projection * view * trans);
+                    geometry.draw(&VAO_Pyramid, &EBO_Pyramid, shaderProgram);
+                }
+            }
+            else if (!frame.pyramid)
+                shapePrism.draw(&VAO_Prism, shaderProgram);
+            else
+                shapePyramid.draw(&VAO_Pyramid, shaderProgram);
+        }
+
+        if (occlusionCulling && !stack.empty())
+        {
+            // the nearest two layers' worth of prisms are the occluders, everything is tested against them
+            occlusion.beginFrame(projection * view);
+            stackOrder.resize(stack.size());
+            for (unsigned int i = 0; i < stack.size(); i++)
+                stackOrder[i] = i;
+            unsigned int occluderCount = std::min((unsigned int)stack.size(), (unsigned int)(2 * stackSize * stackSize));
+            std::partial_sort(stackOrder.begin(), stackOrder.begin() + occluderCount, stackOrder.end(), [](unsigned int a, unsigned int b) {
+                return glm::distance(glm::vec3(stack[a][3]), cameraPos) < glm::distance(glm::vec3(stack[b][3]), cameraPos);
+            });
+            for (unsigned int i = 0; i < occluderCount; i++)
+                occlusion.addOccluder(shapePrism, stack[stackOrder[i]]);
+            occlusion.buildHierarchy();
+        }
+        for (unsigned int v = 0; v < visibleObjects.size(); v++)
+        {
+            unsigned int i = visibleObjects[v];
+            if (i == mainObject || (occlusionCulling && !occlusion.isVisible(shapePrism.boundsMin, shapePrism.boundsMax, stack[i])))
+                continue;
+            glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(stack[i]));
+            shapePrism.draw(&VAO_Prism, shaderProgram);
+        }
+        if (occlusionCulling && !stack.empty())
+        {
+            cullingTime += occlusion.milliseconds;
+            cullingTested += occlusion.tested;
+            cullingCulled += occlusion.culled;
+            cullingFrames++;
+            if (glfwGetTime() - lastReport >= 1.0)
+            {
+                // nothing tested when the whole stack is off screen
+                std::cout << "occlusion: " << (cullingTested ? 100.0f * cullingCulled / cullingTested : 0.0f) << "% culled, "
+                          << cullingTime / cullingFrames << " ms/frame culling" << std::endl;
+                lastReport = glfwGetTime();
+                cullingTime = 0.0;
+                cullingFrames = cullingTested = cullingCulled = 0;
+            }
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
+        frameStats.endCpu();
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        frameStats.endFrame();
+        if (printFrameStats && glfwGetTime() - lastStatsReport >= 1.0)
+        {
+            frameStats.print("frames");
+            lastStatsReport = glfwGetTime();
+        }
+        // keep drawing while the picture hasn't caught up with the simulation, which
+        // wakes us up itself when it moves; otherwise sleep until the next event
+        if (!samePose(frame, simulation.latest()))
+            redraw.invalidate();
+        unsigned int wakeups = redraw.wakeups;
+        redraw.waitEvents(window);
+        if (redraw.wakeups != wakeups)
+            frameStats.idle();
+    }
+
+    simulation.stop();
+    simulationThread = NULL;
+    loader.stop();
+    recorder.close();
+    if (replaying)
+    {
+        double replaySeconds = (double)(glfwGetTimerValue() - replayStart) / glfwGetTimerFrequency();
+        std::cout << "replay: " << frameStats.frameCount() << " frames in " << replaySeconds << " s (recorded "
+                  << replay.seconds() << " s, " << replay.seconds() / std::max(replaySeconds, 1e-9) << "x)" << std::endl;
+        frameStats.print("replay", true);
     }
+    if (frameTimesPath)
+        frameStats.write(frameTimesPath);
 
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &VAO_Prism);
-    glDeleteBuffers(1, &EBO_Prism);
-    glDeleteVertexArrays(1, &VAO_Pyramid);
-    glDeleteBuffers(1, &EBO_Pyramid);
-    glDeleteProgram(shaderProgram);
+    if (resourcesReady)
+    {
+        glDeleteVertexArrays(1, &VAO_Prism);
+        glDeleteBuffers(1, &VBO_Prism);
+        glDeleteBuffers(1, &EBO_Prism);
+        glDeleteVertexArrays(1, &VAO_Pyramid);
+        glDeleteBuffers(1, &VBO_Pyramid);
+        glDeleteBuffers(1, &EBO_Pyramid);
+        glDeleteProgram(shaderProgram);
+    }
+    geometry.deleteBuffers();
+    textures.wait();
+    textures.deleteTextures();
+    pbo.deleteBuffers();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -218,78 +548,38 @@ int main(int argc, char **argv)
     return 0;
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
-void processInput(GLFWwindow *window)
+// software rasterizer or ray tracer: same shape, camera and transform as the first windowed frame
+// -----------------------------------------------------------------------------------------------
+int renderHeadless(int nsides, const char *outputPath, bool raytrace)
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
-    {
-        if (PYRAMID == 0)
-            PYRAMID = 2;
-        if (PYRAMID == 1)
-            PYRAMID = 3;
-    }
-    else if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
-    {
-        if (PYRAMID == 2)
-            PYRAMID = 1;
-        if (PYRAMID == 3)
-            PYRAMID = 0;
-    }
-    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
-    {
-        shift.y += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
-    {
-        shift.y -= 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
-    {
-        shift.x -= 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
-    {
-        shift.x += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
-    {
-        shift.z -= 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS)
-    {
-        shift.z += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-    {
-        cameraPos.z -= 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-    {
-        cameraPos.z += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-    {
-        cameraPos.x -= 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-    {
-        cameraPos.x += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-    {
-        cameraPos.y += 0.02;
-    }
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+    if (nsides <= 2)
     {
-        cameraPos.y -= 0.02;   
+        std::cout << "ERROR: no. of vertices should be >= 3.\n";
+        return 1;
     }
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
+
+    Prism prism((unsigned int)nsides);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 3.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1.0, 0));
+    glm::mat4 trans = glm::scale(glm::mat4(1.0), glm::vec3(0.2, 0.2, 0.2));
+
+    if (raytrace)
     {
-        rotation = glm::rotate(rotation, (float)0.05, glm::vec3(1, 0, 0));
+        RayTracer tracer(SCR_WIDTH, SCR_HEIGHT);
+        tracer.samplesPerPixel = 4;
+        tracer.background = 0xff4c4c33; // glClearColor(0.2f, 0.3f, 0.3f, 1.0f)
+        tracer.addMesh(prism, trans);
+        tracer.build();
+        tracer.setCamera(projection, view);
+        tracer.render();
+        return tracer.writePNG(outputPath) ? 0 : 1;
     }
+
+    SoftwareRasterizer raster(SCR_WIDTH, SCR_HEIGHT);
+    raster.clear(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+    raster.draw(prism, projection * view * trans);
+    raster.flush();
+    return raster.writePNG(outputPath) ? 0 : 1;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -299,4 +589,59 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    redraw.invalidate();
+}
+
+// input: every key, cursor move and resize goes into the log with its timer value when
+// recording, and keys, cursor and scroll are posted to the simulation thread
+// -----------------------------------------------------------------------------------------
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    recorder.key(glfwGetTimerValue(), key, scancode, action, mods);
+    redraw.invalidate();
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+    if (simulationThread)
+    {
+        InputMessage message = {InputMessage::KEY, inputTimer(), key, action, mods, 0.0f, 0.0f};
+        simulationThread->post(message);
+    }
+}
+
+void cursor_position_callback(GLFWwindow *, double xpos, double ypos)
+{
+    recorder.cursor(glfwGetTimerValue(), xpos, ypos);
+    if (simulationThread)
+    {
+        InputMessage message = {InputMessage::CURSOR, inputTimer(), 0, 0, 0, (float)xpos, (float)ypos};
+        simulationThread->post(message);
+    }
+}
+
+void scroll_callback(GLFWwindow *, double xoffset, double yoffset)
+{
+    if (simulationThread)
+    {
+        InputMessage message = {InputMessage::SCROLL, inputTimer(), 0, 0, 0, (float)xoffset, (float)yoffset};
+        simulationThread->post(message);
+    }
+}
+
+// simulation or loader thread: a tick moved something or an upload finished, get the
+// render thread out of its wait
+void wake_render_thread()
+{
+    redraw.invalidate();
+    glfwPostEmptyEvent();
+}
+
+void window_size_callback(GLFWwindow *, int width, int height)
+{
+    recorder.resize(glfwGetTimerValue(), width, height);
+}
+
+// the window system lost our contents (uncovered, restored), draw them again
+void window_refresh_callback(GLFWwindow *)
+{
+    redraw.invalidate();
 }
@@ -0,0 +1,103 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// a whole file mapped read-only; the decoder reads straight out of the page cache
+// instead of copying through stdio
+class MappedFile
+{
+public:
+    const unsigned char *data;
+    size_t size;
+
+    MappedFile()
+    {
+        data = NULL;
+        size = 0;
+#ifdef _WIN32
+        file = mapping = NULL;
+#endif
+    }
+
+    ~MappedFile() { close(); }
+
+    bool open(const char *path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            file = NULL;
+            return false;
+        }
+        LARGE_INTEGER length;
+        GetFileSizeEx(file, &length);
+        size = (size_t)length.QuadPart;
+        mapping = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        data = mapping ? (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            size = (size_t)info.st_size;
+            void *view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED)
+            {
+                madvise(view, size, MADV_SEQUENTIAL);
+                data = (const unsigned char *)view;
+            }
+        }
+        ::close(fd);
+#endif
+        if (!data)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file)
+            CloseHandle(file);
+        file = mapping = NULL;
+#else
+        if (data)
+            munmap((void *)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+};
+
+#endif
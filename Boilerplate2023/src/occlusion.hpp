@@ -0,0 +1,293 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+// Software occlusion culling: the biggest objects are rasterized into a small CPU depth
+// buffer, a max-depth pyramid is built over it, and bounding boxes are tested against
+// that pyramid before anything is submitted to GL. Occluders write the farthest depth
+// they reach in a pixel and tested boxes get a texel of slack, so culling errs towards
+// drawing.
+class OcclusionCuller
+{
+public:
+    static const int WIDTH = 256;
+    static const int HEIGHT = 128;
+
+    std::vector<std::vector<float> > levels; // levels[0] is the depth buffer itself
+    glm::mat4 viewProjection;
+
+    // per-frame statistics, reset by beginFrame()
+    unsigned int occluders, tested, culled;
+    double milliseconds;
+
+    OcclusionCuller()
+    {
+        for (int w = WIDTH, h = HEIGHT; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+        {
+            levels.push_back(std::vector<float>(w * h, 1.0f));
+            if (w == 1 && h == 1)
+                break;
+        }
+        occluders = tested = culled = 0;
+        milliseconds = 0.0;
+    }
+
+    int levelWidth(int level) const
+    {
+        return std::max(1, WIDTH >> level);
+    }
+
+    int levelHeight(int level) const
+    {
+        return std::max(1, HEIGHT >> level);
+    }
+
+    void beginFrame(const glm::mat4 &vp)
+    {
+        milliseconds = 0.0;
+        startTimer();
+        viewProjection = vp;
+        std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+        occluders = tested = culled = 0;
+        stopTimer();
+    }
+
+    template <typename Shape>
+    void addOccluder(const Shape &shape, const glm::mat4 &model)
+    {
+        startTimer();
+        occluders++;
+        glm::mat4 mvp = viewProjection * model;
+        std::vector<glm::vec4> clip(shape.vertices.size() / 3);
+        for (unsigned int i = 0; i < clip.size(); i++)
+            clip[i] = mvp * glm::vec4(shape.vertices[3 * i], shape.vertices[3 * i + 1], shape.vertices[3 * i + 2], 1.0f);
+        for (unsigned int i = 0; i + 2 < shape.indices.size(); i += 3)
+            clipTriangle(clip[shape.indices[i]], clip[shape.indices[i + 1]], clip[shape.indices[i + 2]]);
+        stopTimer();
+    }
+
+    // call once after the last occluder and before the first test
+    void buildHierarchy()
+    {
+        startTimer();
+        for (unsigned int l = 1; l < levels.size(); l++)
+            downsample(l);
+        stopTimer();
+    }
+
+    // false only when the box is certainly hidden behind the occluders or off screen
+    bool isVisible(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model)
+    {
+        startTimer();
+        tested++;
+        bool visible = testBounds(boundsMin, boundsMax, model);
+        culled += !visible;
+        stopTimer();
+        return visible;
+    }
+
+    float culledPercent() const
+    {
+        return tested ? 100.0f * culled / tested : 0.0f;
+    }
+
+private:
+    std::chrono::steady_clock::time_point timerStart;
+
+    void startTimer()
+    {
+        timerStart = std::chrono::steady_clock::now();
+    }
+
+    void stopTimer()
+    {
+        milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timerStart).count();
+    }
+
+    bool testBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model) const
+    {
+        glm::mat4 mvp = viewProjection * model;
+        glm::vec2 rectMin(FLT_MAX), rectMax(-FLT_MAX);
+        float nearest = FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+            glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+            // crossing the near plane, the projected rectangle is unbounded
+            if (clip.z < -clip.w)
+                return true;
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            glm::vec2 window((ndc.x * 0.5f + 0.5f) * WIDTH, (0.5f - ndc.y * 0.5f) * HEIGHT);
+            rectMin = glm::min(rectMin, window);
+            rectMax = glm::max(rectMax, window);
+            nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+        if (rectMax.x < 0.0f || rectMax.y < 0.0f || rectMin.x > WIDTH || rectMin.y > HEIGHT || nearest > 1.0f)
+            return false;
+
+        // one texel of slack for occluder edges that only partly cover their pixel
+        int x0 = std::max(0, (int)rectMin.x - 1), y0 = std::max(0, (int)rectMin.y - 1);
+        int x1 = std::min(WIDTH - 1, (int)rectMax.x + 1), y1 = std::min(HEIGHT - 1, (int)rectMax.y + 1);
+
+        // pick the level where the rectangle spans at most two texels per axis
+        int level = 0;
+        while ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)
+            level++;
+        level = std::min(level, (int)levels.size() - 1);
+
+        const std::vector<float> &depth = levels[level];
+        int w = levelWidth(level), h = levelHeight(level);
+        for (int y = std::min(y0 >> level, h - 1); y <= std::min(y1 >> level, h - 1); y++)
+            for (int x = std::min(x0 >> level, w - 1); x <= std::min(x1 >> level, w - 1); x++)
+                if (nearest <= depth[y * w + x])
+                    return true;
+        return false;
+    }
+
+    void clipTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+    {
+        const glm::vec4 *in[3] = {&a, &b, &c};
+        float d[3] = {a.z + a.w, b.z + b.w, c.z + c.w};
+        if (d[0] >= 0.0f && d[1] >= 0.0f && d[2] >= 0.0f)
+        {
+            rasterize(a, b, c);
+            return;
+        }
+        glm::vec4 poly[4];
+        int n = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            if (d[i] >= 0.0f)
+                poly[n++] = *in[i];
+            if ((d[i] >= 0.0f) != (d[j] >= 0.0f))
+                poly[n++] = *in[i] + (*in[j] - *in[i]) * (d[i] / (d[i] - d[j]));
+        }
+        for (int i = 2; i < n; i++)
+            rasterize(poly[0], poly[i - 1], poly[i]);
+    }
+
+    // sampled at pixel centers with the top-left rule so fans stay watertight, but with
+    // the farthest depth the triangle reaches inside each pixel
+    void rasterize(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+    {
+        glm::vec3 v[3];
+        const glm::vec4 *in[3] = {&a, &b, &c};
+        for (int i = 0; i < 3; i++)
+        {
+            glm::vec3 ndc = glm::vec3(*in[i]) / in[i]->w;
+            v[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (0.5f - ndc.y * 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+        }
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (!(std::fabs(area) > 0.0f))
+            return;
+        if (area < 0.0f)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+
+        int minX = std::max(0, (int)std::floor(std::min(v[0].x, std::min(v[1].x, v[2].x))));
+        int minY = std::max(0, (int)std::floor(std::min(v[0].y, std::min(v[1].y, v[2].y))));
+        int maxX = std::min(WIDTH - 1, (int)std::ceil(std::max(v[0].x, std::max(v[1].x, v[2].x))));
+        int maxY = std::min(HEIGHT - 1, (int)std::ceil(std::max(v[0].y, std::max(v[1].y, v[2].y))));
+        if (minX > maxX || minY > maxY)
+            return;
+
+        float edgeA[3], edgeB[3], edgeC[3];
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec3 &p = v[i], &q = v[(i + 1) % 3];
+            edgeA[i] = p.y - q.y;
+            edgeB[i] = q.x - p.x;
+            edgeC[i] = p.x * q.y - p.y * q.x;
+            // top-left rule: edges that are not top or left must be strictly positive
+            if (!(edgeA[i] > 0.0f || (edgeA[i] == 0.0f && edgeB[i] > 0.0f)))
+                edgeC[i] -= 1e-6f * (std::fabs(edgeA[i]) + std::fabs(edgeB[i]));
+        }
+        float dz1 = (v[1].z - v[0].z) / area, dz2 = (v[2].z - v[0].z) / area;
+        float zA = dz1 * edgeA[2] + dz2 * edgeA[0];
+        float zB = dz1 * edgeB[2] + dz2 * edgeB[0];
+        float zC = v[0].z + dz1 * edgeC[2] + dz2 * edgeC[0] + 0.5f * (std::fabs(zA) + std::fabs(zB));
+        float zMax = std::max(v[0].z, std::max(v[1].z, v[2].z));
+
+        std::vector<float> &depth = levels[0];
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 farthest = _mm_set1_ps(zMax);
+        minX &= ~3;
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), px), _mm_set1_ps(edgeB[0] * py + edgeC[0])), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), px), _mm_set1_ps(edgeB[1] * py + edgeC[1])), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), px), _mm_set1_ps(edgeB[2] * py + edgeC[2])), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_min_ps(farthest, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), px), _mm_set1_ps(zB * py + zC)));
+                float *row = &depth[y * WIDTH + x];
+                __m128 old = _mm_loadu_ps(row);
+                _mm_storeu_ps(row, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, z)), _mm_andnot_ps(inside, old)));
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; x++)
+            {
+                float px = x + 0.5f;
+                if (edgeA[0] * px + edgeB[0] * py + edgeC[0] < 0.0f || edgeA[1] * px + edgeB[1] * py + edgeC[1] < 0.0f ||
+                    edgeA[2] * px + edgeB[2] * py + edgeC[2] < 0.0f)
+                    continue;
+                float z = std::min(zMax, zA * px + zB * py + zC);
+                depth[y * WIDTH + x] = std::min(depth[y * WIDTH + x], z);
+            }
+        }
+#endif
+    }
+
+    void downsample(int level)
+    {
+        const std::vector<float> &src = levels[level - 1];
+        std::vector<float> &dst = levels[level];
+        int sw = levelWidth(level - 1), sh = levelHeight(level - 1);
+        int w = levelWidth(level), h = levelHeight(level);
+        for (int y = 0; y < h; y++)
+        {
+            const float *row0 = &src[std::min(2 * y, sh - 1) * sw];
+            const float *row1 = &src[std::min(2 * y + 1, sh - 1) * sw];
+            int x = 0;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+            if (sw == 2 * w)
+            {
+                for (; x + 4 <= w; x += 4)
+                {
+                    __m128 a = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x), _mm_loadu_ps(row1 + 2 * x));
+                    __m128 b = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x + 4), _mm_loadu_ps(row1 + 2 * x + 4));
+                    __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    _mm_storeu_ps(&dst[y * w + x], _mm_max_ps(even, odd));
+                }
+            }
+#endif
+            for (; x < w; x++)
+            {
+                int x0 = std::min(2 * x, sw - 1), x1 = std::min(2 * x + 1, sw - 1);
+                dst[y * w + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef PBO_H
+#define PBO_H
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "hdr.hpp"
+#include "texcache.hpp"
+
+// streams texture uploads through a ring of pixel unpack buffers on the render thread.
+// Each frame, update() copies at most budget bytes into free ring slots, mapped
+// unsynchronized so mapping never waits on the GPU, and issues glTexSubImage2D from
+// them; the transfer then runs while the CPU goes on with the frame. A fence per slot
+// says when the GPU is done reading it; a slot still in flight ends the frame's
+// uploads instead of stalling. Big images go up in bands of rows, baked textures
+// level by level straight from their mapping, a block compressed level in one piece,
+// HDR images as half floats decoded a band of scanlines at a time right into the slot.
+class PboUploader
+{
+public:
+    uint64_t budget;        // bytes per update()
+    uint64_t uploadedBytes;
+    unsigned int stalls;    // updates cut short by a busy slot
+
+    PboUploader(unsigned int slotCount = 4, unsigned int slotSize = 4 << 20)
+    {
+        budget = 8 << 20;
+        uploadedBytes = 0;
+        stalls = 0;
+        slots.resize(slotCount);
+        for (unsigned int i = 0; i < slotCount; i++)
+        {
+            slots[i].buffer = 0;
+            slots[i].size = slotSize;
+            slots[i].fence = 0;
+        }
+        next = 0;
+    }
+
+    // GL thread, with the context current
+    void init()
+    {
+        for (unsigned int i = 0; i < slots.size(); i++)
+        {
+            glGenBuffers(1, &slots[i].buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[i].buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slots[i].size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void deleteBuffers()
+    {
+        for (unsigned int i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].fence)
+                glDeleteSync(slots[i].fence);
+            if (slots[i].buffer)
+                glDeleteBuffers(1, &slots[i].buffer);
+            slots[i].buffer = 0;
+            slots[i].fence = 0;
+        }
+    }
+
+    // queue a whole 8-bit image for texture, taking the pixels; format GL_RED, GL_RG,
+    // GL_RGB or GL_RGBA. The texture gets its storage with the first band and its
+    // mipmaps with the last; tag comes back from finished() then.
+    void enqueue(unsigned int texture, int width, int height, GLenum format, std::vector<unsigned char> &pixels, unsigned int tag)
+    {
+        Upload upload;
+        upload.texture = texture;
+        upload.width = width;
+        upload.height = height;
+        upload.format = format;
+        upload.type = GL_UNSIGNED_BYTE;
+        upload.rowBytes = width * channelCount(format);
+        upload.nextRow = 0;
+        upload.level = 0;
+        upload.tag = tag;
+        upload.pixels.swap(pixels);
+        queue.push_back(std::move(upload));
+    }
+
+    // queue every level of a baked texture, which stays mapped until it's issued
+    void enqueue(unsigned int texture, const std::shared_ptr<BakedTexture> &baked, unsigned int tag)
+    {
+        Upload upload;
+        upload.texture = texture;
+        upload.width = baked->width();
+        upload.height = baked->levelRows(0);
+        upload.format = baked->format();
+        upload.type = GL_UNSIGNED_BYTE;
+        upload.rowBytes = baked->levelRowBytes(0);
+        upload.nextRow = 0;
+        upload.level = 0;
+        upload.tag = tag;
+        upload.baked = baked;
+        queue.push_back(std::move(upload));
+    }
+
+    // queue an HDR image as GL_RGB16F; it's decoded as it goes up, so never whole in memory
+    void enqueue(unsigned int texture, const std::shared_ptr<HdrImage> &hdr, unsigned int tag)
+    {
+        Upload upload;
+        upload.texture = texture;
+        upload.width = hdr->width();
+        upload.height = hdr->height();
+        upload.format = GL_RGB;
+        upload.type = GL_HALF_FLOAT;
+        upload.rowBytes = (unsigned int)hdr->rowBytes();
+        upload.nextRow = 0;
+        upload.level = 0;
+        upload.tag = tag;
+        upload.hdr = hdr;
+        queue.push_back(std::move(upload));
+    }
+
+    bool idle() const { return queue.empty(); }
+
+    // GL thread, once per frame; returns the bytes issued
+    uint64_t update()
+    {
+        uint64_t issued = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while (!queue.empty() && (issued == 0 || issued < budget))
+        {
+            Slot &slot = slots[next];
+            if (slot.fence)
+            {
+                GLenum state = glClientWaitSync(slot.fence, 0, 0);
+                if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+                {
+                    stalls++;
+                    break;
+                }
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+
+            Upload &upload = queue.front();
+            const unsigned char *pixels = upload.hdr ? NULL : upload.baked ? upload.baked->level(upload.level) : &upload.pixels[0];
+            glBindTexture(GL_TEXTURE_2D, upload.texture);
+            if (upload.nextRow == 0 && upload.baked && !upload.baked->compressed())
+                upload.baked->specifyLevel(upload.level, NULL);
+            else if (upload.nextRow == 0 && upload.hdr)
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, upload.width, upload.height, 0, GL_RGB, GL_HALF_FLOAT, NULL);
+            else if (upload.nextRow == 0)
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat(upload.format), upload.width, upload.height, 0, upload.format, GL_UNSIGNED_BYTE, NULL);
+
+            // as many rows as fit the slot and what's left of the budget, at least one
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (upload.rowBytes > slot.size)
+            {
+                slot.size = upload.rowBytes;
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.size, NULL, GL_STREAM_DRAW);
+            }
+            uint64_t room = std::min<uint64_t>(slot.size, budget > issued ? budget - issued : 0);
+            int rows = std::max(1, (int)std::min<uint64_t>(room / upload.rowBytes, upload.height - upload.nextRow));
+            unsigned int bytes = rows * upload.rowBytes;
+            void *target = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            if (target)
+            {
+                if (upload.hdr)
+                    readHdr(upload, rows, target);
+                else
+                    memcpy(target, pixels + (size_t)upload.nextRow * upload.rowBytes, bytes);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                if (upload.baked && upload.baked->compressed())
+                    upload.baked->specifyLevel(upload.level, (void *)0);
+                else
+                    glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.nextRow, upload.width, rows, upload.format, upload.type, (void *)0);
+            }
+            else
+            {
+                // mapping failed (out of memory, lost context): upload from client memory instead
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                if (upload.hdr)
+                {
+                    upload.pixels.resize(bytes);
+                    readHdr(upload, rows, &upload.pixels[0]);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, upload.width, rows, GL_RGB, GL_HALF_FLOAT, &upload.pixels[0]);
+                }
+                else if (upload.baked && upload.baked->compressed())
+                    upload.baked->specifyLevel(upload.level, pixels);
+                else
+                    glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.nextRow, upload.width, rows, upload.format, GL_UNSIGNED_BYTE, pixels + (size_t)upload.nextRow * upload.rowBytes);
+            }
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            next = (next + 1) % slots.size();
+            issued += bytes;
+
+            upload.nextRow += rows;
+            if (upload.nextRow == upload.height && upload.baked && upload.level + 1 < upload.baked->levels())
+            {
+                upload.level++;
+                upload.width = upload.baked->levelWidth(upload.level);
+                upload.height = upload.baked->levelRows(upload.level);
+                upload.rowBytes = upload.baked->levelRowBytes(upload.level);
+                upload.nextRow = 0;
+            }
+            else if (upload.nextRow == upload.height)
+            {
+                if (upload.baked)
+                    upload.baked->finish();
+                else
+                {
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                }
+                done.push_back(upload.tag);
+                queue.pop_front();
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        uploadedBytes += issued;
+        return issued;
+    }
+
+    // the tag of a fully issued texture, usable from here on in this context
+    bool finished(unsigned int &tag)
+    {
+        if (done.empty())
+            return false;
+        tag = done.front();
+        done.pop_front();
+        return true;
+    }
+
+    static unsigned int channelCount(GLenum format)
+    {
+        return format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGB ? 3 : 4;
+    }
+
+    static GLenum internalFormat(GLenum format)
+    {
+        return format == GL_RED ? GL_R8 : format == GL_RG ? GL_RG8 : format == GL_RGB ? GL_RGB8 : GL_RGBA8;
+    }
+
+private:
+    struct Slot
+    {
+        unsigned int buffer;
+        unsigned int size;
+        GLsync fence; // GPU still reading while unsignaled
+    };
+
+    struct Upload
+    {
+        unsigned int texture;
+        int width, height;
+        GLenum format, type;
+        unsigned int rowBytes;
+        int nextRow, level; // width, height and rowBytes are the level's, height in rows of rowBytes
+        unsigned int tag;
+        std::vector<unsigned char> pixels; // the band being decoded when hdr
+        std::shared_ptr<BakedTexture> baked;
+        std::shared_ptr<HdrImage> hdr;
+    };
+
+    // the next rows of an HDR upload; past corrupt data the texture stays black
+    static void readHdr(Upload &upload, int rows, void *target)
+    {
+        int read = upload.hdr->read(rows, (uint16_t *)target);
+        if (read == rows)
+            return;
+        memset(target, 0, (size_t)rows * upload.rowBytes);
+        if (upload.hdr->rowsLeft() > 0)
+        {
+            std::cout << "ERROR::TEXTURE::CORRUPT_HDR: " << stbi_failure_reason() << std::endl;
+            upload.hdr->close();
+        }
+    }
+
+    std::vector<Slot> slots;
+    unsigned int next;
+    std::deque<Upload> queue;
+    std::deque<unsigned int> done;
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <glm/glm.hpp>
+#include <stb_image_write.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "shapes.hpp"
+
+#include <iostream>
+
+// CPU fallback for the flat-colored GL path: the same vertices, indices, draw ranges
+// and MVP go in, an RGBA8 framebuffer comes out. Triangles are set up and binned into
+// screen tiles on the calling thread, then the tiles are rasterized in parallel.
+class SoftwareRasterizer
+{
+public:
+    static const int TILE_SIZE = 64;
+    static const int BLOCK_SIZE = 8; // granularity of the hierarchical depth buffer
+
+    struct Triangle
+    {
+        float edgeA[3], edgeB[3], edgeC[3];
+        bool topLeft[3];
+        float zA, zB, zC;
+        float minZ;
+        int minX, minY, maxX, maxY;
+        unsigned int color;
+    };
+
+    int width, height;
+    int stride; // pixels per row, padded to whole tiles
+    int tilesX, tilesY;
+    unsigned int numThreads;
+    std::vector<unsigned int> colorBuffer;
+    std::vector<float> depthBuffer;
+    std::vector<float> blockMaxDepth;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<unsigned int> > bins;
+
+    SoftwareRasterizer(int w, int h, unsigned int threads = 0)
+    {
+        width = w;
+        height = h;
+        tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+        stride = tilesX * TILE_SIZE;
+        numThreads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+        colorBuffer.resize(stride * tilesY * TILE_SIZE);
+        depthBuffer.resize(stride * tilesY * TILE_SIZE);
+        blockMaxDepth.resize((stride / BLOCK_SIZE) * (tilesY * TILE_SIZE / BLOCK_SIZE));
+        bins.resize(tilesX * tilesY);
+    }
+
+    // equivalent of glClearColor + glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT)
+    void clear(const glm::vec4 &color)
+    {
+        std::fill(colorBuffer.begin(), colorBuffer.end(), packColor(color));
+        std::fill(depthBuffer.begin(), depthBuffer.end(), 1.0f);
+        std::fill(blockMaxDepth.begin(), blockMaxDepth.end(), 1.0f);
+        triangles.clear();
+        for (unsigned int i = 0; i < bins.size(); i++)
+            bins[i].clear();
+    }
+
+    // queue a shape's draw ranges, transformed by mvp; nothing is rasterized until flush()
+    template <typename Shape>
+    void draw(const Shape &shape, const glm::mat4 &mvp)
+    {
+        draw(shape.vertices, shape.indices, shape.ranges, mvp);
+    }
+
+    void draw(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+              const std::vector<DrawRange> &ranges, const glm::mat4 &mvp)
+    {
+        std::vector<glm::vec4> clip(vertices.size() / 3);
+        for (unsigned int i = 0; i < clip.size(); i++)
+            clip[i] = mvp * glm::vec4(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], 1.0f);
+
+        for (unsigned int r = 0; r < ranges.size(); r++)
+        {
+            unsigned int color = packColor(ranges[r].color);
+            for (unsigned int i = ranges[r].first; i + 2 < ranges[r].first + ranges[r].count; i += 3)
+                clipTriangle(clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]], color);
+        }
+    }
+
+    // rasterize every binned triangle, one tile at a time across all worker threads
+    void flush()
+    {
+        std::atomic<int> nextTile(0);
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < numThreads; i++)
+            workers.push_back(std::thread(&SoftwareRasterizer::worker, this, &nextTile));
+        worker(&nextTile);
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // rows are stored top to bottom, which is what stb_image_write expects
+    const unsigned char *pixels() const
+    {
+        return (const unsigned char *)&colorBuffer[0];
+    }
+
+    bool writePNG(const char *path) const
+    {
+        if (!stbi_write_png(path, width, height, 4, pixels(), stride * 4))
+        {
+            std::cout << "ERROR::RASTERIZER::FAILED_TO_WRITE: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static unsigned int packColor(const glm::vec4 &c)
+    {
+        glm::vec4 v = glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f;
+        return (unsigned int)v.r | ((unsigned int)v.g << 8) | ((unsigned int)v.b << 16) | ((unsigned int)v.a << 24);
+    }
+
+    // only the near plane needs real clipping; x/y are handled by the screen bounding
+    // box and anything past the far plane fails the depth test against the 1.0 clear
+    void clipTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, unsigned int color)
+    {
+        const glm::vec4 *in[3] = {&a, &b, &c};
+        int outside[6] = {0, 0, 0, 0, 0, 0};
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &v = *in[i];
+            outside[0] += v.x < -v.w;
+            outside[1] += v.x > v.w;
+            outside[2] += v.y < -v.w;
+            outside[3] += v.y > v.w;
+            outside[4] += v.z < -v.w;
+            outside[5] += v.z > v.w;
+        }
+        for (int i = 0; i < 6; i++)
+            if (outside[i] == 3)
+                return;
+
+        if (outside[4] == 0)
+        {
+            setupTriangle(a, b, c, color);
+            return;
+        }
+
+        glm::vec4 poly[4];
+        int n = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &p = *in[i];
+            const glm::vec4 &q = *in[(i + 1) % 3];
+            float dp = p.z + p.w, dq = q.z + q.w;
+            if (dp >= 0.0f)
+                poly[n++] = p;
+            if ((dp >= 0.0f) != (dq >= 0.0f))
+                poly[n++] = p + (q - p) * (dp / (dp - dq));
+        }
+        for (int i = 2; i < n; i++)
+            setupTriangle(poly[0], poly[i - 1], poly[i], color);
+    }
+
+    void setupTriangle(glm::vec4 a, glm::vec4 b, glm::vec4 c, unsigned int color)
+    {
+        glm::vec3 v[3];
+        const glm::vec4 *in[3] = {&a, &b, &c};
+        for (int i = 0; i < 3; i++)
+        {
+            glm::vec3 ndc = glm::vec3(*in[i]) / in[i]->w;
+            v[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (0.5f - ndc.y * 0.5f) * height, ndc.z * 0.5f + 0.5f);
+        }
+
+        // no face culling in the GL path either, so flip clockwise triangles around
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (area == 0.0f || !std::isfinite(area))
+            return;
+        if (area < 0.0f)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+
+        Triangle tri;
+        tri.minX = std::max(0, (int)std::floor(std::min(v[0].x, std::min(v[1].x, v[2].x))));
+        tri.minY = std::max(0, (int)std::floor(std::min(v[0].y, std::min(v[1].y, v[2].y))));
+        tri.maxX = std::min(width - 1, (int)std::ceil(std::max(v[0].x, std::max(v[1].x, v[2].x))));
+        tri.maxY = std::min(height - 1, (int)std::ceil(std::max(v[0].y, std::max(v[1].y, v[2].y))));
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+            return;
+
+        // edge i runs from v[i] to v[i + 1] and is positive on the inside
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec3 &p = v[i], &q = v[(i + 1) % 3];
+            tri.edgeA[i] = p.y - q.y;
+            tri.edgeB[i] = q.x - p.x;
+            tri.edgeC[i] = p.x * q.y - p.y * q.x;
+            tri.topLeft[i] = tri.edgeA[i] > 0.0f || (tri.edgeA[i] == 0.0f && tri.edgeB[i] > 0.0f);
+        }
+
+        // depth is affine in screen space: z = z0 + (z1 - z0) * b1 + (z2 - z0) * b2
+        float dz1 = (v[1].z - v[0].z) / area, dz2 = (v[2].z - v[0].z) / area;
+        tri.zA = dz1 * tri.edgeA[2] + dz2 * tri.edgeA[0];
+        tri.zB = dz1 * tri.edgeB[2] + dz2 * tri.edgeB[0];
+        tri.zC = v[0].z + dz1 * tri.edgeC[2] + dz2 * tri.edgeC[0];
+        tri.minZ = std::min(v[0].z, std::min(v[1].z, v[2].z));
+        tri.color = color;
+
+        unsigned int index = triangles.size();
+        triangles.push_back(tri);
+        for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ty++)
+            for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; tx++)
+                bins[ty * tilesX + tx].push_back(index);
+    }
+
+    void worker(std::atomic<int> *nextTile)
+    {
+        int tile;
+        while ((tile = nextTile->fetch_add(1)) < (int)bins.size())
+        {
+            const std::vector<unsigned int> &bin = bins[tile];
+            for (unsigned int i = 0; i < bin.size(); i++)
+                rasterizeTile(triangles[bin[i]], tile % tilesX, tile / tilesX);
+        }
+    }
+
+    void rasterizeTile(const Triangle &tri, int tx, int ty)
+    {
+        int x0 = std::max(tri.minX, tx * TILE_SIZE) & ~(BLOCK_SIZE - 1);
+        int y0 = std::max(tri.minY, ty * TILE_SIZE) & ~(BLOCK_SIZE - 1);
+        int x1 = std::min(tri.maxX, tx * TILE_SIZE + TILE_SIZE - 1);
+        int y1 = std::min(tri.maxY, ty * TILE_SIZE + TILE_SIZE - 1);
+        int blocksPerRow = stride / BLOCK_SIZE;
+
+        for (int by = y0; by <= y1; by += BLOCK_SIZE)
+        {
+            for (int bx = x0; bx <= x1; bx += BLOCK_SIZE)
+            {
+                // hierarchical depth: the whole block is already nearer than this triangle
+                float &blockMax = blockMaxDepth[(by / BLOCK_SIZE) * blocksPerRow + bx / BLOCK_SIZE];
+                if (tri.minZ >= blockMax)
+                    continue;
+                if (blockOutside(tri, bx, by))
+                    continue;
+                if (rasterizeBlock(tri, bx, by))
+                    blockMax = computeBlockMax(bx, by);
+            }
+        }
+    }
+
+    // true when all four block corners are on the outside of one edge
+    static bool blockOutside(const Triangle &tri, int bx, int by)
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            float x = (tri.edgeA[e] >= 0.0f ? bx + BLOCK_SIZE : bx);
+            float y = (tri.edgeB[e] >= 0.0f ? by + BLOCK_SIZE : by);
+            if (tri.edgeA[e] * x + tri.edgeB[e] * y + tri.edgeC[e] < 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    // four pixels per step: three edge functions, the depth plane and a masked write
+    bool rasterizeBlock(const Triangle &tri, int bx, int by)
+    {
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 topLeft[3];
+        for (int e = 0; e < 3; e++)
+            topLeft[e] = _mm_castsi128_ps(_mm_set1_epi32(tri.topLeft[e] ? -1 : 0));
+        __m128i color = _mm_set1_epi32((int)tri.color);
+        int written = 0;
+
+        for (int y = by; y < by + BLOCK_SIZE; y++)
+        {
+            if (y < tri.minY || y > tri.maxY)
+                continue;
+            float py = y + 0.5f;
+            for (int x = bx; x < bx + BLOCK_SIZE; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int e = 0; e < 3; e++)
+                {
+                    __m128 ev = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[e]), px),
+                                           _mm_set1_ps(tri.edgeB[e] * py + tri.edgeC[e]));
+                    __m128 pass = _mm_or_ps(_mm_cmpgt_ps(ev, zero), _mm_and_ps(_mm_cmpeq_ps(ev, zero), topLeft[e]));
+                    inside = _mm_and_ps(inside, pass);
+                }
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                int index = y * stride + x;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.zA), px), _mm_set1_ps(tri.zB * py + tri.zC));
+                __m128 depth = _mm_loadu_ps(&depthBuffer[index]);
+                __m128 mask = _mm_and_ps(inside, _mm_cmplt_ps(z, depth));
+                if (_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                _mm_storeu_ps(&depthBuffer[index], _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth)));
+                __m128i imask = _mm_castps_si128(mask);
+                __m128i old = _mm_loadu_si128((const __m128i *)&colorBuffer[index]);
+                _mm_storeu_si128((__m128i *)&colorBuffer[index], _mm_or_si128(_mm_and_si128(imask, color), _mm_andnot_si128(imask, old)));
+                written = 1;
+            }
+        }
+        return written != 0;
+    }
+
+    float computeBlockMax(int bx, int by) const
+    {
+        __m128 m = _mm_setzero_ps();
+        for (int y = by; y < by + BLOCK_SIZE; y++)
+            for (int x = bx; x < bx + BLOCK_SIZE; x += 4)
+                m = _mm_max_ps(m, _mm_loadu_ps(&depthBuffer[y * stride + x]));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(m);
+    }
+#else
+    bool rasterizeBlock(const Triangle &tri, int bx, int by)
+    {
+        bool written = false;
+        for (int y = std::max(by, tri.minY); y < by + BLOCK_SIZE && y <= tri.maxY; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = bx; x < bx + BLOCK_SIZE; x++)
+            {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3 && inside; e++)
+                {
+                    float ev = tri.edgeA[e] * px + tri.edgeB[e] * py + tri.edgeC[e];
+                    inside = ev > 0.0f || (ev == 0.0f && tri.topLeft[e]);
+                }
+                float z = tri.zA * px + tri.zB * py + tri.zC;
+                int index = y * stride + x;
+                if (inside && z < depthBuffer[index])
+                {
+                    depthBuffer[index] = z;
+                    colorBuffer[index] = tri.color;
+                    written = true;
+                }
+            }
+        }
+        return written;
+    }
+
+    float computeBlockMax(int bx, int by) const
+    {
+        float m = 0.0f;
+        for (int y = by; y < by + BLOCK_SIZE; y++)
+            for (int x = bx; x < bx + BLOCK_SIZE; x++)
+                m = std::max(m, depthBuffer[y * stride + x]);
+        return m;
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,590 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtx/intersect.hpp>
+#include <stb_image_write.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "shapes.hpp"
+
+#include <iostream>
+
+// CPU ray caster for the boilerplate scene: meshes are flattened into world-space
+// triangles, an SAH BVH is built over them (subtrees in parallel), and 2x2 ray
+// packets are traced through it with SSE. Image tiles are handed out through
+// per-thread queues that steal from each other when they run dry.
+class RayTracer
+{
+public:
+    static const int TILE_SIZE = 32;
+    static const int SAH_BINS = 12;
+    static const int MAX_DEPTH = 60; // keeps the fixed traversal stacks from overflowing
+
+    struct Triangle
+    {
+        glm::vec3 v0, e1, e2; // e1 = v1 - v0, e2 = v2 - v0
+        unsigned int color;
+        unsigned int object;
+    };
+
+    struct Node
+    {
+        glm::vec3 boundsMin;
+        unsigned int leftFirst; // left child for interior nodes, first triangle for leaves
+        glm::vec3 boundsMax;
+        unsigned int count;     // 0 for interior nodes
+    };
+
+    struct Hit
+    {
+        float t;
+        int triangle; // -1 on a miss
+        unsigned int object;
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+    unsigned int numThreads;
+    int width, height;
+    int samplesPerPixel; // jittered supersampling for offline renders
+    unsigned int background;
+    std::vector<unsigned int> colorBuffer;
+
+    RayTracer(int w, int h, unsigned int threads = 0)
+    {
+        width = w;
+        height = h;
+        numThreads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        samplesPerPixel = 1;
+        background = 0xff000000;
+        colorBuffer.resize(w * h);
+        nodesUsed = 0;
+    }
+
+    // flatten a shape's draw ranges into world space; returns the object id used by pick()
+    template <typename Shape>
+    unsigned int addMesh(const Shape &shape, const glm::mat4 &model)
+    {
+        unsigned int object = objectCount++;
+        for (unsigned int r = 0; r < shape.ranges.size(); r++)
+        {
+            const DrawRange &range = shape.ranges[r];
+            for (unsigned int i = range.first; i + 2 < range.first + range.count; i += 3)
+            {
+                glm::vec3 v[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int index = shape.indices[i + k];
+                    v[k] = glm::vec3(model * glm::vec4(shape.vertices[3 * index], shape.vertices[3 * index + 1], shape.vertices[3 * index + 2], 1.0f));
+                }
+                Triangle tri = {v[0], v[1] - v[0], v[2] - v[0], packColor(range.color), object};
+                triangles.push_back(tri);
+            }
+        }
+        return object;
+    }
+
+    void clearScene()
+    {
+        triangles.clear();
+        nodes.clear();
+        objectCount = 0;
+    }
+
+    void build()
+    {
+        unsigned int n = triangles.size();
+        nodes.assign(std::max(1u, 2 * n), Node());
+        primIndex.resize(n);
+        for (unsigned int i = 0; i < n; i++)
+            primIndex[i] = i;
+        centroids.resize(n);
+        for (unsigned int i = 0; i < n; i++)
+            centroids[i] = triangles[i].v0 + (triangles[i].e1 + triangles[i].e2) / 3.0f;
+
+        nodesUsed = 1;
+        nodes[0].leftFirst = 0;
+        nodes[0].count = n;
+        updateBounds(0);
+        int parallelDepth = 0;
+        while ((1u << parallelDepth) < numThreads)
+            parallelDepth++;
+        subdivide(0, 0, parallelDepth);
+        nodes.resize(nodesUsed);
+
+        // store triangles in leaf order so leaves read contiguous memory
+        std::vector<Triangle> sorted(n);
+        for (unsigned int i = 0; i < n; i++)
+            sorted[i] = triangles[primIndex[i]];
+        triangles.swap(sorted);
+        primIndex.clear();
+        centroids.clear();
+    }
+
+    // camera rays from the same matrices the GL path uses
+    void setCamera(const glm::mat4 &projection, const glm::mat4 &view)
+    {
+        invViewProjection = glm::inverse(projection * view);
+    }
+
+    void render()
+    {
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        std::vector<TileQueue> queues(numThreads);
+        for (int i = 0; i < tilesX * tilesY; i++)
+            queues[i % numThreads].tiles.push_back(i);
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < numThreads; i++)
+            workers.push_back(std::thread(&RayTracer::renderWorker, this, &queues, i, tilesX));
+        renderWorker(&queues, 0, tilesX);
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // window coordinates with y pointing down, as glfwGetCursorPos reports them
+    Hit pick(float x, float y) const
+    {
+        glm::vec3 origin, dir;
+        primaryRay((x + 0.5f) / width, (y + 0.5f) / height, origin, dir);
+        return intersect(origin, dir);
+    }
+
+    Hit intersect(const glm::vec3 &origin, const glm::vec3 &dir) const
+    {
+        Hit hit = {FLT_MAX, -1, 0};
+        if (triangles.empty())
+            return hit;
+        glm::vec3 invDir = 1.0f / dir;
+        unsigned int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node &node = nodes[stack[--top]];
+            if (slab(node, origin, invDir, hit.t) == FLT_MAX)
+                continue;
+            if (node.count)
+            {
+                for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+                {
+                    float t = intersectTriangle(triangles[i], origin, dir);
+                    if (t < hit.t)
+                    {
+                        hit.t = t;
+                        hit.triangle = i;
+                    }
+                }
+                continue;
+            }
+            // visit the nearer child first
+            float tl = slab(nodes[node.leftFirst], origin, invDir, hit.t);
+            float tr = slab(nodes[node.leftFirst + 1], origin, invDir, hit.t);
+            unsigned int nearChild = tl <= tr ? node.leftFirst : node.leftFirst + 1;
+            if (std::max(tl, tr) != FLT_MAX)
+                stack[top++] = nearChild == node.leftFirst ? node.leftFirst + 1 : node.leftFirst;
+            if (std::min(tl, tr) != FLT_MAX)
+                stack[top++] = nearChild;
+        }
+        if (hit.triangle >= 0)
+            hit.object = triangles[hit.triangle].object;
+        return hit;
+    }
+
+    // brute force over every triangle with glm::intersectRayTriangle, for validation
+    Hit intersectReference(const glm::vec3 &origin, const glm::vec3 &dir) const
+    {
+        Hit hit = {FLT_MAX, -1, 0};
+        for (unsigned int i = 0; i < triangles.size(); i++)
+        {
+            const Triangle &tri = triangles[i];
+            glm::vec3 bary;
+            if (glm::intersectRayTriangle(origin, dir, tri.v0, tri.v0 + tri.e1, tri.v0 + tri.e2, bary) && bary.z < hit.t)
+            {
+                hit.t = bary.z;
+                hit.triangle = i;
+                hit.object = tri.object;
+            }
+        }
+        return hit;
+    }
+
+    void primaryRay(float u, float v, glm::vec3 &origin, glm::vec3 &dir) const
+    {
+        glm::vec4 nearPoint = invViewProjection * glm::vec4(u * 2.0f - 1.0f, 1.0f - v * 2.0f, -1.0f, 1.0f);
+        glm::vec4 farPoint = invViewProjection * glm::vec4(u * 2.0f - 1.0f, 1.0f - v * 2.0f, 1.0f, 1.0f);
+        origin = glm::vec3(nearPoint) / nearPoint.w;
+        dir = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+    }
+
+    bool writePNG(const char *path) const
+    {
+        if (!stbi_write_png(path, width, height, 4, &colorBuffer[0], width * 4))
+        {
+            std::cout << "ERROR::RAYTRACER::FAILED_TO_WRITE: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct TileQueue
+    {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    struct Bin
+    {
+        glm::vec3 boundsMin, boundsMax;
+        unsigned int count;
+    };
+
+    std::vector<unsigned int> primIndex;
+    std::vector<glm::vec3> centroids;
+    std::atomic<unsigned int> nodesUsed;
+    unsigned int objectCount = 0;
+    glm::mat4 invViewProjection;
+
+    static unsigned int packColor(const glm::vec4 &c)
+    {
+        glm::vec4 v = glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f;
+        return (unsigned int)v.r | ((unsigned int)v.g << 8) | ((unsigned int)v.b << 16) | ((unsigned int)v.a << 24);
+    }
+
+    static float area(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        glm::vec3 e = boundsMax - boundsMin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    void updateBounds(unsigned int index)
+    {
+        Node &node = nodes[index];
+        node.boundsMin = glm::vec3(FLT_MAX);
+        node.boundsMax = glm::vec3(-FLT_MAX);
+        for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+        {
+            const Triangle &tri = triangles[primIndex[i]];
+            node.boundsMin = glm::min(node.boundsMin, glm::min(tri.v0, glm::min(tri.v0 + tri.e1, tri.v0 + tri.e2)));
+            node.boundsMax = glm::max(node.boundsMax, glm::max(tri.v0, glm::max(tri.v0 + tri.e1, tri.v0 + tri.e2)));
+        }
+    }
+
+    // binned SAH over all three axes; returns false when a leaf is cheaper
+    bool findSplit(const Node &node, int &bestAxis, float &bestPos)
+    {
+        glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+        for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+        {
+            cmin = glm::min(cmin, centroids[primIndex[i]]);
+            cmax = glm::max(cmax, centroids[primIndex[i]]);
+        }
+
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (cmax[axis] <= cmin[axis])
+                continue;
+            Bin bins[SAH_BINS];
+            for (int b = 0; b < SAH_BINS; b++)
+            {
+                bins[b].boundsMin = glm::vec3(FLT_MAX);
+                bins[b].boundsMax = glm::vec3(-FLT_MAX);
+                bins[b].count = 0;
+            }
+            float scale = SAH_BINS / (cmax[axis] - cmin[axis]);
+            for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+            {
+                const Triangle &tri = triangles[primIndex[i]];
+                int b = std::min(SAH_BINS - 1, (int)((centroids[primIndex[i]][axis] - cmin[axis]) * scale));
+                bins[b].count++;
+                bins[b].boundsMin = glm::min(bins[b].boundsMin, glm::min(tri.v0, glm::min(tri.v0 + tri.e1, tri.v0 + tri.e2)));
+                bins[b].boundsMax = glm::max(bins[b].boundsMax, glm::max(tri.v0, glm::max(tri.v0 + tri.e1, tri.v0 + tri.e2)));
+            }
+
+            // sweep from both sides to get the cost of every bin boundary
+            float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+            unsigned int leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+            glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX), rmin(FLT_MAX), rmax(-FLT_MAX);
+            unsigned int lsum = 0, rsum = 0;
+            for (int b = 0; b < SAH_BINS - 1; b++)
+            {
+                lsum += bins[b].count;
+                leftCount[b] = lsum;
+                if (bins[b].count)
+                {
+                    lmin = glm::min(lmin, bins[b].boundsMin);
+                    lmax = glm::max(lmax, bins[b].boundsMax);
+                }
+                leftArea[b] = lsum ? area(lmin, lmax) : 0.0f;
+
+                int rb = SAH_BINS - 1 - b;
+                rsum += bins[rb].count;
+                rightCount[rb - 1] = rsum;
+                if (bins[rb].count)
+                {
+                    rmin = glm::min(rmin, bins[rb].boundsMin);
+                    rmax = glm::max(rmax, bins[rb].boundsMax);
+                }
+                rightArea[rb - 1] = rsum ? area(rmin, rmax) : 0.0f;
+            }
+            for (int b = 0; b < SAH_BINS - 1; b++)
+            {
+                float cost = leftCount[b] * leftArea[b] + rightCount[b] * rightArea[b];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPos = cmin[axis] + (b + 1) / scale;
+                }
+            }
+        }
+        // one traversal step costs about as much as intersecting one triangle
+        return bestCost < (node.count - 1.0f) * area(node.boundsMin, node.boundsMax);
+    }
+
+    void subdivide(unsigned int index, int depth, int parallelDepth)
+    {
+        Node &node = nodes[index];
+        if (node.count <= 2 || depth >= MAX_DEPTH)
+            return;
+        int axis = 0;
+        float pos = 0.0f;
+        if (!findSplit(node, axis, pos))
+            return;
+
+        unsigned int i = node.leftFirst, j = node.leftFirst + node.count - 1;
+        while (i <= j && j != ~0u)
+        {
+            if (centroids[primIndex[i]][axis] < pos)
+                i++;
+            else
+                std::swap(primIndex[i], primIndex[j--]);
+        }
+        unsigned int leftCount = i - node.leftFirst;
+        if (leftCount == 0 || leftCount == node.count)
+            return;
+
+        unsigned int left = nodesUsed.fetch_add(2);
+        nodes[left].leftFirst = node.leftFirst;
+        nodes[left].count = leftCount;
+        nodes[left + 1].leftFirst = i;
+        nodes[left + 1].count = node.count - leftCount;
+        node.leftFirst = left;
+        node.count = 0;
+        updateBounds(left);
+        updateBounds(left + 1);
+
+        // the two halves touch disjoint ranges of primIndex, so they can build concurrently
+        if (parallelDepth > 0 && nodes[left].count > 1024 && nodes[left + 1].count > 1024)
+        {
+            std::thread leftBuild(&RayTracer::subdivide, this, left, depth + 1, parallelDepth - 1);
+            subdivide(left + 1, depth + 1, parallelDepth - 1);
+            leftBuild.join();
+        }
+        else
+        {
+            subdivide(left, depth + 1, 0);
+            subdivide(left + 1, depth + 1, 0);
+        }
+    }
+
+    static float slab(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tmax)
+    {
+        glm::vec3 t1 = (node.boundsMin - origin) * invDir;
+        glm::vec3 t2 = (node.boundsMax - origin) * invDir;
+        glm::vec3 tminv = glm::min(t1, t2), tmaxv = glm::max(t1, t2);
+        float tnear = std::max(std::max(tminv.x, tminv.y), std::max(tminv.z, 0.0f));
+        float tfar = std::min(std::min(tmaxv.x, tmaxv.y), std::min(tmaxv.z, tmax));
+        return tnear <= tfar ? tnear : FLT_MAX;
+    }
+
+    // Moller-Trumbore, the same test glm::intersectRayTriangle performs
+    static float intersectTriangle(const Triangle &tri, const glm::vec3 &origin, const glm::vec3 &dir)
+    {
+        glm::vec3 p = glm::cross(dir, tri.e2);
+        float det = glm::dot(tri.e1, p);
+        if (std::fabs(det) < FLT_EPSILON)
+            return FLT_MAX;
+        float inv = 1.0f / det;
+        glm::vec3 s = origin - tri.v0;
+        float u = glm::dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f)
+            return FLT_MAX;
+        glm::vec3 q = glm::cross(s, tri.e1);
+        float v = glm::dot(dir, q) * inv;
+        if (v < 0.0f || u + v > 1.0f)
+            return FLT_MAX;
+        float t = glm::dot(tri.e2, q) * inv;
+        return t >= 0.0f ? t : FLT_MAX;
+    }
+
+    bool nextTile(std::vector<TileQueue> *queues, unsigned int self, int &tile)
+    {
+        {
+            std::lock_guard<std::mutex> guard((*queues)[self].lock);
+            if (!(*queues)[self].tiles.empty())
+            {
+                tile = (*queues)[self].tiles.back();
+                (*queues)[self].tiles.pop_back();
+                return true;
+            }
+        }
+        for (unsigned int k = 1; k < queues->size(); k++)
+        {
+            TileQueue &victim = (*queues)[(self + k) % queues->size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty())
+            {
+                tile = victim.tiles.front();
+                victim.tiles.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void renderWorker(std::vector<TileQueue> *queues, unsigned int self, int tilesX)
+    {
+        int tile;
+        while (nextTile(queues, self, tile))
+        {
+            int x0 = (tile % tilesX) * TILE_SIZE, y0 = (tile / tilesX) * TILE_SIZE;
+            for (int y = y0; y < std::min(y0 + TILE_SIZE, height); y += 2)
+                for (int x = x0; x < std::min(x0 + TILE_SIZE, width); x += 2)
+                    shadeQuad(x, y);
+        }
+    }
+
+    // one 2x2 pixel block, traced as one packet per sample
+    void shadeQuad(int x, int y)
+    {
+        glm::vec4 sum[4] = {glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f)};
+        for (int s = 0; s < samplesPerPixel; s++)
+        {
+            // stratified offsets on a rotated grid, the center when there is only one sample
+            float jx = samplesPerPixel == 1 ? 0.5f : (s + 0.5f) / samplesPerPixel;
+            float jy = samplesPerPixel == 1 ? 0.5f : glm::fract(jx * 7.0f + 0.5f / samplesPerPixel);
+            glm::vec3 origins[4], dirs[4];
+            for (int k = 0; k < 4; k++)
+                primaryRay((x + (k & 1) + jx) / width, (y + (k >> 1) + jy) / height, origins[k], dirs[k]);
+            int hits[4];
+            intersectPacket(origins, dirs, hits);
+            for (int k = 0; k < 4; k++)
+                sum[k] += unpackColor(hits[k] >= 0 ? triangles[hits[k]].color : background);
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            int px = x + (k & 1), py = y + (k >> 1);
+            if (px < width && py < height)
+                colorBuffer[py * width + px] = packColor(sum[k] / (float)samplesPerPixel);
+        }
+    }
+
+    static glm::vec4 unpackColor(unsigned int c)
+    {
+        return glm::vec4(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff, c >> 24) / 255.0f;
+    }
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    void intersectPacket(const glm::vec3 origins[4], const glm::vec3 dirs[4], int hits[4]) const
+    {
+        __m128 ox = _mm_setr_ps(origins[0].x, origins[1].x, origins[2].x, origins[3].x);
+        __m128 oy = _mm_setr_ps(origins[0].y, origins[1].y, origins[2].y, origins[3].y);
+        __m128 oz = _mm_setr_ps(origins[0].z, origins[1].z, origins[2].z, origins[3].z);
+        __m128 dx = _mm_setr_ps(dirs[0].x, dirs[1].x, dirs[2].x, dirs[3].x);
+        __m128 dy = _mm_setr_ps(dirs[0].y, dirs[1].y, dirs[2].y, dirs[3].y);
+        __m128 dz = _mm_setr_ps(dirs[0].z, dirs[1].z, dirs[2].z, dirs[3].z);
+        __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+        __m128 idx = _mm_div_ps(one, dx), idy = _mm_div_ps(one, dy), idz = _mm_div_ps(one, dz);
+        __m128 tmax = _mm_set1_ps(FLT_MAX);
+        __m128i hit = _mm_set1_epi32(-1);
+        for (int k = 0; k < 4; k++)
+            hits[k] = -1;
+        if (triangles.empty())
+            return;
+
+        unsigned int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node &node = nodes[stack[--top]];
+            // slab test for all four rays, skip the node if none of them enter it
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), ox), idx);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), ox), idx);
+            __m128 tnear = _mm_max_ps(zero, _mm_min_ps(t1, t2));
+            __m128 tfar = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), oy), idy);
+            t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), oy), idy);
+            tnear = _mm_max_ps(tnear, _mm_min_ps(t1, t2));
+            tfar = _mm_min_ps(tfar, _mm_max_ps(t1, t2));
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), oz), idz);
+            t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), oz), idz);
+            tnear = _mm_max_ps(tnear, _mm_min_ps(t1, t2));
+            tfar = _mm_min_ps(tfar, _mm_max_ps(t1, t2));
+            if (_mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) == 0)
+                continue;
+
+            if (node.count == 0)
+            {
+                stack[top++] = node.leftFirst + 1;
+                stack[top++] = node.leftFirst;
+                continue;
+            }
+
+            for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+            {
+                const Triangle &tri = triangles[i];
+                __m128 e1x = _mm_set1_ps(tri.e1.x), e1y = _mm_set1_ps(tri.e1.y), e1z = _mm_set1_ps(tri.e1.z);
+                __m128 e2x = _mm_set1_ps(tri.e2.x), e2y = _mm_set1_ps(tri.e2.y), e2z = _mm_set1_ps(tri.e2.z);
+                // p = dir x e2
+                __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+                __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+                __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+                __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+                __m128 mask = _mm_cmpge_ps(absDet, _mm_set1_ps(FLT_EPSILON));
+                __m128 inv = _mm_div_ps(one, det);
+                // s = origin - v0
+                __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(tri.v0.x));
+                __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(tri.v0.y));
+                __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(tri.v0.z));
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+                // q = s x e1
+                __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+                __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+                __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, tmax)));
+                if (_mm_movemask_ps(mask) == 0)
+                    continue;
+                tmax = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, tmax));
+                __m128i imask = _mm_castps_si128(mask);
+                hit = _mm_or_si128(_mm_and_si128(imask, _mm_set1_epi32((int)i)), _mm_andnot_si128(imask, hit));
+            }
+        }
+        _mm_storeu_si128((__m128i *)hits, hit);
+    }
+#else
+    void intersectPacket(const glm::vec3 origins[4], const glm::vec3 dirs[4], int hits[4]) const
+    {
+        for (int k = 0; k < 4; k++)
+            hits[k] = intersect(origins[k], dirs[k]).triangle;
+    }
+#endif
+};
+
+#endif
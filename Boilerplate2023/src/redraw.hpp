@@ -0,0 +1,73 @@
+#ifndef REDRAW_H
+#define REDRAW_H
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+
+// on-demand rendering: a frame is drawn only when something marked the scene dirty
+// (input, resize, expose, a moving simulation) or a scheduled animation is due; the
+// rest of the time the render thread sleeps in glfwWaitEventsTimeout. Continuous mode
+// keeps the old poll-and-redraw loop for benchmarks.
+class RedrawTracker
+{
+public:
+    bool continuous;
+    double idleTimeout; // seconds; the longest a wait blocks with nothing scheduled
+    unsigned int frames, wakeups;
+
+    RedrawTracker()
+    {
+        continuous = false;
+        idleTimeout = 1.0;
+        frames = wakeups = 0;
+        dirty.store(true);
+        scheduled = 0;
+    }
+
+    // any thread; from outside the render thread, follow it with glfwPostEmptyEvent
+    void invalidate() { dirty.store(true); }
+
+    // redraw at timer value 'at' (glfwGetTimerValue) even if nothing else happens
+    void schedule(uint64_t at) { scheduled = scheduled ? std::min(scheduled, at) : at; }
+
+    void scheduleIn(double seconds) { schedule(glfwGetTimerValue() + (uint64_t)(seconds * glfwGetTimerFrequency())); }
+
+    // render thread, at the top of each frame before anything is sampled: whatever
+    // invalidates from here on is for the next frame, so no wake-up is lost between
+    // drawing and waiting; returns whether this frame was asked for
+    bool beginFrame() { return dirty.exchange(false); }
+
+    // process events; in on-demand mode, block until the next frame is needed
+    void waitEvents(GLFWwindow *window)
+    {
+        frames++;
+        if (continuous)
+        {
+            glfwPollEvents();
+            return;
+        }
+        glfwPollEvents();
+        while (!dirty.load() && !glfwWindowShouldClose(window))
+        {
+            uint64_t now = glfwGetTimerValue();
+            if (scheduled && now >= scheduled)
+            {
+                scheduled = 0;
+                break;
+            }
+            double timeout = idleTimeout;
+            if (scheduled)
+                timeout = std::min(timeout, (double)(scheduled - now) / glfwGetTimerFrequency());
+            glfwWaitEventsTimeout(timeout);
+            wakeups++;
+        }
+    }
+
+private:
+    std::atomic<bool> dirty;
+    uint64_t scheduled; // 0 when nothing is
+};
+
+#endif
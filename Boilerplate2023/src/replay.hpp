@@ -0,0 +1,302 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <iostream>
+
+// GLFW's internal input entry points (libraries/glfw/src/input.c), the same ones the
+// platform backends call; GLFWwindow is the opaque _GLFWwindow. Needs GLFW linked statically.
+extern "C"
+{
+    void _glfwInputKey(GLFWwindow *window, int key, int scancode, int action, int mods);
+    void _glfwInputCursorPos(GLFWwindow *window, double xpos, double ypos);
+}
+
+// Input log format, little endian:
+//   header   "GLIR", u32 version, u64 timer frequency
+//   records  u8 type, varint timer ticks since the previous record, then per type
+//     FRAME   (start of a rendered frame)
+//     KEY     zigzag varint key, zigzag varint scancode, u8 action, u8 mods
+//     CURSOR  f32 x, f32 y
+//     RESIZE  varint width, varint height
+struct InputEvent
+{
+    enum Type
+    {
+        FRAME,
+        KEY,
+        CURSOR,
+        RESIZE
+    };
+
+    unsigned char type;
+    uint64_t time; // timer ticks since the recording started
+    int key, scancode, action, mods;
+    float x, y;
+    int width, height;
+};
+
+class InputRecorder
+{
+public:
+    uint64_t events;
+
+    InputRecorder()
+    {
+        file = NULL;
+        last = 0;
+        events = 0;
+    }
+
+    ~InputRecorder() { close(); }
+
+    bool create(const char *path, uint64_t frequency, uint64_t now)
+    {
+        file = fopen(path, "wb");
+        if (!file)
+        {
+            std::cout << "ERROR::REPLAY::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        uint32_t version = 1;
+        fwrite("GLIR", 1, 4, file);
+        writeRaw(&version, 4);
+        writeRaw(&frequency, 8);
+        last = now;
+        return true;
+    }
+
+    void close()
+    {
+        if (file)
+            fclose(file);
+        file = NULL;
+    }
+
+    bool recording() const { return file != NULL; }
+
+    void frame(uint64_t now) { begin(InputEvent::FRAME, now); }
+
+    void key(uint64_t now, int key, int scancode, int action, int mods)
+    {
+        if (!begin(InputEvent::KEY, now))
+            return;
+        writeVarint(zigzag(key));
+        writeVarint(zigzag(scancode));
+        unsigned char bytes[2] = {(unsigned char)action, (unsigned char)mods};
+        writeRaw(bytes, 2);
+    }
+
+    void cursor(uint64_t now, double x, double y)
+    {
+        if (!begin(InputEvent::CURSOR, now))
+            return;
+        float position[2] = {(float)x, (float)y};
+        writeRaw(position, 8);
+    }
+
+    void resize(uint64_t now, int width, int height)
+    {
+        if (!begin(InputEvent::RESIZE, now))
+            return;
+        writeVarint(width);
+        writeVarint(height);
+    }
+
+private:
+    FILE *file;
+    uint64_t last;
+
+    static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+
+    bool begin(unsigned char type, uint64_t now)
+    {
+        if (!file)
+            return false;
+        fputc(type, file);
+        // callbacks and frames are stamped on the same thread, but don't trust it
+        writeVarint(now > last ? now - last : 0);
+        last = std::max(last, now);
+        events++;
+        return true;
+    }
+
+    void writeVarint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            fputc((int)(v & 0x7f) | 0x80, file);
+            v >>= 7;
+        }
+        fputc((int)v, file);
+    }
+
+    void writeRaw(const void *data, size_t size) { fwrite(data, 1, size, file); }
+};
+
+// plays a log back into a window: before each frame, inject everything that happened
+// since the previous one and advance a virtual clock to the recorded frame time, so
+// the replay runs as fast as the machine can render and ticks the same simulation
+class InputReplay
+{
+public:
+    std::vector<InputEvent> events;
+    uint64_t frequency;
+    uint64_t clock; // virtual timer value of the frame being replayed
+    unsigned int frames;
+
+    InputReplay()
+    {
+        frequency = 1;
+        clock = 0;
+        frames = 0;
+        position = 0;
+    }
+
+    bool load(const char *path)
+    {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+        {
+            std::cout << "ERROR::REPLAY::CANNOT_READ: " << path << std::endl;
+            return false;
+        }
+        std::vector<unsigned char> bytes;
+        unsigned char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            bytes.insert(bytes.end(), buffer, buffer + n);
+        fclose(file);
+
+        uint32_t version = 0;
+        if (bytes.size() < 16 || memcmp(&bytes[0], "GLIR", 4) != 0)
+        {
+            std::cout << "ERROR::REPLAY::NOT_AN_INPUT_LOG: " << path << std::endl;
+            return false;
+        }
+        memcpy(&version, &bytes[4], 4);
+        memcpy(&frequency, &bytes[8], 8);
+        if (version != 1 || frequency == 0)
+        {
+            std::cout << "ERROR::REPLAY::UNSUPPORTED_VERSION: " << version << std::endl;
+            return false;
+        }
+
+        size_t at = 16;
+        uint64_t time = 0;
+        events.clear();
+        while (at < bytes.size())
+        {
+            InputEvent event;
+            memset(&event, 0, sizeof(event));
+            event.type = bytes[at++];
+            uint64_t delta;
+            bool ok = readVarint(bytes, at, delta);
+            time += delta;
+            event.time = time;
+            uint64_t a = 0, b = 0;
+            switch (event.type)
+            {
+            case InputEvent::FRAME:
+                break;
+            case InputEvent::KEY:
+                ok = ok && readVarint(bytes, at, a) && readVarint(bytes, at, b) && at + 2 <= bytes.size();
+                if (ok)
+                {
+                    event.key = unzigzag(a);
+                    event.scancode = unzigzag(b);
+                    event.action = bytes[at];
+                    event.mods = bytes[at + 1];
+                    at += 2;
+                }
+                break;
+            case InputEvent::CURSOR:
+                ok = ok && at + 8 <= bytes.size();
+                if (ok)
+                {
+                    memcpy(&event.x, &bytes[at], 4);
+                    memcpy(&event.y, &bytes[at + 4], 4);
+                    at += 8;
+                }
+                break;
+            case InputEvent::RESIZE:
+                ok = ok && readVarint(bytes, at, a) && readVarint(bytes, at, b);
+                event.width = (int)a;
+                event.height = (int)b;
+                break;
+            default:
+                ok = false;
+            }
+            if (!ok)
+            {
+                // a recording cut short by a crash still replays up to there
+                std::cout << "ERROR::REPLAY::TRUNCATED_LOG: stopping at byte " << at << std::endl;
+                break;
+            }
+            events.push_back(event);
+        }
+        position = 0;
+        frames = 0;
+        clock = events.empty() ? 0 : events[0].time;
+        return true;
+    }
+
+    // inject the input that preceded the next recorded frame; false when the log is over
+    bool nextFrame(GLFWwindow *window)
+    {
+        while (position < events.size())
+        {
+            const InputEvent &event = events[position++];
+            clock = event.time;
+            switch (event.type)
+            {
+            case InputEvent::FRAME:
+                frames++;
+                return true;
+            case InputEvent::KEY:
+                _glfwInputKey(window, event.key, event.scancode, event.action, event.mods);
+                break;
+            case InputEvent::CURSOR:
+                _glfwInputCursorPos(window, event.x, event.y);
+                break;
+            case InputEvent::RESIZE:
+                glfwSetWindowSize(window, event.width, event.height);
+                break;
+            }
+        }
+        return false;
+    }
+
+    // recorded duration in seconds
+    double seconds() const
+    {
+        return events.empty() ? 0.0 : (double)(events.back().time - events.front().time) / frequency;
+    }
+
+private:
+    size_t position;
+
+    static int unzigzag(uint64_t v) { return (int)((int64_t)(v >> 1) ^ -(int64_t)(v & 1)); }
+
+    static bool readVarint(const std::vector<unsigned char> &bytes, size_t &at, uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && at < bytes.size(); shift += 7)
+        {
+            unsigned char byte = bytes[at++];
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -7,16 +7,50 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
+#include <random>
 #include <vector>
 
 #include <iostream>
 
+// a run of indices drawn with one flat color, shared by the GL and CPU renderers
+struct DrawRange
+{
+    unsigned int first;
+    unsigned int count;
+    glm::vec4 color;
+};
+
+// the side faces get pseudo-random colors from a per-mesh generator, so every renderer
+// agrees and meshes can be built on several threads at once
+inline glm::vec4 randomFaceColor(std::minstd_rand &rng)
+{
+    float r = (float)rng() / std::minstd_rand::max();
+    float g = (float)rng() / std::minstd_rand::max();
+    float b = (float)rng() / std::minstd_rand::max();
+    return glm::vec4(r, g, b, 1.0f);
+}
+
+// object-space AABB, for visibility tests
+inline void computeBounds(const std::vector<float> &vertices, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+    boundsMin = glm::vec3(vertices[0], vertices[1], vertices[2]);
+    boundsMax = boundsMin;
+    for (unsigned int i = 3; i + 2 < vertices.size(); i += 3)
+    {
+        glm::vec3 v(vertices[i], vertices[i + 1], vertices[i + 2]);
+        boundsMin = glm::min(boundsMin, v);
+        boundsMax = glm::max(boundsMax, v);
+    }
+}
+
 class Prism
 {
 public:
     unsigned int nsides;
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
+    std::vector<DrawRange> ranges;
+    glm::vec3 boundsMin, boundsMax;
 
     Prism(unsigned int n)
     {
@@ -74,15 +108,24 @@ public:
             indices.push_back(nsides + 1 + (i + 1) % nsides);
             indices.push_back(nsides + 1 + i);
         }
+
+        // both caps in green, then one quad per side
+        std::minstd_rand rng;
+        DrawRange caps = {0, 6 * nsides, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f)};
+        ranges.push_back(caps);
+        for (int i = 0; i < nsides; i++)
+        {
+            DrawRange side = {6 * (nsides + i), 6, randomFaceColor(rng)};
+            ranges.push_back(side);
+        }
+
+        computeBounds(vertices, boundsMin, boundsMax);
     }
 
     void initBuffers(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO)
     {
-        glGenVertexArrays(1, VAO);
         glGenBuffers(1, VBO);
         glGenBuffers(1, EBO);
-        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-        glBindVertexArray(*VAO);
 
         // init the VBO
         glBindBuffer(GL_ARRAY_BUFFER, *VBO);
@@ -92,6 +135,19 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
+        initVertexArray(VAO, *VBO, *EBO);
+    }
+
+    // the VAO for buffers that already hold vertices and indices, e.g. uploaded by the
+    // loader thread; VAOs aren't shared between contexts, so this runs on the render thread
+    void initVertexArray(unsigned int *VAO, unsigned int VBO, unsigned int EBO)
+    {
+        glGenVertexArrays(1, VAO);
+        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+        glBindVertexArray(*VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
         // declare attributes
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
@@ -106,18 +162,13 @@ public:
 
     void draw(unsigned int *VAO, unsigned int shaderProg)
     {
-        srand(0);
         glBindVertexArray(*VAO); // seeing as we only have a single VAO there's no need to bind it every time, but we'll do so to keep things a bit more organized
         int vertexColorLocation = glGetUniformLocation(shaderProg, "color");
-        glUniform4f(vertexColorLocation, 0.0f, 1.0f, 0.0f, 1.0f);
 
-        glDrawElements(GL_TRIANGLES, 6 * nsides, GL_UNSIGNED_INT, (void *)0);
-        double theta;
-        for (int i = 0; i < nsides; i++)
+        for (unsigned int i = 0; i < ranges.size(); i++)
         {
-            theta = 2.0 * M_PI * i / nsides;
-            glUniform4f(vertexColorLocation, (float)rand()/RAND_MAX, (float)rand()/RAND_MAX, (float)rand()/RAND_MAX, 1.0);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void *)(6 * (nsides + i) * sizeof(unsigned int)));
+            glUniform4fv(vertexColorLocation, 1, glm::value_ptr(ranges[i].color));
+            glDrawElements(GL_TRIANGLES, ranges[i].count, GL_UNSIGNED_INT, (void *)(ranges[i].first * sizeof(unsigned int)));
         }
         glBindVertexArray(0);
     }
@@ -129,6 +180,8 @@ public:
     unsigned int nsides;
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
+    std::vector<DrawRange> ranges;
+    glm::vec3 boundsMin, boundsMax;
 
     Pyramid(unsigned int n)
     {
@@ -168,15 +221,24 @@ public:
             indices.push_back(i + 1);
             indices.push_back((i + 1) % nsides + 1);
         }
+
+        // the base in green, then one triangle per side
+        std::minstd_rand rng;
+        DrawRange base = {3 * nsides, 3 * nsides, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f)};
+        ranges.push_back(base);
+        for (int i = 0; i < nsides; i++)
+        {
+            DrawRange side = {3 * (unsigned int)i, 3, randomFaceColor(rng)};
+            ranges.push_back(side);
+        }
+
+        computeBounds(vertices, boundsMin, boundsMax);
     }
 
     void initBuffers(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO)
     {
-        glGenVertexArrays(1, VAO);
         glGenBuffers(1, VBO);
         glGenBuffers(1, EBO);
-        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-        glBindVertexArray(*VAO);
 
         // init the VBO
         glBindBuffer(GL_ARRAY_BUFFER, *VBO);
@@ -186,6 +248,19 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
+        initVertexArray(VAO, *VBO, *EBO);
+    }
+
+    // the VAO for buffers that already hold vertices and indices, e.g. uploaded by the
+    // loader thread; VAOs aren't shared between contexts, so this runs on the render thread
+    void initVertexArray(unsigned int *VAO, unsigned int VBO, unsigned int EBO)
+    {
+        glGenVertexArrays(1, VAO);
+        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+        glBindVertexArray(*VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
         // declare attributes
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
@@ -200,18 +275,13 @@ public:
 
     void draw(unsigned int *VAO, unsigned int shaderProg)
     {
-        srand(0);
         glBindVertexArray(*VAO); // seeing as we only have a single VAO there's no need to bind it every time, but we'll do so to keep things a bit more organized
         int vertexColorLocation = glGetUniformLocation(shaderProg, "color");
-        glUniform4f(vertexColorLocation, 0.0f, 1.0f, 0.0f, 1.0f);
 
-        glDrawElements(GL_TRIANGLES, 3 * nsides, GL_UNSIGNED_INT, (void *)(3 * nsides * sizeof(unsigned int)));
-        double theta;
-        for (int i = 0; i < nsides; i++)
+        for (unsigned int i = 0; i < ranges.size(); i++)
         {
-            theta = 2.0 * M_PI * i / nsides;
-            glUniform4f(vertexColorLocation, (float)rand()/RAND_MAX, (float)rand()/RAND_MAX, (float)rand()/RAND_MAX, 1.0);
-            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)(3 * i * sizeof(unsigned int)));
+            glUniform4fv(vertexColorLocation, 1, glm::value_ptr(ranges[i].color));
+            glDrawElements(GL_TRIANGLES, ranges[i].count, GL_UNSIGNED_INT, (void *)(ranges[i].first * sizeof(unsigned int)));
         }
         glBindVertexArray(0);
     }
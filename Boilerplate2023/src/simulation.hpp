@@ -0,0 +1,394 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "triplebuffer.hpp"
+#include "input.hpp"
+
+// what a held key does every tick, see InputBindings
+enum Action
+{
+    ACTION_SHIFT_UP = 1 << 0,
+    ACTION_SHIFT_DOWN = 1 << 1,
+    ACTION_SHIFT_LEFT = 1 << 2,
+    ACTION_SHIFT_RIGHT = 1 << 3,
+    ACTION_SHIFT_NEAR = 1 << 4,
+    ACTION_SHIFT_FAR = 1 << 5,
+    ACTION_CAMERA_FORWARD = 1 << 6,
+    ACTION_CAMERA_BACK = 1 << 7,
+    ACTION_CAMERA_LEFT = 1 << 8,
+    ACTION_CAMERA_RIGHT = 1 << 9,
+    ACTION_CAMERA_UP = 1 << 10,
+    ACTION_CAMERA_DOWN = 1 << 11,
+    ACTION_ROTATE = 1 << 12
+};
+
+// everything the simulation owns; a tick only depends on the previous state and the actions
+struct SimState
+{
+    glm::vec3 shift;
+    glm::vec3 cameraPos;
+    glm::quat rotation;
+    bool pyramid; // which shape is shown, toggled by T
+    uint64_t tick;
+
+    SimState()
+    {
+        shift = glm::vec3(0, 0, 0);
+        cameraPos = glm::vec3(0, 0, 3.0f);
+        rotation = glm::quat(1.0f, 0, 0, 0);
+        pyramid = false;
+        tick = 0;
+    }
+};
+
+// one fixed step; the deltas are the old per-frame ones, so at 60 ticks/s it moves as fast as vsync did
+inline void simulate(SimState &state, unsigned int actions)
+{
+    const float step = 0.02f, angle = 0.05f;
+    if (actions & ACTION_SHIFT_UP)
+        state.shift.y += step;
+    if (actions & ACTION_SHIFT_DOWN)
+        state.shift.y -= step;
+    if (actions & ACTION_SHIFT_LEFT)
+        state.shift.x -= step;
+    if (actions & ACTION_SHIFT_RIGHT)
+        state.shift.x += step;
+    if (actions & ACTION_SHIFT_FAR)
+        state.shift.z -= step;
+    if (actions & ACTION_SHIFT_NEAR)
+        state.shift.z += step;
+    if (actions & ACTION_CAMERA_FORWARD)
+        state.cameraPos.z -= step;
+    if (actions & ACTION_CAMERA_BACK)
+        state.cameraPos.z += step;
+    if (actions & ACTION_CAMERA_LEFT)
+        state.cameraPos.x -= step;
+    if (actions & ACTION_CAMERA_RIGHT)
+        state.cameraPos.x += step;
+    if (actions & ACTION_CAMERA_UP)
+        state.cameraPos.y += step;
+    if (actions & ACTION_CAMERA_DOWN)
+        state.cameraPos.y -= step;
+    if (actions & ACTION_ROTATE)
+        state.rotation = glm::normalize(state.rotation * glm::angleAxis(angle, glm::vec3(1, 0, 0)));
+    state.tick++;
+}
+
+inline void toggleShape(SimState &state)
+{
+    state.pyramid = !state.pyramid;
+}
+
+// maps keys to held actions and to press handlers; fed the queued input messages
+// in timestamp order on the simulation thread, so edges are exact and a tap shorter
+// than a tick still moves things for one tick
+class InputBindings
+{
+public:
+    typedef void (*PressHandler)(SimState &state);
+
+    struct Binding
+    {
+        int key;
+        unsigned int action;  // held while the key is down, 0 for none
+        PressHandler onPress; // once per press, NULL for none
+    };
+
+    std::vector<Binding> table;
+    unsigned int held;    // actions whose keys are down
+    unsigned int latched; // pressed since the last tick
+    float cursorX, cursorY, scrollX, scrollY;
+
+    InputBindings()
+    {
+        held = latched = 0;
+        cursorX = cursorY = scrollX = scrollY = 0.0f;
+    }
+
+    void bindHeld(int key, unsigned int action)
+    {
+        Binding binding = {key, action, NULL};
+        table.push_back(binding);
+    }
+
+    void bindPress(int key, PressHandler handler)
+    {
+        Binding binding = {key, 0, handler};
+        table.push_back(binding);
+    }
+
+    // key actions use GLFW's values: 0 release, 1 press, 2 repeat
+    void apply(const InputMessage &message, SimState &state)
+    {
+        switch (message.type)
+        {
+        case InputMessage::KEY:
+            for (unsigned int i = 0; i < table.size(); i++)
+            {
+                if (table[i].key != message.key)
+                    continue;
+                if (message.action == 1)
+                {
+                    held |= table[i].action;
+                    latched |= table[i].action;
+                    if (table[i].onPress)
+                        table[i].onPress(state);
+                }
+                else if (message.action == 0)
+                    held &= ~table[i].action;
+            }
+            break;
+        case InputMessage::CURSOR:
+            cursorX = message.x;
+            cursorY = message.y;
+            break;
+        case InputMessage::SCROLL:
+            scrollX += message.x;
+            scrollY += message.y;
+            break;
+        }
+    }
+
+    // actions for the coming tick
+    unsigned int consume()
+    {
+        unsigned int actions = held | latched;
+        latched = 0;
+        return actions;
+    }
+};
+
+// render state between two ticks, alpha in [0, 1)
+inline SimState interpolate(const SimState &previous, const SimState &current, float alpha)
+{
+    SimState state = current;
+    state.shift = glm::mix(previous.shift, current.shift, alpha);
+    state.cameraPos = glm::mix(previous.cameraPos, current.cameraPos, alpha);
+    state.rotation = glm::slerp(previous.rotation, current.rotation, alpha);
+    return state;
+}
+
+// same pose, i.e. the same picture
+inline bool samePose(const SimState &a, const SimState &b)
+{
+    return a.shift == b.shift && a.cameraPos == b.cameraPos && a.rotation == b.rotation && a.pyramid == b.pyramid;
+}
+
+// fixed-rate clock on raw timer values (glfwGetTimerValue), integer so that it never drifts
+class FixedTimestep
+{
+public:
+    uint64_t frequency; // timer ticks per second
+    uint64_t tickLength;
+    uint64_t accumulator;
+    uint64_t last;
+    int maxSteps;          // catch-up limit per frame; time beyond it is dropped
+    uint64_t droppedTicks; // how often that happened, in simulation ticks
+
+    FixedTimestep(uint64_t timerFrequency, unsigned int ticksPerSecond, int maxCatchUp)
+    {
+        frequency = timerFrequency;
+        tickLength = timerFrequency / ticksPerSecond;
+        maxSteps = maxCatchUp;
+        accumulator = 0;
+        last = 0;
+        droppedTicks = 0;
+    }
+
+    void start(uint64_t now)
+    {
+        last = now;
+        accumulator = 0;
+    }
+
+    // number of ticks to simulate this frame
+    int advance(uint64_t now)
+    {
+        accumulator += now - last;
+        last = now;
+        uint64_t steps = accumulator / tickLength;
+        if (steps > (uint64_t)maxSteps)
+        {
+            // a stall (breakpoint, window drag, slow frame): slow down instead of spiralling
+            droppedTicks += steps - maxSteps;
+            accumulator %= tickLength;
+            return maxSteps;
+        }
+        accumulator -= steps * tickLength;
+        return (int)steps;
+    }
+
+    float alpha() const { return (float)((double)accumulator / (double)tickLength); }
+
+    double seconds() const { return (double)tickLength / (double)frequency; }
+};
+
+// what the simulation thread publishes after each batch of ticks: the last two
+// states and when the newer one became due, so the renderer can interpolate
+struct SimSnapshot
+{
+    SimState previous, current;
+    uint64_t tickTime;
+
+    SimSnapshot() { tickTime = 0; }
+};
+
+// runs simulate() on its own thread at a fixed rate; the input callbacks post to it
+// and the render thread reads back the newest snapshot, neither ever blocks the other
+class SimulationThread
+{
+public:
+    typedef uint64_t (*TimerFunction)();
+
+    SpscRing<InputMessage, 1024> input; // pushed by post(), drained every tick
+    InputBindings bindings;             // set up before start(), then simulation thread only
+    void (*onPublish)();                // called on the simulation thread when the pose changed
+    std::atomic<uint64_t> ticks;        // simulated so far, for stats
+    FixedTimestep timestep;             // owned by the simulation thread once started
+
+    // timer is glfwGetTimerValue or anything else counting timerFrequency per second
+    SimulationThread(TimerFunction timer, uint64_t timerFrequency, unsigned int ticksPerSecond, int maxCatchUp)
+        : timestep(timerFrequency, ticksPerSecond, maxCatchUp)
+    {
+        timerValue = timer;
+        onPublish = NULL;
+        lastActions = 0;
+        ticks.store(0);
+        running.store(false);
+    }
+
+    ~SimulationThread() { stop(); }
+
+    // without a thread, the owner calls update() itself, e.g. once per replayed frame
+    void start(const SimState &initial = SimState(), bool threaded = true)
+    {
+        if (running.load())
+            return;
+        state = previous = published = initial;
+        lastActions = 0;
+        SimSnapshot &snapshot = snapshots.writeBuffer();
+        snapshot.previous = snapshot.current = initial;
+        snapshot.tickTime = timerValue();
+        snapshots.publish();
+        timestep.start(snapshot.tickTime);
+        running.store(true);
+        if (threaded)
+            thread = std::thread(&SimulationThread::run, this);
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            running.store(false);
+        }
+        idle.notify_one();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // input thread (the GLFW callbacks): queue a message and wake a parked simulation
+    void post(const InputMessage &message)
+    {
+        input.push(message);
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idle.notify_one();
+    }
+
+    // run the ticks that are due and publish them; the thread's loop body
+    void update()
+    {
+        uint64_t now = timerValue();
+        int steps = timestep.advance(now);
+        if (!steps)
+            return;
+        uint64_t tickTime = now - timestep.accumulator - (steps - 1) * timestep.tickLength;
+        for (int i = 0; i < steps; i++, tickTime += timestep.tickLength)
+        {
+            previous = state;
+            // everything that happened up to this tick, in order
+            for (const InputMessage *message = input.peek(); message && message->time <= tickTime; message = input.peek())
+            {
+                bindings.apply(*message, state);
+                input.pop();
+            }
+            lastActions = bindings.consume();
+            simulate(state, lastActions);
+        }
+        SimSnapshot &snapshot = snapshots.writeBuffer();
+        snapshot.previous = previous;
+        snapshot.current = state;
+        snapshot.tickTime = tickTime - timestep.tickLength;
+        snapshots.publish();
+        ticks.fetch_add(steps, std::memory_order_relaxed);
+        if (!samePose(published, state))
+        {
+            published = state;
+            if (onPublish)
+                onPublish();
+        }
+    }
+
+    // render thread: the newest published state, interpolated for a frame shown at 'now';
+    // rendering trails the simulation by at most one tick
+    SimState sample(uint64_t now)
+    {
+        snapshots.update();
+        const SimSnapshot &snapshot = snapshots.readBuffer();
+        double alpha = now > snapshot.tickTime ? (double)(now - snapshot.tickTime) / (double)timestep.tickLength : 0.0;
+        return interpolate(snapshot.previous, snapshot.current, (float)std::min(alpha, 1.0));
+    }
+
+    // render thread: the newest published state without interpolation
+    SimState latest()
+    {
+        snapshots.update();
+        return snapshots.readBuffer().current;
+    }
+
+private:
+    TimerFunction timerValue;
+    std::atomic<bool> running;
+    std::thread thread;
+    TripleBuffer<SimSnapshot> snapshots;
+    SimState state, previous, published; // simulation thread only
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    unsigned int lastActions;
+
+    void run()
+    {
+        while (running.load(std::memory_order_relaxed))
+        {
+            update();
+
+            // nothing held and the last tick moved nothing: the published state is final,
+            // so park instead of ticking until input arrives
+            if (!lastActions && input.empty())
+            {
+                std::unique_lock<std::mutex> lock(idleMutex);
+                while (running.load() && input.empty())
+                    idle.wait(lock);
+                lock.unlock();
+                timestep.start(timerValue());
+                continue;
+            }
+
+            // sleep until the next tick is due
+            uint64_t remaining = timestep.tickLength - timestep.accumulator;
+            std::this_thread::sleep_for(std::chrono::microseconds(remaining * 1000000 / timestep.frequency));
+        }
+    }
+};
+
+#endif
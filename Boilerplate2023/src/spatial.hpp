@@ -0,0 +1,352 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// the six clip planes of a view-projection matrix (Gribb & Hartmann), normals pointing inwards
+class Frustum
+{
+public:
+    enum Result
+    {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    Frustum(const glm::mat4 &viewProjection)
+    {
+        // rows of the matrix, glm is column major
+        glm::vec4 row[4];
+        for (int r = 0; r < 4; r++)
+            row[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        planes[0] = row[3] + row[0]; // left
+        planes[1] = row[3] - row[0]; // right
+        planes[2] = row[3] + row[1]; // bottom
+        planes[3] = row[3] - row[1]; // top
+        planes[4] = row[3] + row[2]; // near
+        planes[5] = row[3] - row[2]; // far
+        for (int p = 0; p < 6; p++)
+            planes[p] /= glm::length(glm::vec3(planes[p]));
+    }
+
+    // test a box against the planes whose bit is set in mask; planes the box is
+    // completely inside of are cleared so the children of a tree node can skip them
+    Result classify(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int &mask) const
+    {
+        for (int p = 0; p < 6; p++)
+        {
+            if (!(mask & (1u << p)))
+                continue;
+            glm::vec3 n(planes[p]);
+            // the corner furthest along the normal and the one furthest against it
+            glm::vec3 positive(n.x >= 0 ? boundsMax.x : boundsMin.x, n.y >= 0 ? boundsMax.y : boundsMin.y, n.z >= 0 ? boundsMax.z : boundsMin.z);
+            glm::vec3 negative(n.x >= 0 ? boundsMin.x : boundsMax.x, n.y >= 0 ? boundsMin.y : boundsMax.y, n.z >= 0 ? boundsMin.z : boundsMax.z);
+            if (glm::dot(n, positive) + planes[p].w < 0.0f)
+                return OUTSIDE;
+            if (glm::dot(n, negative) + planes[p].w >= 0.0f)
+                mask &= ~(1u << p);
+        }
+        return mask ? INTERSECTS : INSIDE;
+    }
+};
+
+// world AABB of an object-space box under an affine transform
+inline void transformBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model, glm::vec3 &outMin, glm::vec3 &outMax)
+{
+    glm::vec3 center = glm::vec3(model * glm::vec4(0.5f * (boundsMin + boundsMax), 1.0f));
+    glm::vec3 extent = 0.5f * (boundsMax - boundsMin);
+    glm::vec3 worldExtent;
+    for (int r = 0; r < 3; r++)
+        worldExtent[r] = std::fabs(model[0][r]) * extent.x + std::fabs(model[1][r]) * extent.y + std::fabs(model[2][r]) * extent.z;
+    outMin = center - worldExtent;
+    outMax = center + worldExtent;
+}
+
+// dynamic AABB tree: leaves hold fattened object bounds, internal nodes are kept
+// height balanced by rotations, so insert, remove and move are O(log n). A moving
+// object only touches the tree once it leaves its fat box.
+class AABBTree
+{
+public:
+    static const int NULL_NODE = -1;
+
+    struct Node
+    {
+        glm::vec3 boundsMin, boundsMax;
+        int parent; // next free node while on the free list
+        int child1, child2;
+        int height; // 0 for leaves, -1 when free
+        unsigned int object;
+
+        bool isLeaf() const { return child1 == NULL_NODE; }
+    };
+
+    std::vector<Node> nodes;
+    int root;
+    float margin; // how far leaf boxes are fattened on each side
+
+    AABBTree(float fatMargin = 0.05f)
+    {
+        root = NULL_NODE;
+        freeList = NULL_NODE;
+        margin = fatMargin;
+        proxies = 0;
+    }
+
+    // returns the proxy id used to move or remove the object later
+    int createProxy(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int object)
+    {
+        int proxy = allocateNode();
+        nodes[proxy].boundsMin = boundsMin - glm::vec3(margin);
+        nodes[proxy].boundsMax = boundsMax + glm::vec3(margin);
+        nodes[proxy].object = object;
+        nodes[proxy].height = 0;
+        insertLeaf(proxy);
+        proxies++;
+        return proxy;
+    }
+
+    void destroyProxy(int proxy)
+    {
+        removeLeaf(proxy);
+        freeNode(proxy);
+        proxies--;
+    }
+
+    // returns true if the object left its fat box and was reinserted
+    bool moveProxy(int proxy, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        Node &node = nodes[proxy];
+        if (glm::all(glm::lessThanEqual(node.boundsMin, boundsMin)) && glm::all(glm::lessThanEqual(boundsMax, node.boundsMax)))
+            return false;
+        removeLeaf(proxy);
+        nodes[proxy].boundsMin = boundsMin - glm::vec3(margin);
+        nodes[proxy].boundsMax = boundsMax + glm::vec3(margin);
+        insertLeaf(proxy);
+        return true;
+    }
+
+    // append the objects whose fat boxes touch the frustum; subtrees entirely inside
+    // are collected without further plane tests
+    void query(const Frustum &frustum, std::vector<unsigned int> &visible) const
+    {
+        if (root == NULL_NODE)
+            return;
+        // balanced, so the height stays far below this even for millions of objects
+        int stack[256];
+        unsigned int masks[256];
+        int top = 0;
+        stack[top] = root;
+        masks[top++] = 0x3f;
+        while (top)
+        {
+            top--;
+            int index = stack[top];
+            unsigned int mask = masks[top];
+            const Node &node = nodes[index];
+            Frustum::Result result = mask ? frustum.classify(node.boundsMin, node.boundsMax, mask) : Frustum::INSIDE;
+            if (result == Frustum::OUTSIDE)
+                continue;
+            if (node.isLeaf())
+            {
+                visible.push_back(node.object);
+                continue;
+            }
+            stack[top] = node.child1;
+            masks[top++] = mask;
+            stack[top] = node.child2;
+            masks[top++] = mask;
+        }
+    }
+
+    unsigned int size() const { return proxies; }
+
+    int height() const { return root == NULL_NODE ? 0 : nodes[root].height; }
+
+private:
+    int freeList;
+    unsigned int proxies;
+
+    static float surfaceArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        glm::vec3 d = boundsMax - boundsMin;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    int allocateNode()
+    {
+        if (freeList == NULL_NODE)
+        {
+            nodes.push_back(Node());
+            nodes.back().height = -1;
+            freeList = nodes.size() - 1;
+            nodes.back().parent = NULL_NODE;
+        }
+        int index = freeList;
+        freeList = nodes[index].parent;
+        nodes[index].parent = NULL_NODE;
+        nodes[index].child1 = NULL_NODE;
+        nodes[index].child2 = NULL_NODE;
+        nodes[index].height = 0;
+        nodes[index].object = 0;
+        return index;
+    }
+
+    void freeNode(int index)
+    {
+        nodes[index].parent = freeList;
+        nodes[index].height = -1;
+        freeList = index;
+    }
+
+    void refit(int index)
+    {
+        Node &node = nodes[index];
+        const Node &a = nodes[node.child1], &b = nodes[node.child2];
+        node.boundsMin = glm::min(a.boundsMin, b.boundsMin);
+        node.boundsMax = glm::max(a.boundsMax, b.boundsMax);
+        node.height = 1 + std::max(a.height, b.height);
+    }
+
+    void insertLeaf(int leaf)
+    {
+        if (root == NULL_NODE)
+        {
+            root = leaf;
+            nodes[root].parent = NULL_NODE;
+            return;
+        }
+
+        // descend towards the sibling with the lowest surface area increase
+        glm::vec3 leafMin = nodes[leaf].boundsMin, leafMax = nodes[leaf].boundsMax;
+        int index = root;
+        while (!nodes[index].isLeaf())
+        {
+            const Node &node = nodes[index];
+            float area = surfaceArea(node.boundsMin, node.boundsMax);
+            float combinedArea = surfaceArea(glm::min(node.boundsMin, leafMin), glm::max(node.boundsMax, leafMax));
+            // pairing with this node creates a parent of combinedArea; going down
+            // still grows this node by the difference
+            float cost = 2.0f * combinedArea;
+            float inheritance = 2.0f * (combinedArea - area);
+
+            float childCost[2];
+            int children[2] = {node.child1, node.child2};
+            for (int c = 0; c < 2; c++)
+            {
+                const Node &child = nodes[children[c]];
+                float enlarged = surfaceArea(glm::min(child.boundsMin, leafMin), glm::max(child.boundsMax, leafMax));
+                childCost[c] = (child.isLeaf() ? enlarged : enlarged - surfaceArea(child.boundsMin, child.boundsMax)) + inheritance;
+            }
+            if (cost < childCost[0] && cost < childCost[1])
+                break;
+            index = childCost[0] < childCost[1] ? children[0] : children[1];
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent == NULL_NODE)
+            root = newParent;
+        else if (nodes[oldParent].child1 == sibling)
+            nodes[oldParent].child1 = newParent;
+        else
+            nodes[oldParent].child2 = newParent;
+
+        for (index = newParent; index != NULL_NODE; index = nodes[index].parent)
+        {
+            index = balance(index);
+            refit(index);
+        }
+    }
+
+    void removeLeaf(int leaf)
+    {
+        if (leaf == root)
+        {
+            root = NULL_NODE;
+            return;
+        }
+
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        freeNode(parent);
+        if (grandParent == NULL_NODE)
+        {
+            root = sibling;
+            nodes[sibling].parent = NULL_NODE;
+            return;
+        }
+
+        if (nodes[grandParent].child1 == parent)
+            nodes[grandParent].child1 = sibling;
+        else
+            nodes[grandParent].child2 = sibling;
+        nodes[sibling].parent = grandParent;
+        for (int index = grandParent; index != NULL_NODE; index = nodes[index].parent)
+        {
+            index = balance(index);
+            refit(index);
+        }
+    }
+
+    // if one child of a is more than one level taller, rotate it up; returns the subtree root
+    int balance(int a)
+    {
+        if (nodes[a].isLeaf() || nodes[a].height < 2)
+            return a;
+        int b = nodes[a].child1, c = nodes[a].child2;
+        int difference = nodes[c].height - nodes[b].height;
+        if (difference > 1)
+            return rotate(a, c, false);
+        if (difference < -1)
+            return rotate(a, b, true);
+        return a;
+    }
+
+    // lift child 'up' of a into a's place; a keeps its other child and the shorter grandchild
+    int rotate(int a, int up, bool upIsChild1)
+    {
+        int f = nodes[up].child1, g = nodes[up].child2;
+        nodes[up].child1 = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+
+        int parent = nodes[up].parent;
+        if (parent == NULL_NODE)
+            root = up;
+        else if (nodes[parent].child1 == a)
+            nodes[parent].child1 = up;
+        else
+            nodes[parent].child2 = up;
+
+        int taller = nodes[f].height > nodes[g].height ? f : g;
+        int shorter = taller == f ? g : f;
+        nodes[up].child2 = taller;
+        if (upIsChild1)
+            nodes[a].child1 = shorter;
+        else
+            nodes[a].child2 = shorter;
+        nodes[shorter].parent = a;
+
+        refit(a);
+        refit(up);
+        return up;
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bc.hpp"
+#include "imaging.hpp"
+#include "mappedfile.hpp"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// content hash for cache keys: 64-bit FNV-1a run over four interleaved lanes of
+// 8-byte words so it keeps up with the page cache, the tail a byte at a time, the
+// lanes folded together at the end. Any single changed word changes the hash.
+inline uint64_t fnv1a64(const unsigned char *data, size_t size)
+{
+    const uint64_t basis = 14695981039346656037ull, prime = 1099511628211ull;
+    uint64_t lane[4] = {basis, basis + 1, basis + 2, basis + 3};
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+        for (int k = 0; k < 4; k++)
+        {
+            uint64_t word;
+            memcpy(&word, data + i + 8 * k, 8);
+            lane[k] = (lane[k] ^ word) * prime;
+        }
+    for (; i < size; i++)
+        lane[0] = (lane[0] ^ data[i]) * prime;
+    uint64_t hash = basis ^ size;
+    for (int k = 0; k < 4; k++)
+        for (int b = 0; b < 64; b += 8)
+            hash = (hash ^ ((lane[k] >> b) & 0xff)) * prime;
+    return hash;
+}
+
+// where the baked form of a source image lives, named after the source's path; the
+// header's content hash says whether it is still current
+inline std::string bakedTexturePath(const std::string &directory, const std::string &source)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.btex", (unsigned long long)fnv1a64((const unsigned char *)source.data(), source.size()));
+    return directory + name;
+}
+
+inline bool makeDirectory(const std::string &directory)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(directory.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    struct stat info;
+    return mkdir(directory.c_str(), 0755) == 0 || (stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode));
+#endif
+}
+
+// a baked texture file: this header, then every mip level, each at its offset (16-byte
+// aligned) in its final form, for glTexImage2D with rows tightly packed or, when
+// blockBytes isn't 0, for glCompressedTexImage2D
+struct BakedTextureHeader
+{
+    enum
+    {
+        VERSION = 4,
+        MAX_LEVELS = 16
+    };
+
+    char magic[4]; // "BTEX"
+    uint32_t version;
+    uint64_t sourceHash, sourceSize; // of the image file it was baked from
+    uint32_t width, height, channels, levels;
+    uint32_t color; // the ImageColor the levels were filtered as
+    uint32_t internalFormat, format, type;
+    uint32_t blockBytes; // per 4x4 block when compressed
+    uint64_t offset[MAX_LEVELS], size[MAX_LEVELS];
+};
+
+// a baked texture, either mapped read-only from the cache or baked in memory; level
+// pointers go straight to the GL
+class BakedTexture
+{
+public:
+    BakedTexture() { header = NULL; }
+
+    // false if the file is missing, damaged or was baked from other content
+    bool open(const std::string &path, uint64_t sourceHash, uint64_t sourceSize)
+    {
+        header = NULL;
+        if (!file.open(path.c_str()) || file.size < sizeof(BakedTextureHeader))
+            return false;
+        const BakedTextureHeader *h = (const BakedTextureHeader *)file.data;
+        if (memcmp(h->magic, "BTEX", 4) || h->version != BakedTextureHeader::VERSION || h->sourceHash != sourceHash ||
+            h->sourceSize != sourceSize || h->levels == 0 || h->levels > BakedTextureHeader::MAX_LEVELS)
+            return false;
+        for (unsigned int i = 0; i < h->levels; i++)
+            if (h->offset[i] > file.size || h->size[i] > file.size - h->offset[i] || h->size[i] != levelBytes(h, i))
+                return false;
+        header = h;
+        return true;
+    }
+
+    // bakes an 8-bit image with 1 to 4 channels and its mip chain, each level Kaiser
+    // filtered from the one before as color says (imaging.hpp): colour in linear light,
+    // data such as normal maps channel by channel; block compressed to
+    // bcFormatFor(channels) if compress
+    void bake(const unsigned char *pixels, int width, int height, int channels, ImageColor color, bool compress, uint64_t sourceHash,
+              uint64_t sourceSize)
+    {
+        static const GLenum formats[5] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        static const GLenum internalFormats[5] = {0, GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+        BakedTextureHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "BTEX", 4);
+        h.version = BakedTextureHeader::VERSION;
+        h.sourceHash = sourceHash;
+        h.sourceSize = sourceSize;
+        h.width = width;
+        h.height = height;
+        h.channels = channels;
+        h.color = color;
+        h.format = formats[channels];
+        h.internalFormat = compress ? bcInternalFormat(bcFormatFor(channels)) : internalFormats[channels];
+        h.type = GL_UNSIGNED_BYTE;
+        h.blockBytes = compress ? bcBlockBytes(bcFormatFor(channels)) : 0;
+        h.levels = 1;
+        while ((width >> h.levels | height >> h.levels) && h.levels < BakedTextureHeader::MAX_LEVELS)
+            h.levels++;
+        uint64_t offset = sizeof(h);
+        for (unsigned int i = 0; i < h.levels; i++)
+        {
+            h.offset[i] = offset;
+            h.size[i] = levelBytes(&h, i);
+            offset = (offset + h.size[i] + 15) & ~(uint64_t)15;
+        }
+        file.close();
+        memory.assign(h.offset[h.levels - 1] + h.size[h.levels - 1], 0);
+        memcpy(&memory[0], &h, sizeof(h));
+        header = (const BakedTextureHeader *)&memory[0];
+
+        std::vector<unsigned char> levels[2];
+        const unsigned char *level = pixels;
+        for (unsigned int i = 0; i < h.levels; i++)
+        {
+            if (i > 0)
+            {
+                std::vector<unsigned char> &next = levels[i & 1];
+                next.resize((size_t)levelWidth(i) * levelHeight(i) * channels);
+                downsampleImage(level, levelWidth(i - 1), levelHeight(i - 1), channels, &next[0], FILTER_KAISER, color);
+                level = &next[0];
+            }
+            if (compress)
+                bcCompress(level, levelWidth(i), levelHeight(i), channels, bcFormatFor(channels), BC_HIGH, &memory[h.offset[i]]);
+            else
+                memcpy(&memory[h.offset[i]], level, h.size[i]);
+        }
+    }
+
+    // writes a baked texture to path, through a temporary file renamed into place so no
+    // reader ever maps half of one
+    bool save(const std::string &path) const
+    {
+        std::string temporary = path + ".tmp";
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (!out)
+            return false;
+        size_t size = header->offset[header->levels - 1] + header->size[header->levels - 1];
+        bool ok = fwrite(header, 1, size, out) == size;
+        ok = fclose(out) == 0 && ok;
+        if (ok)
+        {
+            remove(path.c_str());
+            ok = rename(temporary.c_str(), path.c_str()) == 0;
+        }
+        if (!ok)
+            remove(temporary.c_str());
+        return ok;
+    }
+
+    int width() const { return header->width; }
+    int height() const { return header->height; }
+    int channels() const { return header->channels; }
+    ImageColor color() const { return (ImageColor)header->color; }
+    int levels() const { return header->levels; }
+    GLenum format() const { return header->format; }
+    GLenum internalFormat() const { return header->internalFormat; }
+    bool compressed() const { return header->blockBytes != 0; }
+    int levelWidth(int level) const { return levelWidth(header, level); }
+    int levelHeight(int level) const { return levelHeight(header, level); }
+    const unsigned char *level(int level) const { return (const unsigned char *)header + header->offset[level]; }
+    size_t levelSize(int level) const { return header->size[level]; }
+    // what a streamed upload splits a level into: rows, or one piece when compressed
+    int levelRows(int level) const { return compressed() ? 1 : levelHeight(level); }
+    size_t levelRowBytes(int level) const { return compressed() ? levelSize(level) : (size_t)levelWidth(level) * header->channels; }
+
+    // every level, what the uploads add up to
+    uint64_t bytes() const
+    {
+        uint64_t total = 0;
+        for (unsigned int i = 0; i < header->levels; i++)
+            total += header->size[i];
+        return total;
+    }
+
+    // GL thread, texture bound: level's storage and, unless pixels is NULL, its contents;
+    // the pixels may be an offset into a bound GL_PIXEL_UNPACK_BUFFER. Compressed levels
+    // always come with their contents.
+    void specifyLevel(int level, const void *pixels) const
+    {
+        if (compressed())
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, header->internalFormat, levelWidth(level), levelHeight(level), 0, (GLsizei)levelSize(level), pixels);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, header->internalFormat, levelWidth(level), levelHeight(level), 0, header->format, header->type, pixels);
+    }
+
+    // GL thread, after the last level: sample the baked chain instead of generating one
+    void finish() const
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, header->levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+private:
+    MappedFile file;
+    std::vector<unsigned char> memory;
+    const BakedTextureHeader *header;
+
+    static int levelWidth(const BakedTextureHeader *h, int level) { return h->width >> level ? h->width >> level : 1; }
+    static int levelHeight(const BakedTextureHeader *h, int level) { return h->height >> level ? h->height >> level : 1; }
+
+    static uint64_t levelBytes(const BakedTextureHeader *h, int level)
+    {
+        uint64_t w = levelWidth(h, level), hgt = levelHeight(h, level);
+        return h->blockBytes ? (w + 3) / 4 * ((hgt + 3) / 4) * h->blockBytes : w * hgt * h->channels;
+    }
+
+    BakedTexture(const BakedTexture &);
+    BakedTexture &operator=(const BakedTexture &);
+};
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef TEXTURES_H
+#define TEXTURES_H
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stb_image.h>
+#include "jobs.hpp"
+#include "loader.hpp"
+#include "mappedfile.hpp"
+#include "hdr.hpp"
+#include "pbo.hpp"
+#include "texcache.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <iostream>
+
+// the regular files in a directory, sorted, with the directory prefixed
+inline std::vector<std::string> listFiles(const std::string &directory)
+{
+    std::vector<std::string> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &entry);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+            if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                files.push_back(directory + "\\" + entry.cFileName);
+        while (FindNextFileA(find, &entry));
+        FindClose(find);
+    }
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string path = directory + "/" + entry->d_name;
+            struct stat info;
+            if (entry->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+                files.push_back(path);
+        }
+        closedir(dir);
+    }
+#endif
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// stb_image's parallel_for on a JobSystem (stbi_set_parallel_for(stbiParallelFor, &jobs)),
+// so big JPEGs spread over the workers; from inside a job it nests like any parallelFor
+inline void stbiParallelFor(void *jobs, int count, stbi_parallel_task *task, void *taskContext)
+{
+    ((JobSystem *)jobs)->parallelFor(0, count, [task, taskContext](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++)
+            task(taskContext, i);
+    });
+}
+
+struct DecodedImage
+{
+    unsigned int index; // position in the batch
+    int width, height, channels;
+    std::vector<unsigned char> pixels;    // level 0, or empty when baked
+    std::shared_ptr<BakedTexture> baked; // every level, mapped from the cache or baked in memory
+    std::shared_ptr<HdrImage> hdr;       // a Radiance file, not decoded yet
+};
+
+// loads a batch of image files: each file is mapped and decoded as its own job,
+// straight into the image's pixel vector with stbi_load_into_from_memory, the
+// decoder's intermediate buffers coming from a scratch arena per worker thread
+// that grows to the biggest image seen, so a warm decode doesn't touch the heap
+// beyond the pixels it hands on. The decoded images queue up for the GL
+// thread, which hands them to the ResourceLoader or streams them through a
+// PboUploader in submit(). Any format stb_image reads, always 8 bits per channel.
+//
+// With a cacheDirectory, each image is baked there on first load, its whole mip
+// chain in GL's format, and later loads map that file instead of decoding: the
+// source is only read to check its content hash against the one baked in, and the
+// levels go to the GL straight from the mapping, so a warm start is bound by I/O.
+//
+// With cpuMipmaps, every image is baked on its worker with the whole mip chain filtered
+// in linear light (imaging.hpp) instead of glGenerateMipmap on the GL thread, which
+// averages sRGB values as they are and differs between drivers. It's off by default:
+// the Kaiser chain costs the workers more than the decode itself (--bench textures),
+// where the GL's is next to free, so it's for when quality is worth the time. Images
+// load() is told hold data (normal maps, masks) are filtered channel by channel
+// instead, with no sRGB curve and no alpha; the cache keeps which way each was baked.
+// With compress, images are baked with every level block compressed (bc.hpp) and
+// upload at a quarter to an eighth of the bytes; cached or not, the cache holding
+// them compressed so the encoder only runs once.
+//
+// Radiance .hdr files skip all of that: the worker only opens them, and they decode
+// to GL_RGB16F half floats as they upload (hdr.hpp), through the PBO ring a band of
+// scanlines at a time.
+class TextureLoader
+{
+public:
+    JobSystem *jobs;
+    int channels;         // forced channel count, 0 keeps each file's own
+    void (*onDecoded)();  // called on the decoding worker after each image
+    std::string cacheDirectory; // baked textures, none if empty; set before load()
+    bool compress;              // block compress every level; check bcSupported() first
+    bool cpuMipmaps;            // bake the mip chain on the workers rather than glGenerateMipmap; off by default
+    std::vector<std::string> paths;
+    std::vector<ImageColor> colors;      // per path, what its channels hold
+    std::vector<GpuResource *> textures; // per path, NULL until submitted to a ResourceLoader
+    std::vector<unsigned int> names;     // per path, the texture once it can be bound, else 0
+    std::atomic<unsigned int> decoded, failed, cacheHits, cacheBakes;
+    std::atomic<uint64_t> fileBytes, pixelBytes;
+
+    TextureLoader(JobSystem *jobSystem)
+    {
+        jobs = jobSystem;
+        channels = 4;
+        onDecoded = NULL;
+        compress = false;
+        cpuMipmaps = false;
+        decoded.store(0);
+        failed.store(0);
+        cacheHits.store(0);
+        cacheBakes.store(0);
+        fileBytes.store(0);
+        pixelBytes.store(0);
+        submitted = uploaded = 0;
+        started = decodeEnd = firstSubmit = uploadEnd = 0.0;
+    }
+
+    ~TextureLoader() { wait(); }
+
+    // queue the whole batch and return; call once per loader. fileColors says what each
+    // file's channels hold, IMAGE_SRGB colour for any it doesn't cover.
+    void load(const std::vector<std::string> &files, const std::vector<ImageColor> &fileColors = std::vector<ImageColor>())
+    {
+        paths = files;
+        colors = fileColors;
+        colors.resize(paths.size(), IMAGE_SRGB);
+        textures.assign(paths.size(), (GpuResource *)NULL);
+        names.assign(paths.size(), 0);
+        if (!cacheDirectory.empty() && !makeDirectory(cacheDirectory))
+        {
+            std::cout << "ERROR::TEXTURE::CANNOT_CREATE_CACHE: " << cacheDirectory << std::endl;
+            cacheDirectory.clear();
+        }
+        started = seconds();
+        for (unsigned int i = 0; i < paths.size(); i++)
+            jobs->run([this, i]() { decode(i); }, &pending);
+    }
+
+    // every file has been decoded or failed
+    bool decodingDone() const { return decoded.load() + failed.load() == paths.size(); }
+
+    // block until decodingDone(), helping with the decoding
+    void wait() { jobs->wait(pending); }
+
+    // a decoded image, if any is waiting; for callers that don't go through submit()
+    bool take(DecodedImage &image)
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        if (finished.empty())
+            return false;
+        image = std::move(finished.front());
+        finished.pop_front();
+        return true;
+    }
+
+    // GL thread: hand the decoded images to the uploader and check on earlier ones;
+    // true once every texture of the batch is ready to bind
+    bool submit(ResourceLoader &uploader)
+    {
+        DecodedImage image;
+        while (take(image))
+        {
+            if (!submitted++)
+                firstSubmit = seconds();
+            if (image.hdr)
+                textures[image.index] = uploader.uploadTexture(image.hdr);
+            else if (image.baked)
+                textures[image.index] = uploader.uploadTexture(image.baked);
+            else
+                textures[image.index] = uploader.uploadTexture(image.width, image.height, formats()[image.channels], image.pixels);
+        }
+        while (uploaded < paths.size() && (!textures[uploaded] ? failedPath(uploaded) : uploader.ready(textures[uploaded]) || uploader.failed(textures[uploaded])))
+        {
+            if (textures[uploaded])
+                names[uploaded] = textures[uploaded]->name;
+            uploaded++;
+        }
+        return finishUpload();
+    }
+
+    // render thread: the same through a PBO ring, one budget's worth per call
+    bool submit(PboUploader &uploader)
+    {
+        DecodedImage image;
+        while (take(image))
+        {
+            if (!submitted++)
+                firstSubmit = seconds();
+            streaming.resize(paths.size(), 0);
+            glGenTextures(1, &streaming[image.index]);
+            if (image.hdr)
+                uploader.enqueue(streaming[image.index], image.hdr, image.index);
+            else if (image.baked)
+                uploader.enqueue(streaming[image.index], image.baked, image.index);
+            else
+                uploader.enqueue(streaming[image.index], image.width, image.height, formats()[image.channels], image.pixels, image.index);
+        }
+        uploader.update();
+        unsigned int index;
+        while (uploader.finished(index))
+            names[index] = streaming[index];
+        while (uploaded < paths.size() && (names[uploaded] || failedPath(uploaded)))
+            uploaded++;
+        return finishUpload();
+    }
+
+    // GL thread, after the ResourceLoader stopped: every texture made for the batch
+    void deleteTextures()
+    {
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            unsigned int texture = textures[i] ? textures[i]->name : i < streaming.size() ? streaming[i] : 0;
+            if (texture)
+                glDeleteTextures(1, &texture);
+            names[i] = 0;
+        }
+    }
+
+    // decode and upload throughput of the batch
+    void report() const
+    {
+        double decodeSeconds = std::max(decodeEnd - started, 1e-9), uploadSeconds = std::max(uploadEnd - firstSubmit, 1e-9);
+        double mb = pixelBytes.load() / 1048576.0;
+        std::cout << "textures: " << decoded.load() << " decoded, " << failed.load() << " failed, "
+                  << fileBytes.load() / 1048576.0 << " MB of files to " << mb << " MB of pixels\n"
+                  << "  decode " << decodeSeconds * 1000.0 << " ms, " << mb / decodeSeconds << " MB/s on "
+                  << jobs->threadCount() << " threads";
+        if (!cacheDirectory.empty())
+            std::cout << "; cache " << cacheHits.load() << " hits, " << cacheBakes.load() << " baked";
+        if (uploadEnd > 0.0)
+            std::cout << "; upload " << uploadSeconds * 1000.0 << " ms, " << mb / uploadSeconds << " MB/s";
+        std::cout << std::endl;
+    }
+
+private:
+    JobCounter pending;
+    std::mutex finishedMutex;
+    std::deque<DecodedImage> finished;
+    std::vector<unsigned char> failures; // per path, set by the decoding job
+    std::vector<unsigned int> streaming;  // per path, the texture a PboUploader is filling
+    unsigned int submitted, uploaded;     // GL thread
+    double started, decodeEnd, firstSubmit, uploadEnd;
+
+    static const GLenum *formats()
+    {
+        static const GLenum byChannels[5] = {GL_RGBA, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        return byChannels;
+    }
+
+    bool finishUpload()
+    {
+        if (uploaded == paths.size() && uploadEnd == 0.0)
+            uploadEnd = seconds();
+        return uploaded == paths.size();
+    }
+
+    static double seconds()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool failedPath(unsigned int index)
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        return index < failures.size() && failures[index];
+    }
+
+    struct Scratch
+    {
+        std::vector<unsigned char> memory;
+        bool busy; // a decode under another on this thread, which only load() from inside a job allows
+    };
+
+    static Scratch &threadScratch()
+    {
+        static thread_local Scratch scratch = {std::vector<unsigned char>(), false};
+        return scratch;
+    }
+
+    void decode(unsigned int index)
+    {
+        DecodedImage image;
+        image.index = index;
+        MappedFile file;
+        bool loaded = false;
+        int fileChannels = 0;
+        uint64_t hash = 0;
+        std::string bakedPath;
+        bool opened = file.open(paths[index].c_str());
+        if (opened && stbi_is_hdr_from_memory(file.data, (int)file.size))
+        {
+            // stays RGBE until it uploads, as half floats
+            std::shared_ptr<HdrImage> hdr(new HdrImage());
+            if (hdr->open(paths[index].c_str()))
+            {
+                image.width = hdr->width();
+                image.height = hdr->height();
+                image.channels = 3;
+                image.hdr = hdr;
+                loaded = true;
+            }
+        }
+        else if (opened && !cacheDirectory.empty())
+        {
+            hash = fnv1a64(file.data, file.size);
+            bakedPath = bakedTexturePath(cacheDirectory, paths[index]);
+            std::shared_ptr<BakedTexture> baked(new BakedTexture());
+            if (baked->open(bakedPath, hash, file.size) && (!channels || baked->channels() == channels) && baked->compressed() == compress &&
+                baked->color() == colors[index])
+            {
+                image.width = baked->width();
+                image.height = baked->height();
+                image.channels = baked->channels();
+                image.baked = baked;
+                loaded = true;
+                cacheHits.fetch_add(1);
+            }
+        }
+        if (!loaded && file.data && stbi_info_from_memory(file.data, (int)file.size, &image.width, &image.height, &fileChannels))
+        {
+            image.channels = channels ? channels : fileChannels;
+            image.pixels.resize((size_t)image.width * image.height * image.channels);
+            Scratch &scratch = threadScratch();
+            stbi_scratch arena = {scratch.memory.empty() ? NULL : &scratch.memory[0], scratch.memory.size(), 0, 0, 0};
+            bool own = !scratch.busy;
+            scratch.busy = true;
+            loaded = stbi_load_into_from_memory(file.data, (int)file.size, &image.width, &image.height, &fileChannels, channels,
+                                                &image.pixels[0], image.pixels.size(), image.width * image.channels, own ? &arena : NULL) != 0;
+            if (own)
+            {
+                scratch.busy = false;
+                if (arena.peak > scratch.memory.size())
+                    scratch.memory.resize(arena.peak);
+            }
+        }
+        if (!loaded)
+        {
+            std::cout << "ERROR::TEXTURE::CANNOT_LOAD: " << paths[index] << " (" << (file.data ? stbi_failure_reason() : "cannot map file") << ")" << std::endl;
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            failures.resize(paths.size(), 0);
+            failures[index] = 1;
+            finish(failed);
+            return;
+        }
+        if (!image.baked && !image.hdr && (cpuMipmaps || compress || !bakedPath.empty()))
+        {
+            // bake it, mips and all, upload what was baked and keep it for next time
+            std::shared_ptr<BakedTexture> baked(new BakedTexture());
+            baked->bake(&image.pixels[0], image.width, image.height, image.channels, colors[index], compress, hash, file.size);
+            image.baked = baked;
+            std::vector<unsigned char>().swap(image.pixels);
+            if (!bakedPath.empty())
+            {
+                if (baked->save(bakedPath))
+                    cacheBakes.fetch_add(1);
+                else
+                    std::cout << "ERROR::TEXTURE::CANNOT_BAKE: " << bakedPath << std::endl;
+            }
+        }
+        fileBytes.fetch_add(file.size);
+        pixelBytes.fetch_add(image.hdr ? image.hdr->rowBytes() * image.height : (uint64_t)image.width * image.height * image.channels);
+
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished.push_back(std::move(image));
+        finish(decoded);
+    }
+
+    // finishedMutex held
+    void finish(std::atomic<unsigned int> &counter)
+    {
+        counter.fetch_add(1);
+        if (decodingDone())
+            decodeEnd = seconds();
+        if (onDecoded)
+            onDecoded();
+    }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// lock-free single producer / single consumer triple buffer: the writer fills its
+// back buffer and swaps it with the middle one, the reader swaps the middle one
+// with its front buffer when something new was published. Neither side ever waits,
+// and the reader always gets the most recent complete value.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+    {
+        back = 0;
+        middle.store(1);
+        front = 2;
+    }
+
+    // writer side
+    T &writeBuffer() { return buffers[back]; }
+
+    void publish()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // reader side: returns true if a newer value was picked up
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T &readBuffer() const { return buffers[front]; }
+
+private:
+    static const unsigned int INDEX = 3;
+    static const unsigned int FRESH = 4; // set while the middle buffer hasn't been read yet
+
+    T buffers[3];
+    unsigned int back;                // owned by the writer
+    std::atomic<unsigned int> middle; // index | FRESH
+    unsigned int front;               // owned by the reader
+};
+
+#endif
@@ -0,0 +1,698 @@
+#ifndef VTEX_H
+#define VTEX_H
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stb_image.h>
+#include "imaging.hpp"
+#include "jobs.hpp"
+#include "mappedfile.hpp"
+
+#include <iostream>
+
+// a virtual texture's tile file: this header, then from offset on every tile of
+// every level, finest first and row by row, each tileSize + 2 * border texels a side
+// of RGBA8 with its neighbours' texels (or its own edge, at the image's edge) in the
+// border so bilinear filtering inside a tile never needs another
+struct VirtualTextureHeader
+{
+    enum
+    {
+        VERSION = 1,
+        MAX_LEVELS = 16,
+        TILE_SIZE = 128,
+        BORDER = 4
+    };
+
+    char magic[4]; // "VTEX"
+    uint32_t version;
+    uint32_t width, height, levels;
+    uint32_t tileSize, border;
+    uint32_t tilesX[MAX_LEVELS], tilesY[MAX_LEVELS], firstTile[MAX_LEVELS];
+    uint64_t tileBytes, offset;
+};
+
+// writes pixels (RGBA8, power of two sides) as a tile file at path: the levels are
+// Kaiser filtered as color says (imaging.hpp), sRGB colour in linear light, down to
+// the one that fits a single tile. At most 4096 tiles a side, as many as the
+// feedback's 12-bit tile coordinates tell apart. Only this needs the whole image in
+// memory; it's meant to run offline.
+inline bool bakeVirtualTexture(const unsigned char *pixels, int width, int height, const std::string &path, JobSystem *jobs = NULL,
+                               ImageColor color = IMAGE_SRGB)
+{
+    const int tile = VirtualTextureHeader::TILE_SIZE, border = VirtualTextureHeader::BORDER, slot = tile + 2 * border;
+    if (width <= 0 || height <= 0 || (width & (width - 1)) || (height & (height - 1)) || std::max(width, height) > tile << 12)
+    {
+        std::cout << "ERROR::VTEX::SIZE: " << width << "x" << height << " isn't a power of two no bigger than " << (tile << 12) << std::endl;
+        return false;
+    }
+    VirtualTextureHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "VTEX", 4);
+    h.version = VirtualTextureHeader::VERSION;
+    h.width = width;
+    h.height = height;
+    h.tileSize = tile;
+    h.border = border;
+    h.tileBytes = (uint64_t)slot * slot * 4;
+    h.offset = (sizeof(h) + 4095) & ~(uint64_t)4095; // tiles start on a page
+    uint32_t tiles = 0;
+    for (h.levels = 0; h.levels == 0 || (width >> (h.levels - 1)) > tile || (height >> (h.levels - 1)) > tile; h.levels++)
+    {
+        h.firstTile[h.levels] = tiles;
+        h.tilesX[h.levels] = (std::max(width >> h.levels, 1) + tile - 1) / tile;
+        h.tilesY[h.levels] = (std::max(height >> h.levels, 1) + tile - 1) / tile;
+        tiles += h.tilesX[h.levels] * h.tilesY[h.levels];
+    }
+
+    std::string temporary = path + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "wb");
+    if (!out)
+        return false;
+    std::vector<unsigned char> padding(h.offset - sizeof(h), 0), texels(h.tileBytes), levels[2];
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(&padding[0], 1, padding.size(), out) == padding.size();
+    const unsigned char *level = pixels;
+    for (unsigned int l = 0; ok && l < h.levels; l++)
+    {
+        int w = std::max(width >> l, 1), hgt = std::max(height >> l, 1);
+        if (l > 0)
+        {
+            std::vector<unsigned char> &next = levels[l & 1];
+            next.resize((size_t)w * hgt * 4);
+            downsampleImage(level, std::max(width >> (l - 1), 1), std::max(height >> (l - 1), 1), 4, &next[0], FILTER_KAISER, color, jobs);
+            level = &next[0];
+        }
+        for (unsigned int ty = 0; ok && ty < h.tilesY[l]; ty++)
+            for (unsigned int tx = 0; ok && tx < h.tilesX[l]; tx++)
+            {
+                for (int y = 0; y < slot; y++)
+                {
+                    int sy = std::min(std::max((int)ty * tile + y - border, 0), hgt - 1);
+                    for (int x = 0; x < slot; x++)
+                    {
+                        int sx = std::min(std::max((int)tx * tile + x - border, 0), w - 1);
+                        memcpy(&texels[((size_t)y * slot + x) * 4], level + ((size_t)sy * w + sx) * 4, 4);
+                    }
+                }
+                ok = fwrite(&texels[0], 1, texels.size(), out) == texels.size();
+            }
+    }
+    ok = fclose(out) == 0 && ok;
+    if (ok)
+    {
+        remove(path.c_str());
+        ok = rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        std::cout << "ERROR::VTEX::CANNOT_WRITE: " << path << std::endl;
+        remove(temporary.c_str());
+    }
+    return ok;
+}
+
+// the same from an image file, decoded by stb_image
+inline bool bakeVirtualTexture(const std::string &source, const std::string &path, JobSystem *jobs = NULL, ImageColor color = IMAGE_SRGB)
+{
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(source.c_str(), &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        std::cout << "ERROR::VTEX::CANNOT_DECODE: " << source << " (" << stbi_failure_reason() << ")" << std::endl;
+        return false;
+    }
+    bool ok = bakeVirtualTexture(pixels, width, height, path, jobs, color);
+    stbi_image_free(pixels);
+    return ok;
+}
+
+// GLSL (330 core) for shaders drawing with a virtual texture: vtSample(uv) in place of
+// texture(), and vtFeedback(uv) as the colour of the feedback pass, which says which
+// tile each fragment would sample. The uniforms come from VirtualTexture::setUniforms().
+inline const char *virtualTextureGlsl()
+{
+    return "uniform sampler2D vtIndirection;\n" // per level and tile: its cache slot and level, or an ancestor's
+           "uniform sampler2D vtCache;\n"
+           "uniform vec3 vtSize;\n"      // virtual width and height in texels, level count
+           "uniform vec3 vtTiles;\n"     // tile size, border and slot size in texels
+           "uniform vec2 vtCacheSize;\n" // in texels
+           "uniform float vtLevelBias;\n" // log2 of how much smaller the feedback target is than the screen
+           "float vtLevel(vec2 uv)\n"
+           "{\n"
+           "   vec2 dx = dFdx(uv * vtSize.xy), dy = dFdy(uv * vtSize.xy);\n"
+           "   return clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - vtLevelBias), 0.0, vtSize.z - 1.0);\n"
+           "}\n"
+           "vec2 vtTexel(vec2 uv, float level)\n"
+           "{\n"
+           "   vec2 levelSize = max(floor(vtSize.xy * exp2(-level)), vec2(1.0));\n"
+           "   return min(clamp(uv, 0.0, 1.0) * levelSize, levelSize - 0.001);\n"
+           "}\n"
+           "vec4 vtFeedback(vec2 uv)\n"
+           "{\n"
+           "   float level = vtLevel(uv);\n"
+           "   ivec2 tile = ivec2(vtTexel(uv, level) / vtTiles.x);\n"
+           "   return vec4(tile.x & 255, tile.y & 255, (tile.x >> 8) | ((tile.y >> 8) << 4), level + 1.0) / 255.0;\n"
+           "}\n"
+           "vec4 vtSample(vec2 uv)\n"
+           "{\n"
+           "   vec4 entry = floor(textureLod(vtIndirection, uv, vtLevel(uv)) * 255.0 + 0.5);\n"
+           "   vec2 texel = vtTexel(uv, entry.z);\n"
+           "   vec2 position = entry.xy * vtTiles.z + vtTiles.y + texel - floor(texel / vtTiles.x) * vtTiles.x;\n"
+           "   return textureLod(vtCache, position / vtCacheSize, 0.0);\n"
+           "}\n";
+}
+
+// a texture far bigger than VRAM, drawn from a fixed-size cache: the tile file is
+// mapped, and only the tiles the feedback pass asks for are copied into slots of one
+// physical cache texture, the least recently used evicted to make room. An
+// indirection texture, one texel per tile and one mip level per level, says where
+// each tile is in the cache; a tile that isn't there points at its nearest resident
+// ancestor, so the view is blurry for a few frames instead of wrong. The single tile
+// of the coarsest level is pinned so there always is one.
+//
+// Per frame: request() what the feedback pass read back, update() to decide what
+// moves in and out (CPU only), then upload() on the GL thread before drawing.
+class VirtualTexture
+{
+public:
+    unsigned int tilesPerFrame; // tiles update() brings in at most
+    uint64_t hits, misses, loads, evictions;
+    unsigned int starvedFrames; // frames wanting more tiles than the cache holds
+
+    VirtualTexture(int cacheSlotsX = 16, int cacheSlotsY = 16)
+    {
+        slotsX = std::min(std::max(cacheSlotsX, 1), 256);
+        slotsY = std::min(std::max(cacheSlotsY, 1), 256);
+        tilesPerFrame = 16;
+        hits = misses = loads = evictions = 0;
+        starvedFrames = 0;
+        header = NULL;
+        cacheTexture = indirectionTexture = 0;
+        frame = 0;
+        head = tail = -1;
+    }
+
+    ~VirtualTexture() { deleteTextures(); }
+
+    // false if the file is missing or isn't a tile file
+    bool open(const std::string &path)
+    {
+        header = NULL;
+        if (!file.open(path.c_str()) || file.size < sizeof(VirtualTextureHeader))
+            return false;
+        const VirtualTextureHeader *h = (const VirtualTextureHeader *)file.data;
+        if (memcmp(h->magic, "VTEX", 4) || h->version != VirtualTextureHeader::VERSION || h->levels == 0 ||
+            h->levels > VirtualTextureHeader::MAX_LEVELS || h->tilesX[h->levels - 1] != 1 || h->tilesY[h->levels - 1] != 1 ||
+            h->tilesX[0] > 4096 || h->tilesY[0] > 4096)
+            return false;
+        uint64_t tiles = h->firstTile[h->levels - 1] + 1;
+        if (h->offset > file.size || h->tileBytes != (uint64_t)slotSize(h) * slotSize(h) * 4 || tiles > (file.size - h->offset) / h->tileBytes)
+            return false;
+#ifndef _WIN32
+        madvise((void *)file.data, file.size, MADV_RANDOM); // tiles are read wherever the camera is
+#endif
+        header = h;
+
+        tileSlot.assign(tiles, -1);
+        requestFrame.assign(tiles, 0);
+        requestCount.assign(tiles, 0);
+        requests.clear();
+        slots.assign(slotsX * slotsY, Slot());
+        freeSlots.clear();
+        for (int s = slotsX * slotsY - 1; s >= 0; s--)
+            freeSlots.push_back(s);
+        head = tail = -1;
+        pending.clear();
+
+        // the coarsest tile, pinned: outside the LRU list, never evicted
+        int top = freeSlots.back();
+        freeSlots.pop_back();
+        slots[top].tile = (int)tiles - 1;
+        tileSlot[tiles - 1] = top;
+        pending.push_back(top);
+
+        for (unsigned int l = 0; l < h->levels; l++)
+        {
+            indirection[l].assign((size_t)h->tilesX[l] * h->tilesY[l], 0);
+            Rect all = {0, 0, (int)h->tilesX[l], (int)h->tilesY[l]};
+            changed[l] = dirty[l] = all;
+        }
+        rebuildIndirection();
+        return true;
+    }
+
+    int width() const { return header->width; }
+    int height() const { return header->height; }
+    int levels() const { return header->levels; }
+    int tilesX(int level) const { return header->tilesX[level]; }
+    int tilesY(int level) const { return header->tilesY[level]; }
+    int slotCount() const { return slotsX * slotsY; }
+    // a tile as stored, slotSize() texels a side with its border
+    const unsigned char *tile(int level, int x, int y) const { return file.data + header->offset + tileIndex(level, x, y) * header->tileBytes; }
+    int slotSize() const { return slotSize(header); }
+    bool resident(int level, int x, int y) const { return tileSlot[tileIndex(level, x, y)] >= 0; }
+    // the tile in a cache slot, false if it's free
+    bool slotTile(int slot, int &level, int &x, int &y) const
+    {
+        if (slots[slot].tile < 0)
+            return false;
+        tileCoordinates(slots[slot].tile, level, x, y);
+        return true;
+    }
+    // the indirection texels of a level, RGBA8 as (slot x, slot y, level, 255)
+    const uint32_t *indirectionLevel(int level) const { return &indirection[level][0]; }
+
+    // what the feedback pass wrote, count RGBA8 texels: (x, y, high bits of both,
+    // level + 1) of the tile each fragment wanted, 0 alpha where nothing was drawn
+    void request(const unsigned char *feedback, size_t count)
+    {
+        for (size_t i = 0; i < count; i++, feedback += 4)
+            if (feedback[3])
+                requestTile(feedback[3] - 1, feedback[0] | (feedback[2] & 15) << 8, feedback[1] | (feedback[2] >> 4) << 8);
+    }
+
+    // a tile wanted this frame; its ancestors come with it, so the fallback is never
+    // far from what's asked for
+    void requestTile(int level, int x, int y)
+    {
+        if (level < 0 || level >= (int)header->levels || x < 0 || y < 0 || x >= tilesX(level) || y >= tilesY(level))
+            return;
+        requestCount[tileIndex(level, x, y)]++;
+        for (; level < (int)header->levels; level++, x /= 2, y /= 2)
+        {
+            uint32_t index = tileIndex(level, std::min(x, tilesX(level) - 1), std::min(y, tilesY(level) - 1));
+            if (requestFrame[index] == frame + 1)
+                break;
+            requestFrame[index] = frame + 1;
+            requests.push_back(index);
+        }
+    }
+
+    // CPU: keeps the requested tiles that are in the cache, brings in up to
+    // tilesPerFrame that aren't, coarsest first and then the most asked for, in place
+    // of the least recently used that weren't asked for this frame, and updates the
+    // indirection to match
+    void update()
+    {
+        frame++;
+        std::vector<uint32_t> missing;
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            int s = tileSlot[requests[i]];
+            if (s >= 0)
+                touch(s);
+            else
+                missing.push_back(requests[i]);
+        }
+        hits += requests.size() - missing.size();
+        misses += missing.size();
+        std::sort(missing.begin(), missing.end(), [this](uint32_t a, uint32_t b) {
+            int levelA = tileLevel(a), levelB = tileLevel(b);
+            return levelA != levelB ? levelA > levelB : requestCount[a] > requestCount[b];
+        });
+        for (size_t i = 0; i < missing.size() && i < tilesPerFrame; i++)
+        {
+            int s = takeSlot();
+            if (s < 0)
+            {
+                starvedFrames++;
+                break;
+            }
+            slots[s].tile = missing[i];
+            tileSlot[missing[i]] = s;
+            touch(s);
+            markTile(missing[i]);
+            pending.push_back(s);
+            loads++;
+        }
+        for (size_t i = 0; i < requests.size(); i++)
+            requestCount[requests[i]] = 0;
+        requests.clear();
+        rebuildIndirection();
+    }
+
+    // GL thread, with the context current: the textures, before the first upload();
+    // false if the indirection or the cache is bigger than GL_MAX_TEXTURE_SIZE
+    bool init()
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (std::max(tilesX(0), tilesY(0)) > maxSize || std::max(slotsX, slotsY) * slotSize() > maxSize)
+        {
+            std::cout << "ERROR::VTEX::TOO_LARGE: " << tilesX(0) << "x" << tilesY(0) << " tiles or a " << slotsX * slotSize() << "x"
+                      << slotsY * slotSize() << " cache past GL_MAX_TEXTURE_SIZE " << maxSize << std::endl;
+            return false;
+        }
+        glGenTextures(1, &cacheTexture);
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, slotsX * slotSize(), slotsY * slotSize(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenTextures(1, &indirectionTexture);
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        for (unsigned int l = 0; l < header->levels; l++)
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, tilesX(l), tilesY(l), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        for (unsigned int l = 0; l < header->levels; l++)
+        {
+            Rect all = {0, 0, tilesX(l), tilesY(l)};
+            dirty[l] = all;
+        }
+        return true;
+    }
+
+    // GL thread: the tiles update() brought in, straight from the mapping, then the
+    // changed rectangle of each indirection level; returns the bytes sent
+    uint64_t upload()
+    {
+        uint64_t bytes = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            int s = pending[i], level, x, y;
+            tileCoordinates(slots[s].tile, level, x, y);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, s % slotsX * slotSize(), s / slotsX * slotSize(), slotSize(), slotSize(), GL_RGBA, GL_UNSIGNED_BYTE,
+                            tile(level, x, y));
+            bytes += header->tileBytes;
+        }
+        pending.clear();
+
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        for (unsigned int l = 0; l < header->levels; l++)
+        {
+            Rect &r = dirty[l];
+            if (r.x0 >= r.x1)
+                continue;
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, tilesX(l));
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y0);
+            glTexSubImage2D(GL_TEXTURE_2D, l, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, GL_RGBA, GL_UNSIGNED_BYTE, &indirection[l][0]);
+            bytes += (uint64_t)(r.x1 - r.x0) * (r.y1 - r.y0) * 4;
+            r.x0 = r.y0 = r.x1 = r.y1 = 0;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return bytes;
+    }
+
+    // GL thread, program in use: binds the indirection and cache textures to the two
+    // units given and sets the uniforms virtualTextureGlsl() declares; levelBias is
+    // log2 of how much smaller the feedback target is, for the feedback pass only
+    void setUniforms(unsigned int program, int indirectionUnit, int cacheUnit, float levelBias = 0.0f) const
+    {
+        glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        glActiveTexture(GL_TEXTURE0 + cacheUnit);
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(program, "vtIndirection"), indirectionUnit);
+        glUniform1i(glGetUniformLocation(program, "vtCache"), cacheUnit);
+        glUniform3f(glGetUniformLocation(program, "vtSize"), (float)width(), (float)height(), (float)levels());
+        glUniform3f(glGetUniformLocation(program, "vtTiles"), (float)header->tileSize, (float)header->border, (float)slotSize());
+        glUniform2f(glGetUniformLocation(program, "vtCacheSize"), (float)(slotsX * slotSize()), (float)(slotsY * slotSize()));
+        glUniform1f(glGetUniformLocation(program, "vtLevelBias"), levelBias);
+    }
+
+    // GL thread
+    void deleteTextures()
+    {
+        if (cacheTexture)
+            glDeleteTextures(1, &cacheTexture);
+        if (indirectionTexture)
+            glDeleteTextures(1, &indirectionTexture);
+        cacheTexture = indirectionTexture = 0;
+    }
+
+private:
+    struct Slot
+    {
+        int tile;           // -1 when free
+        uint32_t lastUsed;  // the frame it was last asked for
+        int previous, next; // in the LRU list, most recent first
+        Slot() : tile(-1), lastUsed(0), previous(-1), next(-1) {}
+    };
+
+    struct Rect
+    {
+        int x0, y0, x1, y1; // x1, y1 exclusive; empty when x0 >= x1
+    };
+
+    MappedFile file;
+    const VirtualTextureHeader *header;
+    int slotsX, slotsY;
+    unsigned int cacheTexture, indirectionTexture;
+    uint32_t frame;
+    std::vector<int> tileSlot;           // per tile, its slot or -1
+    std::vector<uint32_t> requestFrame;  // per tile, frame + 1 once requested for it
+    std::vector<uint32_t> requestCount;  // per tile, feedback texels asking for it this frame
+    std::vector<uint32_t> requests;      // tiles requested this frame
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    int head, tail;                      // of the LRU list
+    std::vector<int> pending;            // slots whose tile isn't uploaded yet
+    std::vector<uint32_t> indirection[VirtualTextureHeader::MAX_LEVELS];
+    Rect changed[VirtualTextureHeader::MAX_LEVELS]; // tiles in or out since the last rebuild
+    Rect dirty[VirtualTextureHeader::MAX_LEVELS];   // indirection texels not uploaded yet
+
+    static int slotSize(const VirtualTextureHeader *h) { return h->tileSize + 2 * h->border; }
+
+    uint32_t tileIndex(int level, int x, int y) const { return header->firstTile[level] + y * header->tilesX[level] + x; }
+
+    int tileLevel(uint32_t index) const
+    {
+        int level = 0;
+        while (level + 1 < (int)header->levels && index >= header->firstTile[level + 1])
+            level++;
+        return level;
+    }
+
+    void tileCoordinates(uint32_t index, int &level, int &x, int &y) const
+    {
+        level = tileLevel(index);
+        x = (index - header->firstTile[level]) % header->tilesX[level];
+        y = (index - header->firstTile[level]) / header->tilesX[level];
+    }
+
+    void unlink(int s)
+    {
+        Slot &slot = slots[s];
+        (slot.previous >= 0 ? slots[slot.previous].next : head) = slot.next;
+        (slot.next >= 0 ? slots[slot.next].previous : tail) = slot.previous;
+        slot.previous = slot.next = -1;
+    }
+
+    // asked for this frame: to the front of the LRU list, unless it's the pinned one
+    void touch(int s)
+    {
+        if (slots[s].tile == (int)tileSlot.size() - 1)
+            return;
+        if (slots[s].previous >= 0 || head == s)
+            unlink(s);
+        slots[s].lastUsed = frame;
+        slots[s].next = head;
+        (head >= 0 ? slots[head].previous : tail) = s;
+        head = s;
+    }
+
+    // a free slot, else the least recently used one emptied, else -1 when every tile
+    // in the cache was asked for this frame
+    int takeSlot()
+    {
+        if (!freeSlots.empty())
+        {
+            int s = freeSlots.back();
+            freeSlots.pop_back();
+            return s;
+        }
+        int s = tail;
+        if (s < 0 || slots[s].lastUsed == frame)
+            return -1;
+        unlink(s);
+        tileSlot[slots[s].tile] = -1;
+        markTile(slots[s].tile);
+        slots[s].tile = -1;
+        evictions++;
+        return s;
+    }
+
+    static void grow(Rect &r, const Rect &other)
+    {
+        if (other.x0 >= other.x1)
+            return;
+        if (r.x0 >= r.x1)
+        {
+            r = other;
+            return;
+        }
+        r.x0 = std::min(r.x0, other.x0);
+        r.y0 = std::min(r.y0, other.y0);
+        r.x1 = std::max(r.x1, other.x1);
+        r.y1 = std::max(r.y1, other.y1);
+    }
+
+    void markTile(uint32_t index)
+    {
+        int level, x, y;
+        tileCoordinates(index, level, x, y);
+        Rect tile = {x, y, x + 1, y + 1};
+        grow(changed[level], tile);
+    }
+
+    // coarse to fine, each level's changed rectangle grown by the children of the one
+    // above it: a resident tile points at its own slot, any other at what its parent does
+    void rebuildIndirection()
+    {
+        for (int l = header->levels - 1; l >= 0; l--)
+        {
+            Rect &r = changed[l];
+            if (l + 1 < (int)header->levels && changed[l + 1].x0 < changed[l + 1].x1)
+            {
+                const Rect &above = changed[l + 1];
+                Rect children = {above.x0 * 2, above.y0 * 2, std::min(above.x1 * 2, tilesX(l)), std::min(above.y1 * 2, tilesY(l))};
+                grow(r, children);
+            }
+            for (int y = r.y0; y < r.y1; y++)
+                for (int x = r.x0; x < r.x1; x++)
+                {
+                    int s = tileSlot[tileIndex(l, x, y)];
+                    if (s >= 0)
+                        indirection[l][(size_t)y * tilesX(l) + x] = (uint32_t)(s % slotsX) | (uint32_t)(s / slotsX) << 8 | (uint32_t)l << 16 | 0xff000000u;
+                    else if (l + 1 < (int)header->levels)
+                        indirection[l][(size_t)y * tilesX(l) + x] =
+                            indirection[l + 1][(size_t)std::min(y / 2, tilesY(l + 1) - 1) * tilesX(l + 1) + std::min(x / 2, tilesX(l + 1) - 1)];
+                }
+            grow(dirty[l], r);
+        }
+        // the coarser levels' rectangles were needed until the finest was done
+        for (unsigned int l = 0; l < header->levels; l++)
+            changed[l].x0 = changed[l].y0 = changed[l].x1 = changed[l].y1 = 0;
+    }
+
+    VirtualTexture(const VirtualTexture &);
+    VirtualTexture &operator=(const VirtualTexture &);
+};
+
+// the feedback pass's target, a fraction of the screen's size, read back through two
+// pixel pack buffers: end() starts this frame's copy, read() maps last frame's, which
+// the GPU has long finished, so reading back never waits on it
+class VirtualTextureFeedback
+{
+public:
+    VirtualTextureFeedback()
+    {
+        width = height = 0;
+        framebuffer = color = depth = 0;
+        buffers[0] = buffers[1] = 0;
+        frames = 0;
+    }
+
+    // GL thread: a width x height target, e.g. an eighth of the screen each way
+    void init(int targetWidth, int targetHeight)
+    {
+        width = targetWidth;
+        height = targetHeight;
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VTEX::FEEDBACK_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glGenBuffers(2, buffers);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        frames = 0;
+    }
+
+    // log2 of how much smaller the target is than a screen screenWidth wide, for
+    // VirtualTexture::setUniforms() in the feedback pass
+    float levelBias(int screenWidth) const { return std::log2((float)screenWidth / width); }
+
+    // GL thread: draw the feedback pass after this, with vtFeedback(uv) as the colour
+    void begin()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // GL thread: starts this frame's readback and goes back to the default framebuffer;
+    // the caller restores its viewport and clear colour
+    void end()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[frames & 1]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        frames++;
+    }
+
+    // GL thread: hands the previous frame's feedback to texture; false before there is any
+    bool read(VirtualTexture &texture)
+    {
+        if (frames < 2)
+            return false;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[frames & 1]);
+        const unsigned char *texels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+        if (texels)
+        {
+            texture.request(texels, (size_t)width * height);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return texels != NULL;
+    }
+
+    // GL thread
+    void deleteBuffers()
+    {
+        if (framebuffer)
+            glDeleteFramebuffers(1, &framebuffer);
+        if (color)
+            glDeleteRenderbuffers(1, &color);
+        if (depth)
+            glDeleteRenderbuffers(1, &depth);
+        if (buffers[0])
+            glDeleteBuffers(2, buffers);
+        framebuffer = color = depth = 0;
+        buffers[0] = buffers[1] = 0;
+    }
+
+private:
+    int width, height;
+    unsigned int framebuffer, color, depth;
+    unsigned int buffers[2];
+    unsigned int frames;
+};
+
+#endif